@@ -15,6 +15,14 @@
  * simulator uses a segmented memory model, dividing memory into 5 separate
  * segments. There are segments for the user data and text, kernel data and
  * text, and a stack segment that is shared between the user and kernel space.
+ * Addresses are mapped to the segments through a page table, which maps each
+ * page of a segment the first time that it is accessed, so that each access is
+ * translated in constant time, and recent translations are cached in a
+ * software TLB. The segments' pages are also only given host memory once they
+ * are used, so a large segment costs nothing until it is touched. Alternately,
+ * in the flat mode, the whole guest address space is reserved in host memory,
+ * with each segment mapped at its guest address, so that each access is a
+ * plain host memory access.
  *
  * Authors:
  *  - 2016 - 2017: Brandon Perez
@@ -30,6 +38,7 @@
 
 // Standard Includes
 #include <stdint.h>             // Fixed-size integral types
+#include <stdbool.h>            // Boolean type and definitions
 
 // Local Includes
 #include "riscv_abi.h"          // Definition of the number of memory regions
@@ -47,20 +56,165 @@ typedef struct {
     uint32_t max_size;          // Maximum permitted size for the memory segment
     uint32_t size;              // Size of the memory segment in bytes
     uint8_t *mem;               // Actual memory buffer for the segment
+    uint8_t *dirty_pages;       // Per page, the MEM_DIRTY flags for its writes
+    uint32_t copy_offset;       // Offset of the loaded bytes that were copied
+    uint32_t copy_size;         // Number of loaded bytes that were copied
+    uint8_t *copy;              // Saved copy of those bytes, or NULL if none
     const char *extension;      // File extension for the segment's data file
     const char *name;           // Name of the segment, for debugging purposes
 } mem_segment_t;
 
+// A symbol from the loaded program's symbol table
+typedef struct mem_symbol {
+    uint32_t addr;              // Address of the code or data it names
+    uint32_t size;              // Size of the code or data, or 0 if unknown
+    const char *name;           // Name of the symbol
+} mem_symbol_t;
+
+// The number of state registers that each memory-mapped device has
+#define MEM_DEVICE_NUM_REGS     4
+
+/* A memory-mapped device, whose registers occupy a region of the address space
+ * outside of every segment. Accesses to the region are only dispatched to the
+ * device once the segment lookup fails, so they never take the RAM fast path.
+ * The callbacks get the offset of the access in the region, and its size (1,
+ * 2, or 4 bytes). A missing callback makes the access do nothing, and read
+ * as zero. */
+typedef struct mem_device {
+    uint32_t base_addr;         // Base address of the device's region
+    uint32_t size;              // Size of the device's region in bytes
+    const char *name;           // Name of the device, for debugging purposes
+    uint32_t (*read)(struct cpu_state *cpu_state, struct mem_device *device,
+            uint32_t offset, uint32_t size);
+    void (*write)(struct cpu_state *cpu_state, struct mem_device *device,
+            uint32_t offset, uint32_t size, uint32_t value);
+    uint32_t regs[MEM_DEVICE_NUM_REGS]; // State of the device, for callbacks
+} mem_device_t;
+
+/* The flags that track the writes to each page of a segment, which are set when
+ * the page is written, and cleared when its contents are saved or restored. */
+#define MEM_DIRTY_LOAD          0x1     // Written since the program was loaded
+#define MEM_DIRTY_CHECKPOINT    0x2     // Written since the last checkpoint
+#define MEM_DIRTY_ALL           (MEM_DIRTY_LOAD | MEM_DIRTY_CHECKPOINT)
+
+/* Addresses are translated to host memory through a two-level page table. The
+ * top bits of an address select a second-level table, the middle bits select
+ * the page within it, and the low bits are the offset within the page. Pages
+ * are mapped into the table when they are first accessed, so the table stays
+ * sparse for large segments. */
+#define MEM_PAGE_BITS           12
+#define MEM_TABLE_BITS          10
+#define MEM_DIR_BITS            (32 - MEM_TABLE_BITS - MEM_PAGE_BITS)
+
+// The size of a page, and the number of entries at each level of the table
+#define MEM_PAGE_SIZE           (1U << MEM_PAGE_BITS)
+#define MEM_TABLE_ENTRIES       (1U << MEM_TABLE_BITS)
+#define MEM_DIR_ENTRIES         (1U << MEM_DIR_BITS)
+
+// The translation of a page of the address space to host memory
+typedef struct mem_page {
+    uint8_t *host;              // Host address of the start of the page
+    mem_segment_t *segment;     // Segment that contains the page
+    uint32_t limit;             // Number of valid bytes in the page, 0 if none
+} mem_page_t;
+
+/* Recent translations are cached in a small direct-mapped software TLB, with
+ * separate tables for instruction fetches, loads, and stores. An access hits
+ * if its offset from the start of the entry's page, rotated so that the bits
+ * below the access size's alignment become the top bits, is less than the
+ * number of valid accesses of that size in the page. Thus, a hit is a single
+ * compare for any size, and misaligned accesses always miss. The store table
+ * only holds pages that may be written directly, so its entries carry the
+ * write permission. */
+#define MEM_TLB_BITS            6
+#define MEM_TLB_ENTRIES         (1U << MEM_TLB_BITS)
+
+// A cached translation of a guest page to host memory
+typedef struct mem_tlb_entry {
+    uint32_t page_addr;         // Address of the start of the page
+    uint32_t num_words;         // Number of valid words in the page, 0 if empty
+    uint8_t *host;              // Host address of the start of the page
+} mem_tlb_entry_t;
+
+// A software TLB for one kind of access, along with its statistics
+typedef struct mem_tlb {
+    mem_tlb_entry_t entries[MEM_TLB_ENTRIES];   // Direct-mapped entries
+    uint64_t hits;              // Number of accesses that hit in the TLB
+    uint64_t misses;            // Number of accesses that missed in the TLB
+} mem_tlb_t;
+
+/* The most segments whose last page is only partly in the segment, which the
+ * flat mode checks accesses to. */
+#define MEM_FLAT_MAX_TAILS      8
+
+// A segment's last page in the flat mode, if the segment ends partway in it
+typedef struct mem_flat_tail {
+    uint32_t page_addr;         // Address of the start of the page
+    uint32_t size;              // Number of bytes of the page in the segment
+} mem_flat_tail_t;
+
 // The representation for all the memory in the processor
 typedef struct memory {
     int num_segments;           // Number of memory segments
     mem_segment_t *segments;    // Memory segments in the CPU
+    int num_devices;            // Number of memory-mapped devices
+    mem_device_t *devices;      // Memory-mapped devices in the CPU
+    mem_page_t *page_tables[MEM_DIR_ENTRIES];   // Second-level tables, or NULL
+    mem_tlb_t fetch_tlb;        // Translations for instruction fetches
+    mem_tlb_t load_tlb;         // Translations for loads
+    mem_tlb_t store_tlb;        // Translations for stores
+    uint8_t *flat_base;         // Host base of the flat address space, or NULL
+    uint64_t flat_tail_mask;    // Bits of the flat tails' page numbers mod 64
+    int num_flat_tails;         // Number of segments that end partway in a page
+    mem_flat_tail_t flat_tails[MEM_FLAT_MAX_TAILS];     // Their last pages
+    uint32_t entry_point;       // Address of the program's first instruction
+    int num_symbols;            // Number of symbols in the program
+    mem_symbol_t *symbols;      // Program's symbols sorted by address, or NULL
+    char *symbol_names;         // Storage for the names of the symbols
+    bool loaded;                // Indicates if a program is loaded
+    bool file_backed;           // Indicates if the segments map program files
+    char *checkpoint_path;      // File with the checkpoints' base, or NULL
 } memory_t;
 
 /*----------------------------------------------------------------------------
  * Interface
  *----------------------------------------------------------------------------*/
 
+/**
+ * Reads the byte at the specified address in the processor's memory.
+ *
+ * If the address is invalid, then this function will mark the CPU as halted,
+ * and print out an error message.
+ *
+ * Inputs:
+ *  - cpu_state     The CPU state structure for the processor.
+ *  - addr          The address from which to read the byte.
+ *
+ * Outputs:
+ *  - cpu_state     If the address is invalid, the halted field will be set to
+ *                  true.
+ *  - return        The byte at the given address in the CPU's memory.
+ **/
+uint8_t mem_read8(struct cpu_state *cpu_state, uint32_t addr);
+
+/**
+ * Reads the halfword at the specified address in the processor's memory, in
+ * little-endian order.
+ *
+ * If the address is invalid or it is not aligned to a 2-byte boundary, then
+ * this function will mark the CPU as halted, and print out an error message.
+ *
+ * Inputs:
+ *  - cpu_state     The CPU state structure for the processor.
+ *  - addr          The address from which to read the halfword.
+ *
+ * Outputs:
+ *  - cpu_state     If the address is misaligned or invalid, the halted field
+ *                  will be set to true.
+ *  - return        The halfword at the given address in the CPU's memory.
+ **/
+uint16_t mem_read16(struct cpu_state *cpu_state, uint32_t addr);
+
 /**
  * Reads the value at the specified address in the processor's memory.
  *
@@ -80,6 +234,60 @@ typedef struct memory {
  **/
 uint32_t mem_read32(struct cpu_state *cpu_state, uint32_t addr);
 
+/**
+ * Fetches the instruction at the specified address in the processor's memory.
+ *
+ * This behaves the same as mem_read32, except that the translation is cached
+ * in the fetch TLB instead of the load TLB, so that instruction fetches do not
+ * evict the translations used by the program's loads.
+ *
+ * Inputs:
+ *  - cpu_state     The CPU state structure for the processor.
+ *  - addr          The address from which to fetch the instruction.
+ *
+ * Outputs:
+ *  - cpu_state     If the address is misaligned or invalid, the halted field
+ *                  will be set to true.
+ *  - return        The instruction word at the given address.
+ **/
+uint32_t mem_fetch32(struct cpu_state *cpu_state, uint32_t addr);
+
+/**
+ * Writes the byte to the given address in the processor's memory.
+ *
+ * If the address is invalid, then this function will mark the CPU as halted,
+ * and no update to memory happens.
+ *
+ * Inputs:
+ *  - cpu_state     The CPU state structure for the processor.
+ *  - addr          The address to which to write the byte.
+ *  - value         The byte to write to the given address.
+ *
+ * Outputs:
+ *  - cpu_state     If the address is invalid, the halted field will be set to
+ *                  true. The processor memory is also appropriately updated.
+ **/
+void mem_write8(struct cpu_state *cpu_state, uint32_t addr, uint8_t value);
+
+/**
+ * Writes the halfword to the given address in the processor's memory, in
+ * little-endian order.
+ *
+ * If the address is invalid or it is not aligned to a 2-byte boundary, then
+ * this function will mark the CPU as halted, and no update to memory happens.
+ *
+ * Inputs:
+ *  - cpu_state     The CPU state structure for the processor.
+ *  - addr          The address to which to write the halfword.
+ *  - value         The halfword to write to the given address.
+ *
+ * Outputs:
+ *  - cpu_state     If the address is misaligned or invalid, the halted field
+ *                  will be set to true. The processor memory is also
+ *                  appropriately updated.
+ **/
+void mem_write16(struct cpu_state *cpu_state, uint32_t addr, uint16_t value);
+
 /**
  * Writes the specified value to the given address in the processor's memory.
  *
@@ -100,4 +308,16 @@ uint32_t mem_read32(struct cpu_state *cpu_state, uint32_t addr);
  **/
 void mem_write32(struct cpu_state *cpu_state, uint32_t addr, uint32_t value);
 
+/**
+ * Finds the symbol in the loaded program that names the code or data at the
+ * given address, for profiling and tracing. This is the symbol with the
+ * highest address at or below the address, so long as the address lies within
+ * the symbol's size, if it has one.
+ *
+ * Returns NULL if there is no such symbol, including if the program was not
+ * loaded from an executable with a symbol table.
+ **/
+const mem_symbol_t *mem_find_symbol(const struct cpu_state *cpu_state,
+        uint32_t addr);
+
 #endif /* MEMORY_H_ */
@@ -0,0 +1,150 @@
+/**
+ * riscvsim.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the simulator library, libriscvsim,
+ * which lets other programs run the simulator without its shell.
+ *
+ * Each instance of the simulator is a separate processor, with its own memory
+ * and its own flag to stop it, so any number of instances can be used in one
+ * process, and each instance can be used on its own thread. An instance must
+ * not be used by two threads at once, except to stop it. An instance that uses
+ * the flat memory mode must be created, run, and destroyed on the same thread,
+ * and each thread can only have one such instance at a time.
+ *
+ * The library leaves the signals of the process alone, with one exception. It
+ * never installs a SIGINT handler, or reads the flag that the simulator's shell
+ * sets on a SIGINT, since each instance is only stopped by riscvsim_stop. But
+ * the first instance to use the flat memory mode installs a SIGSEGV handler for
+ * the whole process, which stays installed. Faults outside of the instances'
+ * flat address spaces are passed on to the SIGSEGV action from before it, so a
+ * program with its own handler should install it before creating any flat mode
+ * instance, or else pass on the faults that it does not handle itself.
+ *
+ * Unless noted, the functions print an error message and return a negative
+ * error code on failure.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+#ifndef RISCVSIM_H_
+#define RISCVSIM_H_
+
+// Standard Includes
+#include <stdbool.h>                    // Boolean type and definitions
+#include <stdint.h>                     // Fixed-size integral types
+
+// Local Includes
+#include "sim.h"                        // Definition of sim_engine_t
+
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+// Marks the functions that the library exports, as its other symbols are hidden
+#define RISCVSIM_API    __attribute__((visibility("default")))
+
+// An instance of the simulator, whose contents are private to the library
+typedef struct riscvsim riscvsim_t;
+
+// The options for creating an instance of the simulator
+typedef struct riscvsim_options {
+    sim_engine_t engine;                // Engine used to run instructions
+    bool flat_memory;                   // Indicates if the flat mode is used
+    uint32_t stack_size;                // Stack size in bytes, 0 for default
+} riscvsim_options_t;
+
+// How a run of the loaded program ended
+typedef enum riscvsim_status {
+    RISCVSIM_HALTED,                    // The program halted with the ECALL
+    RISCVSIM_FAULTED,                   // The program stopped on an error
+    RISCVSIM_LIMIT,                     // The instruction limit was reached
+    RISCVSIM_STOPPED,                   // The run was stopped by riscvsim_stop
+} riscvsim_status_t;
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Creates an instance of the simulator with the given options, or with the
+ * default options if they are NULL, which are the interpreter, the paged
+ * memory mode, and the default stack size. No program is loaded. Returns NULL
+ * on failure.
+ **/
+RISCVSIM_API riscvsim_t *riscvsim_create(const riscvsim_options_t *options);
+
+/**
+ * Destroys the instance, unloading its program, and freeing all of its memory.
+ **/
+RISCVSIM_API void riscvsim_destroy(riscvsim_t *sim);
+
+/**
+ * Loads the given program, replacing any loaded program, and resets the
+ * registers. The path is the same as the one given to the simulator on the
+ * command line, and any extension on it is ignored.
+ **/
+RISCVSIM_API int riscvsim_load(riscvsim_t *sim, const char *program_path);
+
+/**
+ * Runs the loaded program until it halts, or until the given maximum number of
+ * instructions have retired, if it is not 0. A run that reached the limit can
+ * be continued with another call. Returns how the run ended, or a negative
+ * error code if no program is loaded.
+ **/
+RISCVSIM_API int riscvsim_run(riscvsim_t *sim, uint32_t max_instrs);
+
+/**
+ * Stops the instance's current run, or its next run if there is none, which
+ * then returns RISCVSIM_STOPPED. This can be called from any thread, or from a
+ * signal handler.
+ **/
+RISCVSIM_API void riscvsim_stop(riscvsim_t *sim);
+
+/**
+ * Gets the number of instructions that the loaded program has retired.
+ **/
+RISCVSIM_API uint64_t riscvsim_instructions(const riscvsim_t *sim);
+
+/**
+ * Gets the program counter, which is the address of the next instruction.
+ **/
+RISCVSIM_API uint32_t riscvsim_read_pc(const riscvsim_t *sim);
+
+/**
+ * Reads the value of the given register, x0 to x31.
+ **/
+RISCVSIM_API int riscvsim_read_register(const riscvsim_t *sim,
+        unsigned int reg, uint32_t *value);
+
+/**
+ * Writes the value to the given register, x0 to x31. Writes to x0 are ignored.
+ **/
+RISCVSIM_API int riscvsim_write_register(riscvsim_t *sim, unsigned int reg,
+        uint32_t value);
+
+/**
+ * Reads the given number of bytes at the address from the loaded program's
+ * memory. The whole range must lie in its memory segments, and not in the
+ * memory-mapped devices.
+ **/
+RISCVSIM_API int riscvsim_read_memory(const riscvsim_t *sim, uint32_t addr,
+        void *data, uint32_t size);
+
+/**
+ * Writes the given number of bytes to the address in the loaded program's
+ * memory. The whole range must lie in its memory segments, and not in the
+ * memory-mapped devices. Writes to the program's text take effect the next
+ * time that the instructions are run.
+ **/
+RISCVSIM_API int riscvsim_write_memory(riscvsim_t *sim, uint32_t addr,
+        const void *data, uint32_t size);
+
+#endif /* RISCVSIM_H_ */
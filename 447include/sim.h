@@ -33,15 +33,52 @@
  * Definitions
  *----------------------------------------------------------------------------*/
 
+// Forward declaration of the predecoded text segment, defined by the core
+struct decode_cache;
+
+// The execution engines that the simulator can use to run instructions
+typedef enum sim_engine {
+    SIM_ENGINE_INTERPRETER,             // Reference engine, one call per cycle
+    SIM_ENGINE_THREADED,                // Threaded-code (computed goto) engine
+    SIM_ENGINE_BLOCK,                   // Basic-block translation engine
+    SIM_ENGINE_JIT,                     // Native x86-64 code for hot blocks
+    SIM_ENGINE_AOT,                     // Ahead-of-time translation to C
+} sim_engine_t;
+
+// The reasons that a batch of instructions stopped running
+typedef enum sim_stop {
+    SIM_STOP_HALTED,                    // The processor was halted
+    SIM_STOP_BUDGET,                    // The maximum instructions were run
+    SIM_STOP_INTERRUPTED,               // The interrupt flag was set
+} sim_stop_t;
+
+// The reasons that the processor was halted
+typedef enum sim_halt {
+    SIM_HALT_NONE,                      // The processor is running
+    SIM_HALT_ECALL,                     // The program halted with an ECALL
+    SIM_HALT_ERROR,                     // A memory or decode error occurred
+    SIM_HALT_STOPPED,                   // No program is loaded or running
+} sim_halt_t;
+
+// The outcome of running a batch of instructions
+typedef struct sim_result {
+    int retired;                        // Number of instructions retired
+    sim_stop_t stop;                    // Reason that the batch stopped
+} sim_result_t;
+
 // A structure representing all of the state in a processor.
 typedef struct cpu_state {
     bool verbose_mode;                  // Indicates if verbose mode is active
+    sim_engine_t engine;                // Engine used to run instructions
+    volatile bool *interrupt;           // Flag that stops batches, or NULL
     bool halted;                        // Indicates if the CPU is halted
-    int cycle;                          // Number of processor cycles
+    sim_halt_t halt_reason;             // Reason that the CPU was halted
+    uint64_t cycle;                     // Number of processor cycles
     uint32_t pc;                        // Current program counter
     char *program;                      // Name of the currently loaded program
     memory_t memory;                    // Processor memory segments
     uint32_t registers[RISCV_NUM_REGS]; // CPU register file
+    struct decode_cache *decode_cache;  // Predecoded user text segment
 } cpu_state_t;
 
 /*----------------------------------------------------------------------------
@@ -67,4 +104,151 @@ typedef struct cpu_state {
  **/
 void process_instruction(cpu_state_t *cpu_state);
 
+/**
+ * Simulates a batch of up to max_instrs cycles on the CPU.
+ *
+ * This runs the instructions with the CPU's selected engine in a single tight
+ * loop, and adds the number retired to the cycle count. The interrupt flag is
+ * only checked before and after the batch, so it should be sized to keep the
+ * simulator responsive. No batch is run if the processor is already halted or
+ * the interrupt flag is already set.
+ *
+ * Inputs:
+ *  - cpu_state     The current state of the CPU being simulated.
+ *  - max_instrs    The maximum number of instructions to simulate.
+ *
+ * Outputs:
+ *  - cpu_state     The state of the CPU after the simulated instructions,
+ *                  including the updated cycle count.
+ *  - return        The number of instructions retired, and why the batch
+ *                  stopped.
+ **/
+sim_result_t process_instructions(cpu_state_t *cpu_state, int max_instrs);
+
+/**
+ * Simulates up to max_instrs cycles on the CPU with the threaded-code engine.
+ *
+ * This has the same effect as calling process_instruction max_instrs times,
+ * but dispatches directly from one instruction to the next. Simulation stops
+ * early if the processor is halted.
+ *
+ * Inputs:
+ *  - cpu_state     The current state of the CPU being simulated.
+ *  - max_instrs    The maximum number of instructions to simulate.
+ *
+ * Outputs:
+ *  - cpu_state     The state of the CPU after the simulated instructions. The
+ *                  cycle field is not updated.
+ *  - return        The number of instructions that were simulated.
+ **/
+int process_instructions_threaded(cpu_state_t *cpu_state, int max_instrs);
+
+/**
+ * Simulates up to max_instrs cycles on the CPU with the basic-block engine.
+ *
+ * This has the same effect as calling process_instruction max_instrs times,
+ * but translates each basic block in the text segment once, and runs a whole
+ * block per dispatch, following direct links from each block to its
+ * successors. Simulation stops early if the processor is halted.
+ *
+ * Inputs:
+ *  - cpu_state     The current state of the CPU being simulated.
+ *  - max_instrs    The maximum number of instructions to simulate.
+ *
+ * Outputs:
+ *  - cpu_state     The state of the CPU after the simulated instructions. The
+ *                  cycle field is not updated.
+ *  - return        The number of instructions that were simulated.
+ **/
+int process_instructions_block(cpu_state_t *cpu_state, int max_instrs);
+
+/**
+ * Simulates up to max_instrs cycles on the CPU with the JIT engine.
+ *
+ * This has the same effect as calling process_instruction max_instrs times,
+ * but compiles hot basic blocks to native x86-64 code, holding the guest
+ * registers they use most in host registers. Blocks that are not yet hot run
+ * in the basic-block engine. Simulation stops early if the processor is
+ * halted.
+ *
+ * Inputs:
+ *  - cpu_state     The current state of the CPU being simulated.
+ *  - max_instrs    The maximum number of instructions to simulate.
+ *
+ * Outputs:
+ *  - cpu_state     The state of the CPU after the simulated instructions. The
+ *                  cycle field is not updated.
+ *  - return        The number of instructions that were simulated.
+ **/
+int process_instructions_jit(cpu_state_t *cpu_state, int max_instrs);
+
+/**
+ * Simulates up to max_instrs cycles on the CPU with the AOT engine.
+ *
+ * This has the same effect as calling process_instruction max_instrs times,
+ * but runs an ahead-of-time translation of the whole text segment to C, built
+ * into a shared object by the host compiler. The shared object is cached under
+ * a hash of the text segment, so a program is only translated once. Targets
+ * of indirect jumps that were not translated are run by the interpreter.
+ * Simulation stops early if the processor is halted.
+ *
+ * Inputs:
+ *  - cpu_state     The current state of the CPU being simulated.
+ *  - max_instrs    The maximum number of instructions to simulate.
+ *
+ * Outputs:
+ *  - cpu_state     The state of the CPU after the simulated instructions. The
+ *                  cycle field is not updated.
+ *  - return        The number of instructions that were simulated.
+ **/
+int process_instructions_aot(cpu_state_t *cpu_state, int max_instrs);
+
+/**
+ * Builds the predecoded form of the given text segment.
+ *
+ * This decodes every word in the segment once, so that the simulator does not
+ * have to re-extract the fields of an instruction each time it is executed.
+ * If the RISCV_SIM_DECODE_CACHE environment variable names a directory, then
+ * a segment that an earlier run saved there is loaded instead of decoded, and
+ * other segments are saved there once they are decoded. This is invoked by the
+ * memory subsystem once the program has been loaded. Exits on error.
+ *
+ * Inputs:
+ *  - cpu_state     The CPU state structure for the processor.
+ *  - segment       The loaded text segment to predecode.
+ *
+ * Outputs:
+ *  - cpu_state     The decode_cache field is updated with the predecoded
+ *                  instructions for the segment.
+ **/
+void decode_cache_build(cpu_state_t *cpu_state, const mem_segment_t *segment);
+
+/**
+ * Frees the predecoded text segment previously built by decode_cache_build.
+ *
+ * Inputs:
+ *  - cpu_state     The CPU state structure for the processor.
+ *
+ * Outputs:
+ *  - cpu_state     The decode_cache field is freed and set to NULL.
+ **/
+void decode_cache_free(cpu_state_t *cpu_state);
+
+/**
+ * Invalidates the predecoded entry for the word containing the given address.
+ *
+ * This must be invoked whenever memory in the predecoded text segment is
+ * written. The entry is re-decoded from the updated memory contents, and any
+ * translated basic blocks are discarded. Addresses outside of the predecoded
+ * text segment are ignored.
+ *
+ * Inputs:
+ *  - cpu_state     The CPU state structure for the processor.
+ *  - addr          The address that was written.
+ *
+ * Outputs:
+ *  - cpu_state     The predecoded entry for the address is updated.
+ **/
+void decode_cache_invalidate(cpu_state_t *cpu_state, uint32_t addr);
+
 #endif /* SIM_H_ */
@@ -0,0 +1,420 @@
+/**
+ * checkpoint.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the incremental checkpoints of the processor's state.
+ *
+ * A checkpoint file consists of a header, followed by one or more records. The
+ * first record is the base image, and each later record holds the changes
+ * since the one before it. All integers are stored in little-endian order.
+ *
+ *  - Header:   The magic number, the format version, and the number of memory
+ *              segments, as 32-bit integers.
+ *  - Record:   The record magic, the PC, the halt reason, the cycle count as a
+ *              64-bit integer, and the registers. Then, for each segment, its
+ *              base address, its size, and the number of pages in the record,
+ *              followed by each page as its index and its contents. Pages of
+ *              the base image that are all zeros are left out. The last page
+ *              of a segment only holds the bytes that lie in the segment.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+// Standard Includes
+#include <stdlib.h>                 // Malloc and related functions
+#include <stdio.h>                  // Printf and related functions
+#include <stdint.h>                 // Fixed-size integral types
+#include <stdbool.h>                // Definition of the boolean type
+#include <string.h>                 // String manipulation functions
+#include <errno.h>                  // Error codes
+
+// 18-447 Simulator Includes
+#include <sim.h>                    // Interface to the core simulator
+#include <memory.h>                 // Memory segments and their dirty pages
+
+// Local Includes
+#include "libc_extensions.h"        // Definition of array_len and min
+#include "memory_segments.h"        // Definition of memory segment constants
+#include "memory_shell.h"           // Interface to the processor memory
+#include "stream.h"                 // Little-endian binary streams
+#include "checkpoint.h"             // This file's interface
+
+/*----------------------------------------------------------------------------
+ * Internal Definitions
+ *----------------------------------------------------------------------------*/
+
+// The magic numbers that start a checkpoint file and each of its records
+static const uint32_t CHECKPOINT_MAGIC          = 0x4b433734;   // "47CK"
+static const uint32_t CHECKPOINT_RECORD_MAGIC   = 0x44434552;   // "RECD"
+
+// The version of the checkpoint file format
+static const uint32_t CHECKPOINT_VERSION        = 3;
+
+// A page of zeros, which pages are compared against to leave them out
+static const uint8_t ZERO_PAGE[MEM_PAGE_SIZE];
+
+/*----------------------------------------------------------------------------
+ * Saving Checkpoints
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Gets the number of pages in the segment's memory.
+ **/
+static uint32_t segment_num_pages(const mem_segment_t *segment)
+{
+    return (segment->size + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE;
+}
+
+/**
+ * Indicates if the given page of the segment holds any non-zero byte.
+ **/
+static bool page_nonzero(const mem_segment_t *segment, uint32_t page)
+{
+    uint32_t offset = page * MEM_PAGE_SIZE;
+    return memcmp(&segment->mem[offset], ZERO_PAGE,
+            min(MEM_PAGE_SIZE, segment->size - offset)) != 0;
+}
+
+/**
+ * Indicates if the given page of the segment is saved in a record. A base image
+ * saves every page that is not all zeros, and later records only the pages
+ * written since.
+ **/
+static bool page_saved(const mem_segment_t *segment, uint32_t page, bool base)
+{
+    return base ? page_nonzero(segment, page) :
+            (segment->dirty_pages[page] & MEM_DIRTY_CHECKPOINT);
+}
+
+/**
+ * Writes the segment's part of a record to the file. Returns false on failure.
+ **/
+static bool write_segment(stream_t *stream, const mem_segment_t *segment,
+        bool base)
+{
+    // Count the pages in the record, so that it can be read as a stream
+    uint32_t num_pages = (segment->mem != NULL) ?
+            segment_num_pages(segment) : 0;
+    uint32_t num_saved = 0;
+    for (uint32_t page = 0; page < num_pages; page++)
+    {
+        num_saved += page_saved(segment, page, base);
+    }
+
+    if (!stream_write_u32(stream, segment->base_addr) ||
+            !stream_write_u32(stream, segment->size) ||
+            !stream_write_u32(stream, num_saved)) {
+        return false;
+    }
+
+    for (uint32_t page = 0; page < num_pages; page++)
+    {
+        uint32_t offset = page * MEM_PAGE_SIZE;
+        uint32_t page_size = min(MEM_PAGE_SIZE, segment->size - offset);
+        if (!page_saved(segment, page, base)) {
+            continue;
+        } else if (!stream_write_u32(stream, page) ||
+                !stream_write(stream, &segment->mem[offset], page_size)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Writes a record of the CPU state, and the segment pages in it, to the file.
+ * Returns false on failure.
+ **/
+static bool write_record(stream_t *stream, const cpu_state_t *cpu_state,
+        bool base)
+{
+    if (!stream_write_u32(stream, CHECKPOINT_RECORD_MAGIC) ||
+            !stream_write_u32(stream, cpu_state->pc) ||
+            !stream_write_u32(stream, cpu_state->halt_reason) ||
+            !stream_write_u64(stream, cpu_state->cycle)) {
+        return false;
+    }
+
+    for (int i = 0; i < (int)array_len(cpu_state->registers); i++)
+    {
+        if (!stream_write_u32(stream, cpu_state->registers[i])) {
+            return false;
+        }
+    }
+
+    const memory_t *memory = &cpu_state->memory;
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        if (!write_segment(stream, &memory->segments[i], base)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Saves a checkpoint of the processor's state to the given file.
+ *
+ * If the file holds the previous checkpoint of the loaded program, then the CPU
+ * state and the pages written since that checkpoint are appended to it.
+ * Otherwise, the file is replaced with a base image of the whole state. Returns
+ * a negative error code on failure.
+ **/
+int checkpoint_save(cpu_state_t *cpu_state, const char *path)
+{
+    memory_t *memory = &cpu_state->memory;
+    if (!memory->loaded) {
+        fprintf(stderr, "Error: checkpoint: No program is loaded.\n");
+        return -ENOENT;
+    }
+
+    // Only extend the file if it holds the previous checkpoint
+    bool base = (memory->checkpoint_path == NULL ||
+            strcmp(memory->checkpoint_path, path) != 0);
+    FILE *file = fopen(path, base ? "wb" : "ab");
+    if (file == NULL) {
+        int rc = -errno;
+        fprintf(stderr, "Error: checkpoint: %s: Unable to open file: %s.\n",
+                path, strerror(errno));
+        return rc;
+    }
+
+    stream_t stream;
+    stream_init(&stream, file);
+    bool written = (!base || (stream_write_u32(&stream, CHECKPOINT_MAGIC) &&
+            stream_write_u32(&stream, CHECKPOINT_VERSION) &&
+            stream_write_u32(&stream, memory->num_segments))) &&
+            write_record(&stream, cpu_state, base);
+    if (fclose(file) != 0 || !written) {
+        int rc = -errno;
+        fprintf(stderr, "Error: checkpoint: %s: Unable to write file: %s.\n",
+                path, strerror(errno));
+        return rc;
+    }
+
+    // The next checkpoint only needs the pages written after this one
+    if (base) {
+        free(memory->checkpoint_path);
+        memory->checkpoint_path = strdup(path);
+    }
+    mem_clear_checkpoint_dirty(cpu_state);
+    return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * Restoring Checkpoints
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Reads the segment's part of a record from the file, and copies its pages
+ * into the segment. The base image leaves out its zero pages, so the segment is
+ * cleared before it is applied. Returns a negative error code on failure.
+ **/
+static int read_segment(stream_t *stream, mem_segment_t *segment,
+        const char *path, bool base)
+{
+    uint32_t base_addr, size, num_saved;
+    if (!stream_read_u32(stream, &base_addr) ||
+            !stream_read_u32(stream, &size) ||
+            !stream_read_u32(stream, &num_saved)) {
+        return -EIO;
+    } else if (base_addr != segment->base_addr || size != segment->size) {
+        fprintf(stderr, "Error: restore: %s: The %s segment does not match the "
+                "loaded program.\n", path, segment->name);
+        return -EINVAL;
+    }
+
+    // Only clear the pages that are not already zero, to leave the rest clean
+    uint32_t num_pages = (segment->mem != NULL) ?
+            segment_num_pages(segment) : 0;
+    for (uint32_t page = 0; base && page < num_pages; page++)
+    {
+        if (page_nonzero(segment, page)) {
+            uint32_t offset = page * MEM_PAGE_SIZE;
+            mem_write_segment(segment, offset, ZERO_PAGE,
+                    min(MEM_PAGE_SIZE, segment->size - offset));
+        }
+    }
+
+    uint8_t page_data[MEM_PAGE_SIZE];
+    for (uint32_t i = 0; i < num_saved; i++)
+    {
+        uint32_t page;
+        if (!stream_read_u32(stream, &page)) {
+            return -EIO;
+        } else if (page >= segment_num_pages(segment)) {
+            fprintf(stderr, "Error: restore: %s: Page %u is outside of the %s "
+                    "segment.\n", path, page, segment->name);
+            return -EINVAL;
+        }
+
+        uint32_t offset = page * MEM_PAGE_SIZE;
+        uint32_t page_size = min(MEM_PAGE_SIZE, segment->size - offset);
+        if (!stream_read(stream, page_data, page_size)) {
+            return -EIO;
+        }
+        mem_write_segment(segment, offset, page_data, page_size);
+    }
+
+    return 0;
+}
+
+/**
+ * Reads a record from the file, and applies it to the processor's state. Sets
+ * the end flag instead if the file has no more records. Returns a negative
+ * error code on failure.
+ **/
+static int read_record(stream_t *stream, cpu_state_t *cpu_state,
+        const char *path, bool base, bool *end)
+{
+    // The file may only end between records
+    int next = getc(stream->file);
+    *end = (next == EOF && !ferror(stream->file));
+    if (*end) {
+        return 0;
+    }
+
+    uint32_t magic;
+    if (next == EOF || ungetc(next, stream->file) == EOF ||
+            !stream_read_u32(stream, &magic)) {
+        return -EIO;
+    } else if (magic != CHECKPOINT_RECORD_MAGIC) {
+        fprintf(stderr, "Error: restore: %s: Corrupted checkpoint record.\n",
+                path);
+        return -EINVAL;
+    }
+
+    uint32_t pc, halt_reason;
+    uint64_t cycle;
+    if (!stream_read_u32(stream, &pc) ||
+            !stream_read_u32(stream, &halt_reason) ||
+            !stream_read_u64(stream, &cycle)) {
+        return -EIO;
+    } else if (halt_reason > SIM_HALT_STOPPED) {
+        fprintf(stderr, "Error: restore: %s: Corrupted checkpoint record.\n",
+                path);
+        return -EINVAL;
+    }
+    cpu_state->pc = pc;
+    cpu_state->halted = (halt_reason != SIM_HALT_NONE);
+    cpu_state->halt_reason = halt_reason;
+    cpu_state->cycle = cycle;
+
+    for (int i = 0; i < (int)array_len(cpu_state->registers); i++)
+    {
+        if (!stream_read_u32(stream, &cpu_state->registers[i])) {
+            return -EIO;
+        }
+    }
+
+    memory_t *memory = &cpu_state->memory;
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        int rc = read_segment(stream, &memory->segments[i], path,
+                base);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Restores the processor's state from the given checkpoint file.
+ *
+ * The base image and every later checkpoint in the file are applied in order,
+ * so the processor is left in the state of the file's last checkpoint. The
+ * loaded program must have the same memory layout as the one that the file was
+ * saved from, and later checkpoints to the file extend it. Returns a negative
+ * error code on failure.
+ **/
+int checkpoint_restore(cpu_state_t *cpu_state, const char *path)
+{
+    memory_t *memory = &cpu_state->memory;
+    if (!memory->loaded) {
+        fprintf(stderr, "Error: restore: No program is loaded.\n");
+        return -ENOENT;
+    }
+
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        int rc = -errno;
+        fprintf(stderr, "Error: restore: %s: Unable to open file: %s.\n", path,
+                strerror(errno));
+        return rc;
+    }
+
+    // Check the header, before any of the processor's state is changed
+    stream_t stream;
+    stream_init(&stream, file);
+    uint32_t magic, version, num_segments;
+    if (!stream_read_u32(&stream, &magic) ||
+            !stream_read_u32(&stream, &version) ||
+            !stream_read_u32(&stream, &num_segments) ||
+            magic != CHECKPOINT_MAGIC) {
+        fprintf(stderr, "Error: restore: %s: Not a checkpoint file.\n", path);
+        fclose(file);
+        return -EINVAL;
+    } else if (version != CHECKPOINT_VERSION) {
+        fprintf(stderr, "Error: restore: %s: Unsupported checkpoint version "
+                "%u.\n", path, version);
+        fclose(file);
+        return -EINVAL;
+    } else if (num_segments != (uint32_t)memory->num_segments) {
+        fprintf(stderr, "Error: restore: %s: The memory segments do not match "
+                "the loaded program.\n", path);
+        fclose(file);
+        return -EINVAL;
+    }
+
+    // Apply each of the records in order
+    int rc = 0;
+    int num_records = 0;
+    bool end = false;
+    while (rc == 0 && !end)
+    {
+        rc = read_record(&stream, cpu_state, path, num_records == 0,
+                &end);
+        num_records += (rc == 0 && !end);
+    }
+    fclose(file);
+
+    if (rc == -EIO || (rc == 0 && num_records == 0)) {
+        fprintf(stderr, "Error: restore: %s: The checkpoint file is "
+                "truncated.\n", path);
+        rc = -EIO;
+    }
+
+    /* The predecoded text segment is rebuilt from the restored text. If the
+     * restore failed partway, the processor's state is incomplete, so it is
+     * halted. */
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        const mem_segment_t *segment = &memory->segments[i];
+        if (segment->base_addr == USER_TEXT_START && segment->mem != NULL) {
+            decode_cache_free(cpu_state);
+            decode_cache_build(cpu_state, segment);
+        }
+    }
+    if (rc < 0) {
+        cpu_state->halted = true;
+        cpu_state->halt_reason = SIM_HALT_STOPPED;
+        return rc;
+    }
+
+    // Later checkpoints to the same file extend it from the restored state
+    free(memory->checkpoint_path);
+    memory->checkpoint_path = strdup(path);
+    mem_clear_checkpoint_dirty(cpu_state);
+    return 0;
+}
@@ -0,0 +1,55 @@
+/**
+ * checkpoint.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the incremental checkpoints of the
+ * processor's state.
+ *
+ * A checkpoint file starts with a base image of the CPU state and every memory
+ * segment, leaving out the pages that are all zeros. Each later checkpoint to
+ * the same file appends a record with the CPU state and only the pages that
+ * were written since the previous one, so saving the state of a long run does
+ * not require a full memory dump.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+#ifndef CHECKPOINT_H_
+#define CHECKPOINT_H_
+
+// 18-447 Simulator Includes
+#include <sim.h>                // Definition of cpu_state_t
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Saves a checkpoint of the processor's state to the given file.
+ *
+ * If the file holds the previous checkpoint of the loaded program, then the CPU
+ * state and the pages written since that checkpoint are appended to it.
+ * Otherwise, the file is replaced with a base image of the whole state. Returns
+ * a negative error code on failure.
+ **/
+int checkpoint_save(cpu_state_t *cpu_state, const char *path);
+
+/**
+ * Restores the processor's state from the given checkpoint file.
+ *
+ * The base image and every later checkpoint in the file are applied in order,
+ * so the processor is left in the state of the file's last checkpoint. The
+ * loaded program must have the same memory layout as the one that the file was
+ * saved from, and later checkpoints to the file extend it. Returns a negative
+ * error code on failure.
+ **/
+int checkpoint_restore(cpu_state_t *cpu_state, const char *path);
+
+#endif /* CHECKPOINT_H_ */
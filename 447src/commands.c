@@ -31,6 +31,7 @@
 #include <limits.h>                 // Limits for integer types
 #include <assert.h>                 // Assert macro
 #include <errno.h>                  // Error codes and perror
+#include <inttypes.h>               // Format specifiers for fixed-size types
 
 // 18-447 Simulator Includes
 #include <sim.h>                    // Definition of cpu_state_t
@@ -40,8 +41,20 @@
 #include "memory_shell.h"           // Interface to the processor memory
 #include "libc_extensions.h"        // Parsing functions, array_len, Snprintf
 #include "riscv_register_names.h"   // Names for the RISC-V registers
+#include "checkpoint.h"             // Incremental checkpoints of the state
+#include "snapshot.h"               // Self-contained snapshots of the state
+#include "verify.h"                 // Verification against reference dumps
 #include "commands.h"               // This file's interface
 
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+/* Indicates that a SIGINT signal was received by the program. This is set by
+ * the shell's handler, and only stops the processors that point to it, so each
+ * processor in the simulator library has its own flag instead. */
+volatile bool SIGINT_RECEIVED = false;
+
 /*----------------------------------------------------------------------------
  * Shared Helper Functions
  *----------------------------------------------------------------------------*/
@@ -102,20 +115,30 @@ static const int STEP_MAX_NUM_ARGS      = 1;
 // The expected number of arguments for the go command
 static const int GO_NUM_ARGS            = 0;
 
+/* The maximum number of cycles the simulator runs in a batch before checking
+ * for a keyboard interrupt. */
+static const int SIM_BATCH_SIZE         = 1 << 16;
+
 /**
- * Run the simulator for a single cycle, incrementing the instruction count.
+ * Runs the simulator for a batch of up to max_cycles cycles. Verbose mode needs
+ * a register dump after every cycle, so it runs batches of a single cycle.
  **/
-static void run_simulator(cpu_state_t *cpu_state)
+static sim_result_t run_simulator(cpu_state_t *cpu_state, int max_cycles)
 {
-    // Run the simulator for a cycle, then the increment instruction count
-    process_instruction(cpu_state);
-    cpu_state->cycle += 1;
+    if (cpu_state->verbose_mode) {
+        max_cycles = 1;
+    } else if (max_cycles > SIM_BATCH_SIZE) {
+        max_cycles = SIM_BATCH_SIZE;
+    }
+
+    // Run the batch, which also increments the instruction count
+    sim_result_t result = process_instructions(cpu_state, max_cycles);
 
     // If the user has activated verbose mode, then perform a register dump
-    if (cpu_state->verbose_mode) {
+    if (cpu_state->verbose_mode && result.retired > 0) {
         command_rdump(cpu_state, NULL, 0);
     }
-    return;
+    return result;
 }
 
 /**
@@ -148,12 +171,21 @@ void command_step(cpu_state_t *cpu_state, char *args[], int num_args)
     }
 
     /* Run the simulator for the specified number of cycles, or until the
-     * processor is halted. */
-    for (int i = 0; i < num_cycles && !cpu_state->halted; i++)
+     * processor is halted or the user interrupts it. */
+    SIGINT_RECEIVED = false;
+    sim_result_t result = { .retired = 0, .stop = SIM_STOP_BUDGET };
+    for (int i = 0; i < num_cycles && result.stop == SIM_STOP_BUDGET;
+            i += result.retired)
     {
-        run_simulator(cpu_state);
+        result = run_simulator(cpu_state, num_cycles - i);
     }
 
+    // Tell the user if they interrupted execution, and reset the received flag
+    if (result.stop == SIM_STOP_INTERRUPTED) {
+        fprintf(stdout, "\nExecution interrupted by the user, stopping.\n");
+    }
+    SIGINT_RECEIVED = false;
+
     return;
 }
 
@@ -184,13 +216,14 @@ void command_go(cpu_state_t *cpu_state, char *args[], int num_args)
     /* Run the simulator until the processor is halted or the user tells us to
      * stop with a keyboard interrupt (SIGINT). */
     SIGINT_RECEIVED = false;
-    while (!cpu_state->halted && !SIGINT_RECEIVED)
+    sim_result_t result;
+    do
     {
-        run_simulator(cpu_state);
-    }
+        result = run_simulator(cpu_state, SIM_BATCH_SIZE);
+    } while (result.stop == SIM_STOP_BUDGET);
 
     // Tell the user if they interrupted execution, and reset the received flag
-    if (SIGINT_RECEIVED) {
+    if (result.stop == SIM_STOP_INTERRUPTED) {
         fprintf(stdout, "\nExecution interrupted by the user, stopping.\n");
     }
     SIGINT_RECEIVED = false;
@@ -297,6 +330,20 @@ static void print_register(cpu_state_t *cpu_state, riscv_isa_reg_t reg_num,
     return;
 }
 
+/**
+ * Prints out the header for the registers, followed by the value of each
+ * general purpose register, to the file.
+ **/
+static void print_registers(cpu_state_t *cpu_state, FILE *file)
+{
+    print_register_header(file);
+    for (int i = 0; i < (int)array_len(cpu_state->registers); i++)
+    {
+        print_register(cpu_state, i, file);
+    }
+    return;
+}
+
 /**
  * Prints out information about the current CPU state to the file.
  **/
@@ -304,7 +351,7 @@ static void print_cpu_state(const cpu_state_t *cpu_state, FILE* file)
 {
     ssize_t width = fprintf(file, "Current CPU State and Register Values:\n");
     print_separator('-', width-1, file);
-    fprintf(file, "%-20s = %d\n", "Cycle", cpu_state->cycle);
+    fprintf(file, "%-20s = %" PRIu64 "\n", "Cycle", cpu_state->cycle);
     fprintf(file, "%-20s = 0x%08x\n", "Program Counter (PC)", cpu_state->pc);
     return;
 }
@@ -387,19 +434,13 @@ void command_rdump(cpu_state_t *cpu_state, char *args[], int num_args)
         return;
     }
 
-    /* Print out the current CPU state, and the header for the registers.
-     * The current CPU state is not printed to dump files. */
+    /* Print out the current CPU state, and the registers. The current CPU
+     * state is not printed to dump files. */
     if (dump_file == stdout) {
         print_cpu_state(cpu_state, dump_file);
         fprintf(dump_file, "\n");
     }
-    print_register_header(dump_file);
-
-    // Print out all of the general purpose register values
-    for (int i = 0; i < (int)array_len(cpu_state->registers); i++)
-    {
-        print_register(cpu_state, i, dump_file);
-    }
+    print_registers(cpu_state, dump_file);
 
     // Close the dump file if it was specified by the user
     close_dump_file(dump_file);
@@ -519,8 +560,13 @@ void command_mem(cpu_state_t *cpu_state, char *args[], int num_args)
         return;
     }
 
-    // Update the memory location with the new value
+    /* Update the memory location with the new value. An unaligned address
+     * splits the value across two words, which are both decoded again. */
     mem_write_word(segment, addr, mem_value);
+    decode_cache_invalidate(cpu_state, addr);
+    if ((end_addr - 1) / sizeof(uint32_t) != addr / sizeof(uint32_t)) {
+        decode_cache_invalidate(cpu_state, end_addr - 1);
+    }
     return;
 }
 
@@ -617,11 +663,13 @@ int init_cpu_state(cpu_state_t *cpu_state, char *program_path)
     int rc = mem_load_program(cpu_state, program_path);
     if (rc < 0) {
         cpu_state->halted = true;
+        cpu_state->halt_reason = SIM_HALT_STOPPED;
         return rc;
     }
 
     // Mark the CPU as running, and save the name of the loaded program
     cpu_state->halted = false;
+    cpu_state->halt_reason = SIM_HALT_NONE;
     cpu_state->program = program_path;
 
     return rc;
@@ -645,10 +693,20 @@ void command_restart(cpu_state_t *cpu_state, char *args[], int num_args)
         return;
     }
 
-    // Unload the program on the processor
-    mem_unload_program(cpu_state);
+    /* Reset the CPU state, and restore the memory to the program's loaded
+     * image, which only touches the pages that the program wrote. */
+    cpu_state->cycle = 0;
+    memset(cpu_state->registers, 0, sizeof(cpu_state->registers));
+    if (mem_reset_program(cpu_state) == 0) {
+        cpu_state->halted = false;
+        cpu_state->halt_reason = SIM_HALT_NONE;
+        return;
+    }
 
-    // Reinitialize the CPU state and reload the program, exit on failure
+    /* Otherwise, no program is loaded, or its memory was replaced by a
+     * snapshot, so unload the processor's memory, then reinitialize the CPU
+     * state and reload the program, exit on failure. */
+    mem_unload_program(cpu_state);
     int rc = init_cpu_state(cpu_state, cpu_state->program);
     if (rc < 0) {
         fprintf(stderr, "Error: restart: Unable to restart program. Exiting "
@@ -691,6 +749,145 @@ void command_load(cpu_state_t *cpu_state, char *args[], int num_args)
     return;
 }
 
+/*----------------------------------------------------------------------------
+ * Checkpoint and Restore Commands
+ *----------------------------------------------------------------------------*/
+
+// The expected number of arguments for the checkpoint and restore commands
+static const int CHECKPOINT_NUM_ARGS    = 1;
+static const int RESTORE_NUM_ARGS       = 1;
+
+/**
+ * Saves a checkpoint of the processor's state to the specified file.
+ *
+ * The first checkpoint to a file writes a base image of the whole state, and
+ * each later one appends only the CPU state and the memory pages that were
+ * written since the previous checkpoint.
+ **/
+void command_checkpoint(cpu_state_t *cpu_state, char *args[], int num_args)
+{
+    // Check that the appropriate number of arguments was specified
+    if (num_args != CHECKPOINT_NUM_ARGS) {
+        fprintf(stderr, "Error: checkpoint: Improper number of arguments "
+                "specified.\n");
+        return;
+    }
+
+    checkpoint_save(cpu_state, args[0]);
+    return;
+}
+
+/**
+ * Restores the processor's state from the last checkpoint in the specified
+ * file.
+ *
+ * The currently loaded program must be the one that the checkpoints were saved
+ * from.
+ **/
+void command_restore(cpu_state_t *cpu_state, char *args[], int num_args)
+{
+    // Check that the appropriate number of arguments was specified
+    if (num_args != RESTORE_NUM_ARGS) {
+        fprintf(stderr, "Error: restore: Improper number of arguments "
+                "specified.\n");
+        return;
+    }
+
+    checkpoint_restore(cpu_state, args[0]);
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * Snapshot Commands
+ *----------------------------------------------------------------------------*/
+
+// The expected number of arguments for the save and load-snapshot commands
+static const int SAVE_NUM_ARGS          = 1;
+static const int LOAD_SNAPSHOT_NUM_ARGS = 1;
+
+/**
+ * Saves a snapshot of the processor's whole state to the specified file.
+ **/
+void command_save(cpu_state_t *cpu_state, char *args[], int num_args)
+{
+    // Check that the appropriate number of arguments was specified
+    if (num_args != SAVE_NUM_ARGS) {
+        fprintf(stderr, "Error: save: Improper number of arguments "
+                "specified.\n");
+        return;
+    }
+
+    snapshot_save(cpu_state, args[0]);
+    return;
+}
+
+/**
+ * Loads the processor's whole state from the snapshot in the specified file.
+ *
+ * The snapshot replaces the processor's memory, so it does not need to be
+ * saved from the currently loaded program.
+ **/
+void command_load_snapshot(cpu_state_t *cpu_state, char *args[], int num_args)
+{
+    // Check that the appropriate number of arguments was specified
+    if (num_args != LOAD_SNAPSHOT_NUM_ARGS) {
+        fprintf(stderr, "Error: load-snapshot: Improper number of arguments "
+                "specified.\n");
+        return;
+    }
+
+    snapshot_load(cpu_state, args[0]);
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * TLB Command
+ *----------------------------------------------------------------------------*/
+
+// The expected number of arguments for the tlb command
+static const int TLB_NUM_ARGS           = 0;
+
+/**
+ * Prints out the hit and miss counts for the given TLB on one line to the
+ * file, along with its hit rate.
+ **/
+static void print_tlb_stats(const char *name, const mem_tlb_t *tlb, FILE *file)
+{
+    uint64_t accesses = tlb->hits + tlb->misses;
+    double hit_rate = (accesses == 0) ? 0.0 : 100.0 * tlb->hits / accesses;
+    fprintf(file, "%-6s  %-14" PRIu64 "  %-14" PRIu64 "  %.2f%%\n", name,
+            tlb->hits, tlb->misses, hit_rate);
+    return;
+}
+
+/**
+ * Displays the hit and miss counts of the software TLB.
+ *
+ * The counts are kept separately for instruction fetches, loads, and stores,
+ * and are reset whenever a program is loaded or restarted.
+ **/
+void command_tlb(cpu_state_t *cpu_state, char *args[], int num_args)
+{
+    // Silence unused variable warnings from the compiler
+    (void)args;
+
+    // Check that the appropriate number of arguments was specified
+    if (num_args != TLB_NUM_ARGS) {
+        fprintf(stderr, "Error: tlb: Improper number of arguments "
+                "specified.\n");
+        return;
+    }
+
+    const memory_t *memory = &cpu_state->memory;
+    ssize_t width = fprintf(stdout, "%-6s  %-14s  %-14s  %s\n", "TLB", "Hits",
+            "Misses", "Hit Rate");
+    print_separator('-', width-1, stdout);
+    print_tlb_stats("Fetch", &memory->fetch_tlb, stdout);
+    print_tlb_stats("Load", &memory->load_tlb, stdout);
+    print_tlb_stats("Store", &memory->store_tlb, stdout);
+    return;
+}
+
 /*----------------------------------------------------------------------------
  * Verbose and Quit Commands
  *----------------------------------------------------------------------------*/
@@ -741,6 +938,7 @@ bool command_quit(cpu_state_t *cpu_state, char *args[], int num_args)
 
     // Indicate that we should quit
     cpu_state->halted = true;
+    cpu_state->halt_reason = SIM_HALT_STOPPED;
     return true;
 }
 
@@ -814,6 +1012,22 @@ void command_help(cpu_state_t *cpu_state, char *args[], int num_args)
     print_help("load <program>", "Reset the processor and load the new program "
             "into memory for execution.");
 
+    // Print help messages for the checkpoint and restore commands
+    print_help("checkpoint <file>", "Save a checkpoint of the processor to "
+            "the file, appending only the changes if it has the last one.");
+    print_help("restore <file>", "Restore the processor to the last "
+            "checkpoint in the file.");
+
+    // Print help messages for the snapshot commands
+    print_help("save <file>", "Save a snapshot of the processor's whole state "
+            "to the file.");
+    print_help("load-snapshot <file>", "Replace the processor's whole state "
+            "with the snapshot in the file.");
+
+    // Print help message for the TLB statistics command
+    print_help("tlb", "Display the hit and miss counts of the software TLB "
+            "for fetches, loads, and stores.");
+
     // Print help message for the verbose, quit, and help commands
     print_help("v[erbose]", "Toggles verbose mode for the simulator. When "
             "active, the simulator dumps the registers after each cycle.");
@@ -824,3 +1038,170 @@ void command_help(cpu_state_t *cpu_state, char *args[], int num_args)
 
     return;
 }
+
+/*----------------------------------------------------------------------------
+ * Batch Mode
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Dumps the registers to the file at the given path, in the same format as the
+ * rdump command. Returns a negative error code on failure.
+ **/
+static int dump_registers(cpu_state_t *cpu_state, const char *rdump_path)
+{
+    FILE *dump_file = fopen(rdump_path, "w");
+    if (dump_file == NULL) {
+        int rc = -errno;
+        fprintf(stderr, "Error: %s: Unable to open file: %s.\n", rdump_path,
+                strerror(errno));
+        return rc;
+    }
+
+    print_registers(cpu_state, dump_file);
+    bool failed = ferror(dump_file);
+    if (fclose(dump_file) != 0 || failed) {
+        fprintf(stderr, "Error: %s: Unable to write the register dump.\n",
+                rdump_path);
+        return -EIO;
+    }
+    return 0;
+}
+
+/**
+ * Gets the name for the outcome of a run, as used in the verification result.
+ **/
+const char *batch_outcome_name(batch_status_t status)
+{
+    switch (status)
+    {
+        case BATCH_HALTED:
+            return "halted";
+        case BATCH_FAULTED:
+            return "faulted";
+        case BATCH_LIMIT:
+            return "limit";
+        case BATCH_INTERRUPTED:
+            return "interrupted";
+        default:
+            return "unknown";
+    }
+}
+
+/**
+ * Verifies the registers against the reference, writing the result as JSON to
+ * the file at the given path, or stdout if it is NULL. Returns the exit status
+ * for the verification of a run with the given outcome.
+ **/
+static batch_status_t verify_run(cpu_state_t *cpu_state,
+        const verify_reference_t *reference, batch_status_t status,
+        const char *json_path)
+{
+    FILE *json_file = stdout;
+    if (json_path != NULL) {
+        json_file = fopen(json_path, "w");
+        if (json_file == NULL) {
+            fprintf(stderr, "Error: %s: Unable to open file: %s.\n", json_path,
+                    strerror(errno));
+            return BATCH_DUMP_FAILED;
+        }
+    }
+
+    // A run that stops on an error is complete, as the reference may be too
+    bool completed = (status == BATCH_HALTED || status == BATCH_FAULTED);
+    int num_mismatches = verify_registers(cpu_state, reference,
+            batch_outcome_name(status), completed, json_file);
+    bool failed = (fflush(json_file) != 0 || ferror(json_file));
+    if (json_file != stdout) {
+        failed = (fclose(json_file) != 0 || failed);
+    }
+
+    if (failed) {
+        fprintf(stderr, "Error: %s: Unable to write the verification "
+                "result.\n", (json_path == NULL) ? "stdout" : json_path);
+        return BATCH_DUMP_FAILED;
+    } else if (!completed) {
+        return status;
+    }
+    return (num_mismatches == 0) ? BATCH_HALTED : BATCH_MISMATCH;
+}
+
+/**
+ * Runs the loaded program until it halts, or until the given maximum number of
+ * instructions have retired, if it is not 0, and determines how the run ended.
+ *
+ * The keyboard interrupt flag is left alone, so that several processors can
+ * run programs at once on different threads. The caller resets it as needed.
+ **/
+batch_status_t run_program(cpu_state_t *cpu_state, uint32_t max_instrs)
+{
+    /* Run the simulator until the processor is halted, it reaches the limit,
+     * or it is stopped by a keyboard interrupt (SIGINT). */
+    sim_result_t result = { .retired = 0, .stop = SIM_STOP_BUDGET };
+    uint32_t retired = 0;
+    while (result.stop == SIM_STOP_BUDGET &&
+            (max_instrs == 0 || retired < max_instrs))
+    {
+        uint32_t budget = SIM_BATCH_SIZE;
+        if (max_instrs != 0 && max_instrs - retired < budget) {
+            budget = max_instrs - retired;
+        }
+        result = run_simulator(cpu_state, budget);
+        retired += result.retired;
+    }
+
+    // Determine why the run stopped
+    if (result.stop == SIM_STOP_INTERRUPTED) {
+        return BATCH_INTERRUPTED;
+    } else if (!cpu_state->halted) {
+        return BATCH_LIMIT;
+    } else if (cpu_state->halt_reason != SIM_HALT_ECALL) {
+        return BATCH_FAULTED;
+    }
+    return BATCH_HALTED;
+}
+
+/**
+ * Runs the loaded program without the shell, until it halts, or until the
+ * options' maximum number of instructions have retired, if it is not 0.
+ *
+ * Afterwards, the registers are dumped to the options' file, if there is one,
+ * whatever the outcome of the run, so that a failing run can still be compared
+ * against its reference. If the options have a reference dump, then the
+ * registers are also verified against it, writing the result as JSON to the
+ * options' file, or stdout if there is none.
+ *
+ * Returns the exit status for the outcome. When verifying, a run that stops on
+ * an error passes if its registers match, since the reference may record such
+ * a run. A failed dump takes precedence over the outcome of the run.
+ **/
+batch_status_t run_batch(cpu_state_t *cpu_state,
+        const batch_options_t *options)
+{
+    // Read the reference first, so that a bad reference does not waste a run
+    verify_reference_t reference;
+    if (options->verify_path != NULL && verify_load_reference(&reference,
+                options->verify_path) < 0) {
+        return BATCH_BAD_REFERENCE;
+    }
+
+    // Run the program, with the keyboard interrupt flag reset around the run
+    SIGINT_RECEIVED = false;
+    batch_status_t status = run_program(cpu_state, options->max_instrs);
+    SIGINT_RECEIVED = false;
+
+    // Tell the user if the program did not halt
+    if (status == BATCH_INTERRUPTED) {
+        fprintf(stderr, "\nExecution interrupted by the user, stopping.\n");
+    } else if (status == BATCH_LIMIT) {
+        fprintf(stderr, "Error: The program did not halt within %" PRIu32
+                " instructions.\n", options->max_instrs);
+    }
+
+    // Dump and verify the registers, if the options ask for it
+    bool dump_failed = (options->rdump_path != NULL &&
+            dump_registers(cpu_state, options->rdump_path) < 0);
+    if (options->verify_path != NULL) {
+        status = verify_run(cpu_state, &reference, status, options->json_path);
+    }
+    return dump_failed ? BATCH_DUMP_FAILED : status;
+}
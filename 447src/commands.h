@@ -25,6 +25,7 @@
 
 // Standard Includes
 #include <stdbool.h>            // Definition of the boolean type
+#include <stdint.h>             // Fixed-size integral types
 
 // 18-447 Simulator Includes
 #include <sim.h>                // Definition of cpu_state_t
@@ -34,7 +35,30 @@
  *----------------------------------------------------------------------------*/
 
 // Indicates that a SIGINT signal was received by the program
-volatile bool SIGINT_RECEIVED;
+extern volatile bool SIGINT_RECEIVED;
+
+/* The exit statuses of the simulator when it runs a program in batch mode.
+ * They are kept clear of the small error codes that the simulator exits with
+ * when it fails to start. */
+typedef enum batch_status {
+    BATCH_HALTED            = 0,    // The program halted with the halt ECALL
+    BATCH_FAULTED           = 100,  // The program stopped on a simulation error
+    BATCH_LIMIT             = 101,  // The instruction limit was reached first
+    BATCH_DUMP_FAILED       = 102,  // The register dump or result not written
+    BATCH_MISMATCH          = 103,  // The registers did not match the reference
+    BATCH_BAD_REFERENCE     = 104,  // The reference dump could not be read
+    BATCH_TESTS_FAILED      = 105,  // Not every test in the list passed
+    BATCH_INTERRUPTED       = 130,  // The run was interrupted by a SIGINT
+} batch_status_t;
+
+// The options for running a program in batch mode, without the shell
+typedef struct batch_options {
+    bool run;                   // Indicates if the program is run in batch mode
+    const char *rdump_path;     // File to dump the registers to, or NULL
+    uint32_t max_instrs;        // Maximum instructions to run, 0 if no limit
+    const char *verify_path;    // Reference dump to verify against, or NULL
+    const char *json_path;      // File for the verification result, or NULL
+} batch_options_t;
 
 /*----------------------------------------------------------------------------
  * CPU Initialization
@@ -49,6 +73,41 @@ volatile bool SIGINT_RECEIVED;
  **/
 int init_cpu_state(cpu_state_t *cpu_state, char *program_path);
 
+/*----------------------------------------------------------------------------
+ * Batch Mode
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Gets the name for the outcome of a run, as used in the verification result.
+ **/
+const char *batch_outcome_name(batch_status_t status);
+
+/**
+ * Runs the loaded program until it halts, or until the given maximum number of
+ * instructions have retired, if it is not 0, and determines how the run ended.
+ *
+ * The keyboard interrupt flag is left alone, so that several processors can
+ * run programs at once on different threads. The caller resets it as needed.
+ **/
+batch_status_t run_program(cpu_state_t *cpu_state, uint32_t max_instrs);
+
+/**
+ * Runs the loaded program without the shell, until it halts, or until the
+ * options' maximum number of instructions have retired, if it is not 0.
+ *
+ * Afterwards, the registers are dumped to the options' file, if there is one,
+ * whatever the outcome of the run, so that a failing run can still be compared
+ * against its reference. If the options have a reference dump, then the
+ * registers are also verified against it, writing the result as JSON to the
+ * options' file, or stdout if there is none.
+ *
+ * Returns the exit status for the outcome. When verifying, a run that stops on
+ * an error passes if its registers match, since the reference may record such
+ * a run. A failed dump takes precedence over the outcome of the run.
+ **/
+batch_status_t run_batch(cpu_state_t *cpu_state,
+        const batch_options_t *options);
+
 /*----------------------------------------------------------------------------
  * Commands
  *----------------------------------------------------------------------------*/
@@ -120,6 +179,45 @@ void command_restart(cpu_state_t *cpu_state, char *args[], int num_args);
  **/
 void command_load(cpu_state_t *cpu_state, char *args[], int num_args);
 
+/**
+ * Saves a checkpoint of the processor's state to the specified file.
+ *
+ * The first checkpoint to a file writes a base image of the whole state, and
+ * each later one appends only the CPU state and the memory pages that were
+ * written since the previous checkpoint.
+ **/
+void command_checkpoint(cpu_state_t *cpu_state, char *args[], int num_args);
+
+/**
+ * Restores the processor's state from the last checkpoint in the specified
+ * file.
+ *
+ * The currently loaded program must be the one that the checkpoints were saved
+ * from.
+ **/
+void command_restore(cpu_state_t *cpu_state, char *args[], int num_args);
+
+/**
+ * Saves a snapshot of the processor's whole state to the specified file.
+ **/
+void command_save(cpu_state_t *cpu_state, char *args[], int num_args);
+
+/**
+ * Loads the processor's whole state from the snapshot in the specified file.
+ *
+ * The snapshot replaces the processor's memory, so it does not need to be
+ * saved from the currently loaded program.
+ **/
+void command_load_snapshot(cpu_state_t *cpu_state, char *args[], int num_args);
+
+/**
+ * Displays the hit and miss counts of the software TLB.
+ *
+ * The counts are kept separately for instruction fetches, loads, and stores,
+ * and are reset whenever a program is loaded or restarted.
+ **/
+void command_tlb(cpu_state_t *cpu_state, char *args[], int num_args);
+
 /**
  * Toggles verbose mode for the simulator.
  *
@@ -0,0 +1,183 @@
+/**
+ * devices.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the memory-mapped devices, which give programs
+ * host-assisted I/O through plain loads and stores.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+// Standard Includes
+#include <stdio.h>                  // Printf and related functions
+#include <stdint.h>                 // Fixed-size integral types
+#include <stdbool.h>                // Definition of the boolean type
+#include <time.h>                   // Host monotonic clock
+
+// 18-447 Simulator Includes
+#include <sim.h>                    // Definition of cpu_state_t
+#include <memory.h>                 // Interface to the processor memory
+
+// Local Includes
+#include "devices.h"                // This file's interface
+
+/*----------------------------------------------------------------------------
+ * Register Helpers
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Extracts the bytes of an access of the given size at the offset from the
+ * 32-bit register that contains the offset.
+ **/
+static uint32_t device_reg_read(uint32_t reg, uint32_t offset, uint32_t size)
+{
+    uint32_t shift = 8 * (offset % sizeof(uint32_t));
+    uint32_t mask = (size == sizeof(uint32_t)) ? UINT32_MAX :
+            (1U << (8 * size)) - 1;
+    return (reg >> shift) & mask;
+}
+
+/**
+ * Updates the bytes of the 32-bit register that contains the offset with the
+ * value of an access of the given size.
+ **/
+static void device_reg_write(uint32_t *reg, uint32_t offset, uint32_t size,
+        uint32_t value)
+{
+    uint32_t shift = 8 * (offset % sizeof(uint32_t));
+    uint32_t mask = (size == sizeof(uint32_t)) ? UINT32_MAX :
+            (1U << (8 * size)) - 1;
+    *reg = (*reg & ~(mask << shift)) | ((value & mask) << shift);
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * Console
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Writes to the console device's registers.
+ **/
+void device_console_write(struct cpu_state *cpu_state, mem_device_t *device,
+        uint32_t offset, uint32_t size, uint32_t value)
+{
+    // Silence unused variable warnings from the compiler
+    (void)cpu_state;
+    (void)device;
+    (void)size;
+
+    if (offset == DEVICE_CONSOLE_TX) {
+        fputc(value & 0xFF, stdout);
+    }
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * Timer
+ *----------------------------------------------------------------------------*/
+
+// The device register that holds the latched high word of the time
+#define TIMER_LATCHED_HI        0
+
+/**
+ * Reads from the timer device's registers.
+ **/
+uint32_t device_timer_read(struct cpu_state *cpu_state, mem_device_t *device,
+        uint32_t offset, uint32_t size)
+{
+    // Silence unused variable warnings from the compiler
+    (void)cpu_state;
+
+    if (offset >= DEVICE_TIMER_TIME_HI) {
+        return device_reg_read(device->regs[TIMER_LATCHED_HI], offset, size);
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t time_ns = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    device->regs[TIMER_LATCHED_HI] = time_ns >> 32;
+    return device_reg_read(time_ns, offset, size);
+}
+
+/*----------------------------------------------------------------------------
+ * Bulk Copy Engine
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Copies the bytes of the engine's length register from its source to its
+ * destination address, through the processor's memory, so that the written
+ * pages are tracked as for any other store. Whole words are copied when the
+ * addresses and length allow it. The copy stops if the processor halts.
+ **/
+static void copy_run(struct cpu_state *cpu_state, mem_device_t *device)
+{
+    uint32_t *src = &device->regs[DEVICE_COPY_SRC / sizeof(uint32_t)];
+    uint32_t *dst = &device->regs[DEVICE_COPY_DST / sizeof(uint32_t)];
+    uint32_t *len = &device->regs[DEVICE_COPY_LEN / sizeof(uint32_t)];
+
+    // Copy backwards if the destination overlaps the end of the source
+    bool backwards = (*dst - *src < *len && *dst != *src);
+    uint32_t step = ((*src | *dst | *len) % sizeof(uint32_t) == 0) ?
+            sizeof(uint32_t) : sizeof(uint8_t);
+    uint32_t done = 0;
+    while (done < *len && !cpu_state->halted)
+    {
+        uint32_t offset = backwards ? *len - done - step : done;
+        if (step == sizeof(uint32_t)) {
+            uint32_t word = mem_read32(cpu_state, *src + offset);
+            if (!cpu_state->halted) {
+                mem_write32(cpu_state, *dst + offset, word);
+            }
+        } else {
+            uint8_t byte = mem_read8(cpu_state, *src + offset);
+            if (!cpu_state->halted) {
+                mem_write8(cpu_state, *dst + offset, byte);
+            }
+        }
+        done += cpu_state->halted ? 0 : step;
+    }
+
+    /* Advance past the copied bytes, leaving the rest in the length. A partial
+     * backwards copy leaves the bytes at the start, so its addresses stay. */
+    if (!backwards || done == *len) {
+        *src += done;
+        *dst += done;
+    }
+    *len -= done;
+    return;
+}
+
+/**
+ * Reads from the bulk copy engine's registers.
+ **/
+uint32_t device_copy_read(struct cpu_state *cpu_state, mem_device_t *device,
+        uint32_t offset, uint32_t size)
+{
+    // Silence unused variable warnings from the compiler
+    (void)cpu_state;
+
+    return device_reg_read(device->regs[offset / sizeof(uint32_t)], offset,
+            size);
+}
+
+/**
+ * Writes to the bulk copy engine's registers, running the copy if the length
+ * register is written.
+ **/
+void device_copy_write(struct cpu_state *cpu_state, mem_device_t *device,
+        uint32_t offset, uint32_t size, uint32_t value)
+{
+    device_reg_write(&device->regs[offset / sizeof(uint32_t)], offset, size,
+            value);
+    if (offset / sizeof(uint32_t) == DEVICE_COPY_LEN / sizeof(uint32_t)) {
+        copy_run(cpu_state, device);
+    }
+    return;
+}
@@ -0,0 +1,86 @@
+/**
+ * devices.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the memory-mapped devices, which give
+ * programs host-assisted I/O through plain loads and stores.
+ *
+ * Each device has a region of 32-bit registers, at the offsets defined here
+ * from the device's starting address. The devices are placed in the address
+ * space by the MEMORY_DEVICES array.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+#ifndef DEVICES_H_
+#define DEVICES_H_
+
+// Standard Includes
+#include <stdint.h>             // Fixed-size integral types
+
+// 18-447 Simulator Includes
+#include <memory.h>             // Definition of mem_device_t
+
+/*----------------------------------------------------------------------------
+ * Device Registers
+ *----------------------------------------------------------------------------*/
+
+/* The console has a single transmit register. The low byte of each value
+ * written to it is printed to stdout, and it reads as zero. */
+#define DEVICE_CONSOLE_TX       0x0
+#define DEVICE_CONSOLE_SIZE     0x4
+
+/* The timer has the low and high words of the host's monotonic clock, in
+ * nanoseconds. Reading the low word latches the high word, so that reading the
+ * low and then the high word gives a consistent value. Writes are ignored. */
+#define DEVICE_TIMER_TIME_LO    0x0
+#define DEVICE_TIMER_TIME_HI    0x4
+#define DEVICE_TIMER_SIZE       0x8
+
+/* The bulk copy engine has source address, destination address, and length
+ * registers. Writing the length copies that many bytes from the source to the
+ * destination, as if by memmove, then advances both addresses past the copied
+ * bytes, and clears the length. If an address is invalid, then the processor
+ * halts, and the length holds the number of bytes that were not copied. */
+#define DEVICE_COPY_SRC         0x0
+#define DEVICE_COPY_DST         0x4
+#define DEVICE_COPY_LEN         0x8
+#define DEVICE_COPY_SIZE        0xc
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Writes to the console device's registers.
+ **/
+void device_console_write(struct cpu_state *cpu_state, mem_device_t *device,
+        uint32_t offset, uint32_t size, uint32_t value);
+
+/**
+ * Reads from the timer device's registers.
+ **/
+uint32_t device_timer_read(struct cpu_state *cpu_state, mem_device_t *device,
+        uint32_t offset, uint32_t size);
+
+/**
+ * Reads from the bulk copy engine's registers.
+ **/
+uint32_t device_copy_read(struct cpu_state *cpu_state, mem_device_t *device,
+        uint32_t offset, uint32_t size);
+
+/**
+ * Writes to the bulk copy engine's registers, running the copy if the length
+ * register is written.
+ **/
+void device_copy_write(struct cpu_state *cpu_state, mem_device_t *device,
+        uint32_t offset, uint32_t size, uint32_t value);
+
+#endif /* DEVICES_H_ */
@@ -0,0 +1,351 @@
+/**
+ * elf_loader.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the reader for the ELF executables of programs.
+ *
+ * The fields of the executable are little-endian, so they are converted to the
+ * host's byte order as they are read.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+// Standard Includes
+#include <stdlib.h>                 // Malloc, qsort, and related functions
+#include <stdio.h>                  // Printf and related functions
+#include <stdint.h>                 // Fixed-size integral types
+#include <stdbool.h>                // Definition of the boolean type
+#include <string.h>                 // String and memory comparison functions
+#include <errno.h>                  // Error codes and strerror
+#include <endian.h>                 // Conversion from little-endian fields
+#include <elf.h>                    // Layout of the ELF headers and symbols
+#include <fcntl.h>                  // Opening of the executable
+#include <unistd.h>                 // Reading and closing of the executable
+#include <sys/stat.h>               // Size of the executable
+
+// 18-447 Simulator Includes
+#include <memory.h>                 // Definition of mem_symbol_t
+
+// Local Includes
+#include "elf_loader.h"             // This file's interface
+
+/*----------------------------------------------------------------------------
+ * Helper Functions
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Allocates a zeroed array of the given number of elements, which may be zero.
+ * Exits on error.
+ **/
+static void *elf_alloc(size_t count, size_t size, const char *what)
+{
+    void *data = calloc((count == 0) ? 1 : count, size);
+    if (data == NULL) {
+        fprintf(stderr, "Error: Unable to allocate %s.\n", what);
+        exit(ENOMEM);
+    }
+    return data;
+}
+
+/**
+ * Checks that the given range lies in the executable, whose size is given.
+ **/
+static bool elf_range_valid(uint64_t offset, uint64_t size, uint64_t file_size)
+{
+    return offset <= file_size && size <= file_size - offset;
+}
+
+/**
+ * Checks that the ELF header is for a 32-bit little-endian RISC-V executable.
+ * Returns a negative error code on failure.
+ **/
+static int elf_check_header(const Elf32_Ehdr *header, const char *path)
+{
+    if (memcmp(header->e_ident, ELFMAG, SELFMAG) != 0) {
+        fprintf(stderr, "Error: %s: Not an ELF file.\n", path);
+        return -EINVAL;
+    } else if (header->e_ident[EI_CLASS] != ELFCLASS32 ||
+            header->e_ident[EI_DATA] != ELFDATA2LSB ||
+            le16toh(header->e_machine) != EM_RISCV) {
+        fprintf(stderr, "Error: %s: Not a 32-bit little-endian RISC-V ELF "
+                "file.\n", path);
+        return -EINVAL;
+    } else if (le16toh(header->e_type) != ET_EXEC) {
+        fprintf(stderr, "Error: %s: Not an executable ELF file.\n", path);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/**
+ * Orders the symbols by their address, and then by their name, so that the
+ * order does not depend on the symbol table's.
+ **/
+static int elf_compare_symbols(const void *symbol1, const void *symbol2)
+{
+    const mem_symbol_t *sym1 = symbol1;
+    const mem_symbol_t *sym2 = symbol2;
+    if (sym1->addr != sym2->addr) {
+        return (sym1->addr < sym2->addr) ? -1 : 1;
+    }
+    return strcmp(sym1->name, sym2->name);
+}
+
+/*----------------------------------------------------------------------------
+ * Program and Section Headers
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Reads the ranges that are loaded into memory from the program headers.
+ * Returns a negative error code on failure.
+ **/
+static int elf_read_loads(elf_file_t *elf, const Elf32_Ehdr *header,
+        uint64_t file_size, const char *path)
+{
+    uint16_t num_headers = le16toh(header->e_phnum);
+    uint32_t headers_offset = le32toh(header->e_phoff);
+    if (num_headers > 0 && (le16toh(header->e_phentsize) !=
+            sizeof(Elf32_Phdr) || !elf_range_valid(headers_offset,
+            (uint64_t)num_headers * sizeof(Elf32_Phdr), file_size))) {
+        fprintf(stderr, "Error: %s: The program headers are invalid.\n", path);
+        return -EINVAL;
+    }
+
+    Elf32_Phdr *headers = elf_alloc(num_headers, sizeof(headers[0]),
+            "the program headers");
+    int rc = elf_read(elf, headers, num_headers * sizeof(headers[0]),
+            headers_offset, path);
+
+    // Only the headers for ranges with a size in memory are kept
+    elf->loads = elf_alloc(num_headers, sizeof(elf->loads[0]),
+            "the loaded ranges");
+    for (int i = 0; rc == 0 && i < num_headers; i++)
+    {
+        elf_load_t load = {
+            .addr           = le32toh(headers[i].p_vaddr),
+            .mem_size       = le32toh(headers[i].p_memsz),
+            .file_offset    = le32toh(headers[i].p_offset),
+            .file_size      = le32toh(headers[i].p_filesz),
+        };
+        if (le32toh(headers[i].p_type) != PT_LOAD || load.mem_size == 0) {
+            continue;
+        } else if (load.file_size > load.mem_size || !elf_range_valid(
+                load.file_offset, load.file_size, file_size)) {
+            fprintf(stderr, "Error: %s: Program header %d is invalid.\n",
+                    path, i);
+            rc = -EINVAL;
+        } else {
+            elf->loads[elf->num_loads] = load;
+            elf->num_loads += 1;
+        }
+    }
+
+    free(headers);
+    return rc;
+}
+
+/**
+ * Reads the symbols that name addresses in the program from the symbol table,
+ * if the executable has one. Returns a negative error code on failure.
+ **/
+static int elf_read_symbols(elf_file_t *elf, const Elf32_Ehdr *header,
+        uint64_t file_size, const char *path)
+{
+    // The executable has no symbols if it has no section headers
+    uint16_t num_sections = le16toh(header->e_shnum);
+    uint32_t sections_offset = le32toh(header->e_shoff);
+    if (num_sections == 0) {
+        return 0;
+    } else if (le16toh(header->e_shentsize) != sizeof(Elf32_Shdr) ||
+            !elf_range_valid(sections_offset, (uint64_t)num_sections *
+            sizeof(Elf32_Shdr), file_size)) {
+        fprintf(stderr, "Error: %s: The section headers are invalid.\n", path);
+        return -EINVAL;
+    }
+
+    Elf32_Shdr *sections = elf_alloc(num_sections, sizeof(sections[0]),
+            "the section headers");
+    int rc = elf_read(elf, sections, num_sections * sizeof(sections[0]),
+            sections_offset, path);
+    if (rc < 0) {
+        free(sections);
+        return rc;
+    }
+
+    // Find the symbol table, and the string table with the symbols' names
+    const Elf32_Shdr *symtab = NULL;
+    for (int i = 0; i < num_sections && symtab == NULL; i++)
+    {
+        if (le32toh(sections[i].sh_type) == SHT_SYMTAB) {
+            symtab = &sections[i];
+        }
+    }
+    if (symtab == NULL) {
+        free(sections);
+        return 0;
+    }
+
+    uint32_t strtab_index = le32toh(symtab->sh_link);
+    const Elf32_Shdr *strtab = (strtab_index < num_sections) ?
+            &sections[strtab_index] : NULL;
+    uint32_t names_size = (strtab == NULL) ? 0 : le32toh(strtab->sh_size);
+    uint32_t num_entries = le32toh(symtab->sh_size) / sizeof(Elf32_Sym);
+    if (strtab == NULL || !elf_range_valid(le32toh(strtab->sh_offset),
+            names_size, file_size) || !elf_range_valid(le32toh(
+            symtab->sh_offset), le32toh(symtab->sh_size), file_size)) {
+        fprintf(stderr, "Error: %s: The symbol table is invalid.\n", path);
+        free(sections);
+        return -EINVAL;
+    }
+
+    // Read the names, which are made to end in a null byte if they did not
+    elf->symbol_names = elf_alloc(names_size + 1, sizeof(char),
+            "the symbol names");
+    Elf32_Sym *entries = elf_alloc(num_entries, sizeof(entries[0]),
+            "the symbol table");
+    rc = elf_read(elf, elf->symbol_names, names_size,
+            le32toh(strtab->sh_offset), path);
+    if (rc == 0) {
+        rc = elf_read(elf, entries, num_entries * sizeof(entries[0]),
+                le32toh(symtab->sh_offset), path);
+    }
+
+    /* Keep the named symbols for code and data that are defined in a section,
+     * which excludes the symbols for constants, files, and sections. */
+    elf->symbols = elf_alloc(num_entries, sizeof(elf->symbols[0]),
+            "the symbols");
+    for (uint32_t i = 0; rc == 0 && i < num_entries; i++)
+    {
+        uint32_t name = le32toh(entries[i].st_name);
+        uint16_t section = le16toh(entries[i].st_shndx);
+        int type = ELF32_ST_TYPE(entries[i].st_info);
+        if (name == 0 || name >= names_size || section == SHN_UNDEF ||
+                section >= SHN_LORESERVE || (type != STT_NOTYPE &&
+                type != STT_OBJECT && type != STT_FUNC)) {
+            continue;
+        }
+
+        mem_symbol_t *symbol = &elf->symbols[elf->num_symbols];
+        symbol->addr = le32toh(entries[i].st_value);
+        symbol->size = le32toh(entries[i].st_size);
+        symbol->name = &elf->symbol_names[name];
+        elf->num_symbols += 1;
+    }
+    qsort(elf->symbols, elf->num_symbols, sizeof(elf->symbols[0]),
+            elf_compare_symbols);
+
+    free(entries);
+    free(sections);
+    return rc;
+}
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Opens the given executable, which must be a 32-bit little-endian RISC-V
+ * executable, and reads its loaded ranges, entry point, and symbol table.
+ *
+ * Returns -ENOENT without printing an error if the file does not exist, so
+ * that the caller can load the program in another way. Otherwise, returns a
+ * negative error code on failure.
+ **/
+int elf_open(elf_file_t *elf, const char *path)
+{
+    memset(elf, 0, sizeof(*elf));
+    elf->fd = open(path, O_RDONLY);
+    if (elf->fd < 0 && errno == ENOENT) {
+        return -ENOENT;
+    } else if (elf->fd < 0) {
+        int rc = -errno;
+        fprintf(stderr, "Error: %s: Unable to open file: %s.\n", path,
+                strerror(errno));
+        return rc;
+    }
+
+    struct stat elf_stat;
+    if (fstat(elf->fd, &elf_stat) < 0) {
+        int rc = -errno;
+        fprintf(stderr, "Error: %s: Unable to stat file: %s.\n", path,
+                strerror(errno));
+        elf_close(elf);
+        return rc;
+    }
+
+    // Read and check the ELF header, then the headers that it points to
+    Elf32_Ehdr header;
+    int rc = elf_read(elf, &header, sizeof(header), 0, path);
+    if (rc == 0) {
+        rc = elf_check_header(&header, path);
+    }
+    if (rc == 0) {
+        rc = elf_read_loads(elf, &header, elf_stat.st_size, path);
+    }
+    if (rc == 0) {
+        rc = elf_read_symbols(elf, &header, elf_stat.st_size, path);
+    }
+
+    if (rc < 0) {
+        elf_close(elf);
+        return rc;
+    }
+
+    elf->entry = le32toh(header.e_entry);
+    return 0;
+}
+
+/**
+ * Reads the data of the given size at the offset in the executable. Returns a
+ * negative error code on failure, including if the file ends first.
+ **/
+int elf_read(const elf_file_t *elf, void *data, size_t size,
+        uint64_t offset, const char *path)
+{
+    size_t bytes_read = 0;
+    while (bytes_read < size)
+    {
+        ssize_t rc = pread(elf->fd, (uint8_t *)data + bytes_read,
+                size - bytes_read, offset + bytes_read);
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        } else if (rc < 0) {
+            int error = errno;
+            fprintf(stderr, "Error: %s: Unable to read file: %s.\n", path,
+                    strerror(error));
+            return -error;
+        } else if (rc == 0) {
+            fprintf(stderr, "Error: %s: File is truncated.\n", path);
+            return -EINVAL;
+        }
+        bytes_read += rc;
+    }
+
+    return 0;
+}
+
+/**
+ * Closes the executable, and frees its symbol table. The caller can keep the
+ * symbol table instead by taking the symbols and their names, and setting them
+ * to NULL first.
+ **/
+void elf_close(elf_file_t *elf)
+{
+    if (elf->fd >= 0) {
+        close(elf->fd);
+    }
+    free(elf->loads);
+    free(elf->symbols);
+    free(elf->symbol_names);
+    memset(elf, 0, sizeof(*elf));
+    elf->fd = -1;
+    return;
+}
@@ -0,0 +1,84 @@
+/**
+ * elf_loader.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the reader for the ELF executables of
+ * programs.
+ *
+ * The reader takes the ranges of the file that are loaded into memory from the
+ * executable's program headers, along with its entry point and symbol table.
+ * Placing the loaded ranges in the processor's memory segments is left to the
+ * memory subsystem, which maps them directly from the open file.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+#ifndef ELF_LOADER_H_
+#define ELF_LOADER_H_
+
+// Standard Includes
+#include <stdint.h>             // Fixed-size integral types
+#include <stddef.h>             // Definition of size_t
+
+// 18-447 Simulator Includes
+#include <memory.h>             // Definition of mem_symbol_t
+
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+// A range of the executable that is loaded into memory
+typedef struct elf_load {
+    uint32_t addr;              // Address that the range is loaded at
+    uint32_t mem_size;          // Size of the range in memory
+    uint32_t file_offset;       // Offset of the range's data in the file
+    uint32_t file_size;         // Size of the range's data, the rest is zeros
+} elf_load_t;
+
+// An executable that is open for loading
+typedef struct elf_file {
+    int fd;                     // The executable's file descriptor
+    uint32_t entry;             // Address of the program's first instruction
+    int num_loads;              // Number of ranges that are loaded
+    elf_load_t *loads;          // Ranges that are loaded, in the file's order
+    int num_symbols;            // Number of symbols in the symbol table
+    mem_symbol_t *symbols;      // Symbols, sorted by address, or NULL if none
+    char *symbol_names;         // String table with the symbols' names
+} elf_file_t;
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Opens the given executable, which must be a 32-bit little-endian RISC-V
+ * executable, and reads its loaded ranges, entry point, and symbol table.
+ *
+ * Returns -ENOENT without printing an error if the file does not exist, so
+ * that the caller can load the program in another way. Otherwise, returns a
+ * negative error code on failure.
+ **/
+int elf_open(elf_file_t *elf, const char *path);
+
+/**
+ * Reads the data of the given size at the offset in the executable. Returns a
+ * negative error code on failure, including if the file ends first.
+ **/
+int elf_read(const elf_file_t *elf, void *data, size_t size, uint64_t offset,
+        const char *path);
+
+/**
+ * Closes the executable, and frees its symbol table. The caller can keep the
+ * symbol table instead by taking the symbols and their names, and setting them
+ * to NULL first.
+ **/
+void elf_close(elf_file_t *elf);
+
+#endif /* ELF_LOADER_H_ */
@@ -0,0 +1,346 @@
+/**
+ * fork_server.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the fork server, which runs a loaded program many times
+ * with different inputs, at almost no startup cost per run.
+ *
+ * The server sets up the processor and loads the program once, and each run
+ * happens in a child forked from it, which starts with the loaded program
+ * through copy-on-write. The child patches in the input and runs the program,
+ * then puts the processor's state in a page that it shares with the server,
+ * and exits with the outcome of the run, so that a run that crashes the
+ * simulator only takes down its child.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+// Standard Includes
+#include <stdlib.h>                 // Malloc and related functions
+#include <stdio.h>                  // Printf and related functions
+#include <stdint.h>                 // Fixed-size integral types
+#include <string.h>                 // Memcpy and memset functions
+#include <errno.h>                  // Error codes
+#include <fcntl.h>                  // Opening of /dev/null
+#include <unistd.h>                 // Fork, read, write, and dup functions
+#include <sys/mman.h>               // Memory shared with the children
+#include <sys/wait.h>               // Waiting for the children
+
+// 18-447 Simulator Includes
+#include <sim.h>                    // Definition of cpu_state_t
+#include <register_file.h>          // Interface to the register file
+
+// Local Includes
+#include "commands.h"               // Running of the loaded program
+#include "memory_shell.h"           // Interface to the processor memory
+#include "memory_segments.h"        // Address of the user data segment
+#include "fork_server.h"            // This file's interface
+
+/*----------------------------------------------------------------------------
+ * Internal Definitions
+ *----------------------------------------------------------------------------*/
+
+// The exit status offset for a child that was killed by a signal
+#define SIGNAL_STATUS_BASE      128
+
+// The status that a child overwrites once it has filled in its response
+#define UNSET_STATUS            INT32_MIN
+
+/*----------------------------------------------------------------------------
+ * Helper Functions
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Reads exactly the given number of bytes from the file descriptor. Returns
+ * the number of bytes read, which is only less than the size if the file ends
+ * first, or a negative error code on failure.
+ **/
+static ssize_t read_full(int fd, void *data, size_t size)
+{
+    size_t bytes_read = 0;
+    while (bytes_read < size)
+    {
+        ssize_t rc = read(fd, (uint8_t *)data + bytes_read, size - bytes_read);
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        } else if (rc < 0) {
+            return -errno;
+        } else if (rc == 0) {
+            break;
+        }
+        bytes_read += rc;
+    }
+
+    return bytes_read;
+}
+
+/**
+ * Writes all of the given data to the file descriptor, printing an error on
+ * failure. Returns a negative error code on failure.
+ **/
+static int write_full(int fd, const void *data, size_t size)
+{
+    size_t bytes_written = 0;
+    while (bytes_written < size)
+    {
+        ssize_t rc = write(fd, (const uint8_t *)data + bytes_written,
+                size - bytes_written);
+        if (rc < 0 && errno == EINTR) {
+            continue;
+        } else if (rc < 0) {
+            int error = errno;
+            fprintf(stderr, "Error: Unable to write the response: %s.\n",
+                    strerror(error));
+            return -error;
+        }
+        bytes_written += rc;
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the input bytes that follow a request into the buffer, which must hold
+ * at least one byte. An input that does not fit is read and discarded, so that
+ * the next request can still be read. Returns a negative error code on
+ * failure, including if stdin ends first.
+ **/
+static int read_input(uint8_t *buffer, uint32_t buffer_size, uint32_t size)
+{
+    uint32_t bytes_read = 0;
+    while (bytes_read < size)
+    {
+        uint32_t offset = (size <= buffer_size) ? bytes_read : 0;
+        uint32_t chunk_size = size - bytes_read;
+        if (chunk_size > buffer_size - offset) {
+            chunk_size = buffer_size - offset;
+        }
+
+        ssize_t rc = read_full(STDIN_FILENO, &buffer[offset], chunk_size);
+        if (rc < 0) {
+            fprintf(stderr, "Error: Unable to read the input: %s.\n",
+                    strerror(-rc));
+            return rc;
+        } else if ((uint32_t)rc < chunk_size) {
+            fprintf(stderr, "Error: The input of the request is truncated.\n");
+            return -EIO;
+        }
+        bytes_read += chunk_size;
+    }
+
+    return 0;
+}
+
+/**
+ * Redirects stdout to /dev/null, so that the program's output does not mix
+ * with the responses, and gets a copy of the original stdout to write the
+ * responses to. Returns the copy, or a negative error code on failure.
+ **/
+static int take_stdout()
+{
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd < 0) {
+        int rc = -errno;
+        fprintf(stderr, "Error: /dev/null: Unable to open file: %s.\n",
+                strerror(errno));
+        return rc;
+    }
+
+    fflush(stdout);
+    int response_fd = dup(STDOUT_FILENO);
+    if (response_fd < 0 || dup2(null_fd, STDOUT_FILENO) < 0) {
+        int rc = -errno;
+        fprintf(stderr, "Error: Unable to redirect stdout: %s.\n",
+                strerror(errno));
+        if (response_fd >= 0) {
+            close(response_fd);
+        }
+        close(null_fd);
+        return rc;
+    }
+
+    close(null_fd);
+    return response_fd;
+}
+
+/*----------------------------------------------------------------------------
+ * Runs
+ *----------------------------------------------------------------------------*/
+
+/**
+ * The body of a child, which patches the input into the user data segment,
+ * runs the program, and puts the processor's state in the shared response.
+ * Exits with the status of the run, as in batch mode.
+ **/
+static void run_child(cpu_state_t *cpu_state, mem_segment_t *data_segment,
+        const fork_server_request_t *request, const uint8_t *input,
+        uint32_t max_instrs, fork_server_response_t *response)
+{
+    if (request->size > 0) {
+        mem_write_segment(data_segment, request->offset, input, request->size);
+    }
+
+    // The status is written last, so that it marks the response as complete
+    batch_status_t status = run_program(cpu_state, max_instrs);
+    response->instructions = cpu_state->cycle;
+    response->pc = cpu_state->pc;
+    for (int i = 0; i < RISCV_NUM_REGS; i++)
+    {
+        response->registers[i] = register_read(cpu_state, i);
+    }
+    response->status = status;
+
+    // Leave without flushing any output, which was the server's to flush
+    _exit(status);
+}
+
+/**
+ * Runs the program for the request in a forked child, and waits for it to
+ * finish, filling in the response. Returns a negative error code if the child
+ * could not be started.
+ *
+ * The status is set to a value that no run has before the fork, so that a
+ * child that exits on an error before it fills in the response, such as from
+ * an exit(ENOMEM) in the memory code, is reported by its exit status instead
+ * of as an empty run that halted.
+ **/
+static int run_request(cpu_state_t *cpu_state, mem_segment_t *data_segment,
+        const fork_server_request_t *request, const uint8_t *input,
+        uint32_t max_instrs, fork_server_response_t *response)
+{
+    memset(response, 0, sizeof(*response));
+    response->status = UNSET_STATUS;
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        int rc = -errno;
+        fprintf(stderr, "Error: Unable to fork the run: %s.\n",
+                strerror(errno));
+        return rc;
+    } else if (pid == 0) {
+        run_child(cpu_state, data_segment, request, input, max_instrs,
+                response);
+    }
+
+    int wait_status;
+    while (waitpid(pid, &wait_status, 0) < 0)
+    {
+        if (errno != EINTR) {
+            int rc = -errno;
+            fprintf(stderr, "Error: Unable to wait for the run: %s.\n",
+                    strerror(errno));
+            return rc;
+        }
+    }
+
+    /* A child that crashed leaves no state behind, only its signal, and one
+     * that exited early only its exit status, which is never a pass. */
+    if (WIFSIGNALED(wait_status)) {
+        memset(response, 0, sizeof(*response));
+        response->status = SIGNAL_STATUS_BASE + WTERMSIG(wait_status);
+    } else if (response->status == UNSET_STATUS) {
+        int exit_status = WEXITSTATUS(wait_status);
+        memset(response, 0, sizeof(*response));
+        response->status = (exit_status == BATCH_HALTED) ? BATCH_FAULTED :
+                exit_status;
+    }
+    return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Serves requests to run the loaded program with different inputs, until
+ * stdin is closed, running each for at most the given number of instructions,
+ * if it is not 0. The output of the program is suppressed. Returns a negative
+ * error code if the requests or responses cannot be read or written.
+ **/
+int run_fork_server(cpu_state_t *cpu_state, uint32_t max_instrs)
+{
+    // The input can cover any part of the user data segment, if there is one
+    mem_segment_t *data_segment = mem_find_segment(cpu_state,
+            USER_DATA_START);
+    uint32_t data_size = (data_segment == NULL) ? 0 : data_segment->size;
+    uint32_t input_size = (data_size == 0) ? 1 : data_size;
+    uint8_t *input = malloc(input_size);
+    if (input == NULL) {
+        fprintf(stderr, "Error: Unable to allocate the input buffer.\n");
+        exit(ENOMEM);
+    }
+
+    // The children leave the processor's state in a page shared with them
+    fork_server_response_t *response = mmap(NULL, sizeof(*response),
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (response == MAP_FAILED) {
+        int rc = -errno;
+        fprintf(stderr, "Error: Unable to map the shared response: %s.\n",
+                strerror(errno));
+        free(input);
+        return rc;
+    }
+
+    int response_fd = take_stdout();
+    if (response_fd < 0) {
+        munmap(response, sizeof(*response));
+        free(input);
+        return response_fd;
+    }
+
+    // Tell the client that the server is ready, and how much input fits
+    fork_server_greeting_t greeting = { .magic = FORK_SERVER_MAGIC,
+            .data_size = data_size, };
+    int rc = write_full(response_fd, &greeting, sizeof(greeting));
+
+    // Serve requests until the client closes stdin between requests
+    while (rc == 0)
+    {
+        fork_server_request_t request;
+        ssize_t bytes_read = read_full(STDIN_FILENO, &request,
+                sizeof(request));
+        if (bytes_read == 0) {
+            break;
+        } else if (bytes_read < 0) {
+            fprintf(stderr, "Error: Unable to read the request: %s.\n",
+                    strerror(-bytes_read));
+            rc = bytes_read;
+            break;
+        } else if ((size_t)bytes_read < sizeof(request)) {
+            fprintf(stderr, "Error: The request is truncated.\n");
+            rc = -EIO;
+            break;
+        }
+
+        rc = read_input(input, input_size, request.size);
+        if (rc < 0) {
+            break;
+        }
+
+        // Reject an input that does not fit, otherwise run the program on it
+        if (request.size > data_size || request.offset > data_size -
+                request.size) {
+            memset(response, 0, sizeof(*response));
+            response->status = -EINVAL;
+        } else {
+            rc = run_request(cpu_state, data_segment, &request, input,
+                    max_instrs, response);
+        }
+
+        if (rc == 0) {
+            rc = write_full(response_fd, response, sizeof(*response));
+        }
+    }
+
+    close(response_fd);
+    munmap(response, sizeof(*response));
+    free(input);
+    return rc;
+}
@@ -0,0 +1,79 @@
+/**
+ * fork_server.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the fork server, which runs a loaded
+ * program many times with different inputs, at almost no startup cost per run.
+ *
+ * The server reads requests from stdin, and writes its responses to stdout,
+ * in the host's byte order. Once the program is loaded, the server writes a
+ * greeting with the size of the user data segment. Then, for each request, the
+ * input bytes that follow it are patched into the user data segment, and the
+ * program is run in a forked child, so that only the pages that a run writes
+ * are copied. The server writes one response for each request, and exits when
+ * stdin is closed.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+#ifndef FORK_SERVER_H_
+#define FORK_SERVER_H_
+
+// Standard Includes
+#include <stdint.h>             // Fixed-size integral types
+
+// 18-447 Simulator Includes
+#include <sim.h>                // Definition of cpu_state_t
+
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+// The magic number at the start of the greeting, which is "RVFS" in ASCII
+#define FORK_SERVER_MAGIC       0x53465652
+
+// The greeting that the server writes once it is ready for requests
+typedef struct fork_server_greeting {
+    uint32_t magic;             // Always FORK_SERVER_MAGIC
+    uint32_t data_size;         // Size of the user data segment in bytes
+} fork_server_greeting_t;
+
+// A request to run the program, which is followed by the input bytes
+typedef struct fork_server_request {
+    uint32_t offset;            // Offset of the input in the user data segment
+    uint32_t size;              // Number of input bytes after the request
+} fork_server_request_t;
+
+/* The response to a request. The status is the exit status that batch mode
+ * would have for the run, 128 plus the signal number if the run crashed the
+ * simulator, the simulator's own exit status if it exited on an error before
+ * the run finished, or a negative error code if the request was rejected
+ * because the input does not fit in the user data segment. The processor's
+ * state is only valid for a run that finished, and is zero otherwise. */
+typedef struct fork_server_response {
+    int32_t status;                         // How the run ended
+    uint32_t pc;                            // Final program counter
+    uint64_t instructions;                  // Number of instructions retired
+    uint32_t registers[RISCV_NUM_REGS];     // Final value of each register
+} fork_server_response_t;
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Serves requests to run the loaded program with different inputs, until
+ * stdin is closed, running each for at most the given number of instructions,
+ * if it is not 0. The output of the program is suppressed. Returns a negative
+ * error code if the requests or responses cannot be read or written.
+ **/
+int run_fork_server(cpu_state_t *cpu_state, uint32_t max_instrs);
+
+#endif /* FORK_SERVER_H_ */
@@ -28,6 +28,12 @@
 #include <assert.h>                 // Assert macro
 #include <errno.h>                  // Error codes and perror
 #include <string.h>                 // String manipulation functions and memset
+#include <signal.h>                 // Signal numbers and sigaction function
+#include <pthread.h>                // One-time setup of the SIGSEGV handler
+#include <fcntl.h>                  // Opening of the segment data files
+#include <unistd.h>                 // Host page size, closing files
+#include <sys/mman.h>               // Mapping and protection of host memory
+#include <sys/stat.h>               // Size of the segment data files
 
 // 18-447 Simulator Includes
 #include <sim.h>                    // Interface to the core simulator
@@ -37,6 +43,7 @@
 
 // Local Includes
 #include "libc_extensions.h"        // Various utilities
+#include "elf_loader.h"             // Reading of program executables
 #include "memory_segments.h"        // Definition of memory segment constants
 #include "memory_shell.h"           // This file's interface to the shell
 
@@ -45,28 +52,715 @@
  *----------------------------------------------------------------------------*/
 
 /**
- * Reads the specified value out from the given address in the segment in
- * little-endian order.
+ * Translates the given address to the page table entry for the page that
+ * contains it. Returns NULL if the address does not lie in any segment.
  **/
-static uint32_t mem_read_word(const mem_segment_t *segment, uint32_t addr)
+static inline const mem_page_t *mem_translate(const memory_t *memory,
+        uint32_t addr)
 {
-    assert(segment->base_addr <= addr &&
-            addr < segment->base_addr + segment->size);
+    const mem_page_t *table = memory->page_tables[addr >> (MEM_PAGE_BITS +
+            MEM_TABLE_BITS)];
+    if (table == NULL) {
+        return NULL;
+    }
+
+    const mem_page_t *page = &table[(addr >> MEM_PAGE_BITS) &
+            (MEM_TABLE_ENTRIES - 1)];
+    return ((addr & (MEM_PAGE_SIZE - 1)) < page->limit) ? page : NULL;
+}
+
+/**
+ * Finds the segment that contains the given address by searching the list of
+ * segments, without the page table. Returns NULL if the address does not lie
+ * in any segment. This does not allocate, so it is safe in a signal handler.
+ **/
+static mem_segment_t *mem_lookup_segment(const memory_t *memory, uint32_t addr)
+{
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        mem_segment_t *segment = &memory->segments[i];
+        if (segment->mem != NULL && addr - segment->base_addr < segment->size) {
+            return segment;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Translates the given address through the page table, mapping the page that
+ * contains it into the table first if it is not there yet. Returns NULL if the
+ * address does not lie in any segment. Exits on error.
+ *
+ * Pages are only mapped when they are first accessed, so the page table only
+ * takes up host memory for the parts of the segments that are used.
+ **/
+static const mem_page_t *mem_map_page(memory_t *memory, uint32_t addr)
+{
+    const mem_page_t *page = mem_translate(memory, addr);
+    mem_segment_t *segment = (page == NULL) ?
+            mem_lookup_segment(memory, addr) : NULL;
+    if (segment == NULL) {
+        return page;
+    }
+
+    // Allocate the second-level table for the page, if it has none yet
+    mem_page_t **table = &memory->page_tables[addr >> (MEM_PAGE_BITS +
+            MEM_TABLE_BITS)];
+    if (*table == NULL) {
+        *table = calloc(MEM_TABLE_ENTRIES, sizeof((*table)[0]));
+        if (*table == NULL) {
+            fprintf(stderr, "Error: Unable to allocate memory for the page "
+                    "table.\n");
+            exit(ENOMEM);
+        }
+    }
+
+    // Only the part of the last page that lies in the segment is valid
+    uint32_t offset = (addr - segment->base_addr) & ~(MEM_PAGE_SIZE - 1);
+    mem_page_t *new_page = &(*table)[(addr >> MEM_PAGE_BITS) &
+            (MEM_TABLE_ENTRIES - 1)];
+    new_page->host = &segment->mem[offset];
+    new_page->segment = segment;
+    new_page->limit = min(MEM_PAGE_SIZE, segment->size - offset);
+    return new_page;
+}
+
+/**
+ * Rounds the given size up to a multiple of the host page size.
+ **/
+static size_t mem_host_page_round(size_t size)
+{
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    return (size + page_size - 1) & ~(page_size - 1);
+}
 
-    const uint8_t *mem_addr = &segment->mem[addr - segment->base_addr];
+/**
+ * Marks the page that contains the given address in the segment as written, so
+ * that it is restored when the program is restarted, and saved by the next
+ * checkpoint.
+ **/
+static inline void mem_mark_dirty(mem_segment_t *segment, uint32_t addr)
+{
+    segment->dirty_pages[(addr - segment->base_addr) >> MEM_PAGE_BITS] =
+            MEM_DIRTY_ALL;
+    return;
+}
+
+/**
+ * Reads the value of the given size (1, 2, or 4 bytes) at the host address,
+ * which is stored in little-endian order. The address need not be aligned.
+ **/
+static inline uint32_t mem_read_host(const uint8_t *mem_addr, uint32_t size)
+{
+    /* On a little-endian host, the value can be read with a single load. Each
+     * size is copied with a constant length, so that the copy is a load. */
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    uint32_t value;
+    if (size == sizeof(uint32_t)) {
+        memcpy(&value, mem_addr, sizeof(uint32_t));
+    } else if (size == sizeof(uint16_t)) {
+        uint16_t halfword;
+        memcpy(&halfword, mem_addr, sizeof(halfword));
+        value = halfword;
+    } else {
+        value = mem_addr[0];
+    }
+#else /* __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__ */
     uint32_t value = 0;
-    for (int i = 0; i < (int)sizeof(uint32_t); i++)
+    for (int i = 0; i < (int)size; i++)
     {
         value |= set_byte(mem_addr[i], i);
     }
+#endif /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ */
 
     return value;
 }
 
+/**
+ * Writes the low bytes of the value, of the given size (1, 2, or 4 bytes), to
+ * the host address in little-endian order. The address need not be aligned.
+ **/
+static inline void mem_write_host(uint8_t *mem_addr, uint32_t size,
+        uint32_t value)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    if (size == sizeof(uint32_t)) {
+        memcpy(mem_addr, &value, sizeof(uint32_t));
+    } else if (size == sizeof(uint16_t)) {
+        uint16_t halfword = value;
+        memcpy(mem_addr, &halfword, sizeof(halfword));
+    } else {
+        mem_addr[0] = value;
+    }
+#else /* __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__ */
+    for (int i = 0; i < (int)size; i++)
+    {
+        mem_addr[i] = get_byte(value, i);
+    }
+#endif /* __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__ */
+
+    return;
+}
+
+/**
+ * Looks up the given address of an access of the given size (1, 2, or 4 bytes)
+ * in the TLB, and returns its location in host memory on a hit. Returns NULL
+ * on a miss, which includes every address that is not aligned to the size.
+ *
+ * The offset is rotated by the log of the size, so that its misaligned bits
+ * become the top bits, and it is compared with the number of valid accesses
+ * of that size in the page.
+ **/
+static inline uint8_t *mem_tlb_lookup(mem_tlb_t *tlb, uint32_t addr,
+        uint32_t size)
+{
+    const mem_tlb_entry_t *entry = &tlb->entries[(addr >> MEM_PAGE_BITS) &
+            (MEM_TLB_ENTRIES - 1)];
+    uint32_t offset = addr - entry->page_addr;
+    uint32_t size_bits = size >> 1;
+    uint32_t rotated = (offset >> size_bits) |
+            (offset << ((32 - size_bits) & 31));
+    if (rotated >= (entry->num_words << (2 - size_bits))) {
+        tlb->misses += 1;
+        return NULL;
+    }
+
+    tlb->hits += 1;
+    return &entry->host[offset];
+}
+
+/**
+ * Caches the translation of the page that contains the given address in the
+ * TLB.
+ **/
+static void mem_tlb_fill(mem_tlb_t *tlb, uint32_t addr, const mem_page_t *page)
+{
+    mem_tlb_entry_t *entry = &tlb->entries[(addr >> MEM_PAGE_BITS) &
+            (MEM_TLB_ENTRIES - 1)];
+    entry->page_addr = addr & ~(MEM_PAGE_SIZE - 1);
+    entry->num_words = page->limit / sizeof(uint32_t);
+    entry->host = page->host;
+    return;
+}
+
+/**
+ * Invalidates every entry in the fetch, load, and store TLBs. This must be
+ * done whenever the page table changes.
+ **/
+static void mem_tlb_flush(memory_t *memory)
+{
+    mem_tlb_t *tlbs[] = { &memory->fetch_tlb, &memory->load_tlb,
+            &memory->store_tlb };
+    for (int i = 0; i < (int)array_len(tlbs); i++)
+    {
+        memset(tlbs[i]->entries, 0, sizeof(tlbs[i]->entries));
+    }
+    return;
+}
+
+/**
+ * Checks that the address of an access of the given size is aligned. If it is
+ * not, this marks the CPU as halted, prints out an error message, and returns
+ * false.
+ **/
+static bool mem_check_aligned(cpu_state_t *cpu_state, uint32_t addr,
+        uint32_t size)
+{
+    if (addr % size != 0) {
+        fprintf(stderr, "Encountered an unaligned memory address 0x%08x. "
+                "Halting simulation.\n", addr);
+        cpu_state->halted = true;
+        cpu_state->halt_reason = SIM_HALT_ERROR;
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Marks the CPU as halted, and prints out an error message, for an access to an
+ * address that lies in no segment or device.
+ **/
+static void mem_invalid_access(cpu_state_t *cpu_state, uint32_t addr)
+{
+    fprintf(stderr, "Encountered invalid memory address 0x%08x. Halting "
+            "simulation.\n", addr);
+    cpu_state->halted = true;
+    cpu_state->halt_reason = SIM_HALT_ERROR;
+    return;
+}
+
+/**
+ * Finds the memory-mapped device whose region holds the whole access of the
+ * given size at the address. Returns NULL if there is none.
+ **/
+static mem_device_t *mem_lookup_device(const memory_t *memory, uint32_t addr,
+        uint32_t size)
+{
+    for (int i = 0; i < memory->num_devices; i++)
+    {
+        mem_device_t *device = &memory->devices[i];
+        uint32_t offset = addr - device->base_addr;
+        if (offset < device->size && device->size - offset >= size) {
+            return device;
+        }
+    }
+
+    return NULL;
+}
+
+/**
+ * Reads the value of the given size from the device at the address, which lies
+ * in no segment. If there is no device there, then this halts the CPU.
+ **/
+static uint32_t mem_device_read(cpu_state_t *cpu_state, uint32_t addr,
+        uint32_t size)
+{
+    mem_device_t *device = mem_lookup_device(&cpu_state->memory, addr, size);
+    if (device == NULL) {
+        mem_invalid_access(cpu_state, addr);
+        return 0;
+    } else if (device->read == NULL) {
+        return 0;
+    }
+
+    return device->read(cpu_state, device, addr - device->base_addr, size);
+}
+
+/**
+ * Writes the value of the given size to the device at the address, which lies
+ * in no segment. If there is no device there, then this halts the CPU.
+ **/
+static void mem_device_write(cpu_state_t *cpu_state, uint32_t addr,
+        uint32_t size, uint32_t value)
+{
+    mem_device_t *device = mem_lookup_device(&cpu_state->memory, addr, size);
+    if (device == NULL) {
+        mem_invalid_access(cpu_state, addr);
+    } else if (device->write != NULL) {
+        device->write(cpu_state, device, addr - device->base_addr, size,
+                value);
+    }
+    return;
+}
+
+/**
+ * Indicates if the access of the given size at the address lies past the end of
+ * a segment in the flat mode, in the segment's last page. The host maps whole
+ * pages, so these accesses do not fault, and are checked against the segment's
+ * size instead. Only the pages whose number modulo 64 matches a segment's last
+ * page need the check, which the tail mask filters in a single test.
+ **/
+static inline bool mem_flat_past_end(const memory_t *memory, uint32_t addr,
+        uint32_t size)
+{
+    if (!(memory->flat_tail_mask & ((uint64_t)1 << (addr / MEM_PAGE_SIZE %
+                        64)))) {
+        return false;
+    }
+
+    uint32_t page_addr = addr & ~(MEM_PAGE_SIZE - 1);
+    for (int i = 0; i < memory->num_flat_tails; i++)
+    {
+        const mem_flat_tail_t *tail = &memory->flat_tails[i];
+        if (tail->page_addr == page_addr) {
+            return addr - page_addr + size > tail->size;
+        }
+    }
+    return false;
+}
+
+/**
+ * Indicates if the address lies in the window of the address space that holds
+ * the memory-mapped devices. The window is never mapped in the flat mode, so
+ * this is the only check that accesses there take before the direct access.
+ **/
+static inline bool mem_in_device_window(uint32_t addr)
+{
+    return addr - DEVICES_START < DEVICES_END - DEVICES_START;
+}
+
+/**
+ * Reads the value of the given size (1, 2, or 4 bytes) at the address, caching
+ * its translation in the given TLB, which is either the fetch or the load TLB.
+ * Every access size shares this path, so that they are checked the same way.
+ *
+ * Loads from addresses that lie in no segment are dispatched to the devices,
+ * but instructions cannot be fetched from them.
+ **/
+static inline uint32_t mem_read_value(cpu_state_t *cpu_state, mem_tlb_t *tlb,
+        uint32_t addr, uint32_t size)
+{
+    // In the flat mode, the value is read directly, and faults are trapped
+    memory_t *memory = &cpu_state->memory;
+    bool fetch = (tlb == &memory->fetch_tlb);
+    if (memory->flat_base != NULL) {
+        if (!mem_check_aligned(cpu_state, addr, size)) {
+            return 0;
+        } else if (!fetch && mem_in_device_window(addr)) {
+            return mem_device_read(cpu_state, addr, size);
+        } else if (mem_flat_past_end(memory, addr, size)) {
+            mem_invalid_access(cpu_state, addr);
+            return 0;
+        }
+        return mem_read_host(&memory->flat_base[addr], size);
+    }
+
+    // On a hit, the value can be read directly from host memory
+    const uint8_t *host = mem_tlb_lookup(tlb, addr, size);
+    if (host != NULL) {
+        return mem_read_host(host, size);
+    }
+
+    // Otherwise, translate the address through the page table
+    if (!mem_check_aligned(cpu_state, addr, size)) {
+        return 0;
+    }
+
+    const mem_page_t *page = mem_map_page(memory, addr);
+    if (page == NULL && fetch) {
+        mem_invalid_access(cpu_state, addr);
+        return 0;
+    } else if (page == NULL) {
+        return mem_device_read(cpu_state, addr, size);
+    }
+
+    mem_tlb_fill(tlb, addr, page);
+    return mem_read_host(&page->host[addr & (MEM_PAGE_SIZE - 1)], size);
+}
+
+/**
+ * Writes the low bytes of the value, of the given size (1, 2, or 4 bytes), to
+ * the address, caching its translation in the store TLB. Every access size
+ * shares this path, so that they are checked the same way.
+ *
+ * Stores to addresses that lie in no segment are dispatched to the devices.
+ **/
+static inline void mem_write_value(cpu_state_t *cpu_state, uint32_t addr,
+        uint32_t size, uint32_t value)
+{
+    /* In the flat mode, the value is written directly, and faults are trapped.
+     * Stores into the user text segment's range must still invalidate it. */
+    memory_t *memory = &cpu_state->memory;
+    if (memory->flat_base != NULL) {
+        if (!mem_check_aligned(cpu_state, addr, size)) {
+            return;
+        } else if (mem_in_device_window(addr)) {
+            mem_device_write(cpu_state, addr, size, value);
+            return;
+        } else if (mem_flat_past_end(memory, addr, size)) {
+            mem_invalid_access(cpu_state, addr);
+            return;
+        }
+
+        mem_write_host(&memory->flat_base[addr], size, value);
+        if (addr - USER_TEXT_START < USER_DATA_START - USER_TEXT_START) {
+            decode_cache_invalidate(cpu_state, addr);
+        }
+        return;
+    }
+
+    // On a hit, the page is writable, so the value can be written directly
+    uint8_t *host = mem_tlb_lookup(&memory->store_tlb, addr, size);
+    if (host != NULL) {
+        mem_write_host(host, size, value);
+        return;
+    }
+
+    // Otherwise, translate the address through the page table
+    if (!mem_check_aligned(cpu_state, addr, size)) {
+        return;
+    }
+
+    const mem_page_t *page = mem_map_page(memory, addr);
+    if (page == NULL) {
+        mem_device_write(cpu_state, addr, size, value);
+        return;
+    }
+
+    /* Write the value out in little-endian order. A page only enters the store
+     * TLB through this path, so this marks every page that is written. */
+    mem_write_host(&page->host[addr & (MEM_PAGE_SIZE - 1)], size, value);
+    mem_mark_dirty(page->segment, addr);
+
+    /* Stores into the user text segment make its predecoded entry stale, so its
+     * pages are never cached in the store TLB, and always take this path. */
+    if (page->segment->base_addr == USER_TEXT_START) {
+        decode_cache_invalidate(cpu_state, addr);
+    } else {
+        mem_tlb_fill(&memory->store_tlb, addr, page);
+    }
+    return;
+}
+
+/**
+ * Removes every mapping from the page table, and frees its second-level
+ * tables.
+ **/
+static void mem_unmap_all(memory_t *memory)
+{
+    for (uint32_t i = 0; i < MEM_DIR_ENTRIES; i++)
+    {
+        free(memory->page_tables[i]);
+        memory->page_tables[i] = NULL;
+    }
+
+    mem_tlb_flush(memory);
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * Flat Address Space
+ *----------------------------------------------------------------------------*/
+
+// The size of the guest address space, which is reserved in the flat mode
+#define MEM_FLAT_SIZE           ((uint64_t)UINT32_MAX + 1)
+
+/* The CPU that uses the flat mode, whose faults the SIGSEGV handler resolves.
+ * The faults are raised on the thread that made the access, so each thread can
+ * have its own CPU in the flat mode. */
+static _Thread_local cpu_state_t *flat_cpu_state = NULL;
+
+/**
+ * Reserves the given range of the flat address space, so that any access to it
+ * faults. This discards whatever was mapped there before. Exits on error.
+ **/
+static void mem_flat_reserve(void *host_addr, size_t size)
+{
+    void *mem = mmap(host_addr, size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS |
+            MAP_NORESERVE | MAP_FIXED, -1, 0);
+    if (mem == MAP_FAILED) {
+        fprintf(stderr, "Error: Unable to reserve the flat address space: "
+                "%s.\n", strerror(errno));
+        exit(ENOMEM);
+    }
+    return;
+}
+
+// The page that the thread's last invalid flat mode access was backed with
+static _Thread_local void *flat_scratch_page = NULL;
+
+/**
+ * Prints the same message as mem_invalid_access, for the given address, but
+ * without stdio, so that it can be printed from the fault handler.
+ **/
+static void mem_flat_print_invalid(uint32_t addr)
+{
+    static const char HEX_DIGITS[] = "0123456789abcdef";
+    static const char PREFIX[] = "Encountered invalid memory address 0x";
+    char message[] = "Encountered invalid memory address 0x00000000. Halting "
+            "simulation.\n";
+
+    char *digits = &message[sizeof(PREFIX) - 1];
+    for (int i = 0; i < 8; i++)
+    {
+        digits[i] = HEX_DIGITS[(addr >> (28 - 4 * i)) & 0xF];
+    }
+
+    // There is nothing to do if the message cannot be written
+    ssize_t rc = write(STDERR_FILENO, message, sizeof(message) - 1);
+    (void)rc;
+    return;
+}
+
+/* The SIGSEGV action from before the flat mode's handler was installed, which
+ * is installed once for the whole process, by the first CPU to use the mode,
+ * and the error from installing it, if any. */
+static struct sigaction flat_prev_sigact;
+static int flat_handler_rc = 0;
+static pthread_once_t flat_handler_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Passes a fault that is not in a flat address space on to the SIGSEGV action
+ * from before the flat mode's handler. If it is the default action, or to
+ * ignore the signal, then the default action is restored, which the fault
+ * raises again once this returns.
+ **/
+static void mem_flat_chain_fault(int signum, siginfo_t *info, void *context)
+{
+    if ((flat_prev_sigact.sa_flags & SA_SIGINFO) != 0) {
+        flat_prev_sigact.sa_sigaction(signum, info, context);
+    } else if (flat_prev_sigact.sa_handler == SIG_DFL ||
+            flat_prev_sigact.sa_handler == SIG_IGN) {
+        signal(signum, SIG_DFL);
+    } else {
+        flat_prev_sigact.sa_handler(signum);
+    }
+    return;
+}
+
+/**
+ * Handles a SIGSEGV, which is raised when the guest accesses the flat address
+ * space in a way that the host mappings do not permit.
+ *
+ * The segments are mapped read-only until each page is first written, so if
+ * the fault is in a segment, it is a first write. The page is marked dirty and
+ * made writable, and the write completes once this returns. Otherwise, no
+ * segment is mapped at the address, so this halts the CPU with the same
+ * message as for an invalid address in the page table, and backs the faulting
+ * page with scratch memory, so that the access still completes. The scratch
+ * page is discarded when the program is restarted or unloaded.
+ *
+ * The handler only makes system calls, and does not use stdio, so that it does
+ * not depend on the state of the code that the fault interrupted.
+ **/
+static void mem_flat_fault_handler(int signum, siginfo_t *info, void *context)
+{
+    /* If the fault is not in the thread's flat address space, it belongs to
+     * the rest of the process, such as a program that uses the library, so it
+     * is passed on to whatever handled it before. */
+    uintptr_t host_addr = (uintptr_t)info->si_addr;
+    if (flat_cpu_state == NULL || host_addr -
+            (uintptr_t)flat_cpu_state->memory.flat_base >= MEM_FLAT_SIZE) {
+        mem_flat_chain_fault(signum, info, context);
+        return;
+    }
+
+    uint32_t addr = host_addr - (uintptr_t)flat_cpu_state->memory.flat_base;
+    void *page_addr = (void *)(host_addr & ~(uintptr_t)(MEM_PAGE_SIZE - 1));
+    mem_segment_t *segment = mem_lookup_segment(&flat_cpu_state->memory, addr);
+    if (segment != NULL) {
+        mem_mark_dirty(segment, addr);
+        if (mprotect(page_addr, MEM_PAGE_SIZE, PROT_READ | PROT_WRITE) < 0) {
+            signal(signum, SIG_DFL);
+        }
+        return;
+    }
+
+    mem_flat_print_invalid(addr);
+    flat_cpu_state->halted = true;
+    flat_cpu_state->halt_reason = SIM_HALT_ERROR;
+
+    flat_scratch_page = mmap(page_addr, MEM_PAGE_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+    if (flat_scratch_page == MAP_FAILED) {
+        flat_scratch_page = NULL;
+        signal(signum, SIG_DFL);
+    }
+    return;
+}
+
+/**
+ * Installs the handler for faults in the flat address spaces, saving the
+ * previous action, so that other faults can be passed on to it.
+ **/
+static void mem_flat_install_handler()
+{
+    struct sigaction sigact;
+    memset(&sigact, 0, sizeof(sigact));
+    sigact.sa_sigaction = mem_flat_fault_handler;
+    sigact.sa_flags = SA_SIGINFO;
+    sigemptyset(&sigact.sa_mask);
+    if (sigaction(SIGSEGV, &sigact, &flat_prev_sigact) < 0) {
+        flat_handler_rc = -errno;
+    }
+    return;
+}
+
+/**
+ * Switches the memory subsystem to the flat address space mode.
+ *
+ * This reserves the full 4 GiB guest address space in host memory, so that the
+ * segments of programs loaded afterwards are mapped at their guest addresses,
+ * and guest accesses need no translation. Accesses outside of the segments are
+ * caught by a SIGSEGV handler, which halts the CPU. Segments are mapped in
+ * whole host pages, so accesses past the end of a segment but inside its last
+ * page are instead checked against the segment's size. This must be called
+ * before any program is loaded, and only one CPU per thread can use the flat
+ * mode at a time.
+ *
+ * The handler is installed for the whole process, the first time that any CPU
+ * uses the flat mode, and stays installed. Faults outside of the flat address
+ * spaces are passed on to the SIGSEGV action from before it was installed.
+ **/
+int mem_enable_flat(cpu_state_t *cpu_state)
+{
+    // The host needs a 64-bit address space to hold the guest's
+    if (SIZE_MAX <= UINT32_MAX) {
+        fprintf(stderr, "Error: The flat memory mode requires a 64-bit "
+                "host.\n");
+        return -ENOTSUP;
+    } else if (sysconf(_SC_PAGESIZE) != MEM_PAGE_SIZE) {
+        fprintf(stderr, "Error: The flat memory mode requires the host page "
+                "size to be %u bytes.\n", MEM_PAGE_SIZE);
+        return -ENOTSUP;
+    } else if (flat_cpu_state != NULL) {
+        fprintf(stderr, "Error: The flat memory mode is already in use by "
+                "this thread.\n");
+        return -EBUSY;
+    }
+
+    void *flat_base = mmap(NULL, MEM_FLAT_SIZE, PROT_NONE, MAP_PRIVATE |
+            MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (flat_base == MAP_FAILED) {
+        int rc = -errno;
+        fprintf(stderr, "Error: Unable to reserve the flat address space: "
+                "%s.\n", strerror(errno));
+        return rc;
+    }
+
+    // Install the handler that turns faults into invalid address halts, once
+    pthread_once(&flat_handler_once, mem_flat_install_handler);
+    if (flat_handler_rc < 0) {
+        fprintf(stderr, "Error: Unable to install the SIGSEGV handler: %s.\n",
+                strerror(-flat_handler_rc));
+        munmap(flat_base, MEM_FLAT_SIZE);
+        return flat_handler_rc;
+    }
+
+    cpu_state->memory.flat_base = flat_base;
+    flat_cpu_state = cpu_state;
+    return 0;
+}
+
 /*----------------------------------------------------------------------------
  * Core Simulator Interface Functions
  *----------------------------------------------------------------------------*/
 
+/**
+ * Reads the byte at the specified address in the processor's memory.
+ *
+ * If the address is invalid, then this function will mark the CPU as halted,
+ * and print out an error message.
+ *
+ * Inputs:
+ *  - cpu_state     The CPU state structure for the processor.
+ *  - addr          The address from which to read the byte.
+ *
+ * Outputs:
+ *  - cpu_state     If the address is invalid, the halted field will be set to
+ *                  true.
+ *  - return        The byte at the given address in the CPU's memory.
+ **/
+uint8_t mem_read8(cpu_state_t *cpu_state, uint32_t addr)
+{
+    return mem_read_value(cpu_state, &cpu_state->memory.load_tlb, addr,
+            sizeof(uint8_t));
+}
+
+/**
+ * Reads the halfword at the specified address in the processor's memory, in
+ * little-endian order.
+ *
+ * If the address is invalid or it is not aligned to a 2-byte boundary, then
+ * this function will mark the CPU as halted, and print out an error message.
+ *
+ * Inputs:
+ *  - cpu_state     The CPU state structure for the processor.
+ *  - addr          The address from which to read the halfword.
+ *
+ * Outputs:
+ *  - cpu_state     If the address is misaligned or invalid, the halted field
+ *                  will be set to true.
+ *  - return        The halfword at the given address in the CPU's memory.
+ **/
+uint16_t mem_read16(cpu_state_t *cpu_state, uint32_t addr)
+{
+    return mem_read_value(cpu_state, &cpu_state->memory.load_tlb, addr,
+            sizeof(uint16_t));
+}
+
 /**
  * Reads the value at the specified address in the processor's memory.
  *
@@ -86,24 +780,74 @@ static uint32_t mem_read_word(const mem_segment_t *segment, uint32_t addr)
  **/
 uint32_t mem_read32(cpu_state_t *cpu_state, uint32_t addr)
 {
-    // Make sure the address is aligned
-    if (addr % sizeof(uint32_t) != 0) {
-        fprintf(stderr, "Encountered an unaligned memory address 0x%08x. "
-                "Halting simulation.\n", addr);
-        cpu_state->halted = true;
-        return 0;
-    }
+    return mem_read_value(cpu_state, &cpu_state->memory.load_tlb, addr,
+            sizeof(uint32_t));
+}
 
-    // Try to find the specified address
-    mem_segment_t *segment = mem_find_segment(cpu_state, addr);
-    if (segment == NULL) {
-        fprintf(stderr, "Encountered invalid memory address 0x%08x. Halting "
-                "simulation.\n", addr);
-        cpu_state->halted = true;
-        return 0;
-    }
+/**
+ * Fetches the instruction at the specified address in the processor's memory.
+ *
+ * This behaves the same as mem_read32, except that the translation is cached
+ * in the fetch TLB instead of the load TLB, so that instruction fetches do not
+ * evict the translations used by the program's loads.
+ *
+ * Inputs:
+ *  - cpu_state     The CPU state structure for the processor.
+ *  - addr          The address from which to fetch the instruction.
+ *
+ * Outputs:
+ *  - cpu_state     If the address is misaligned or invalid, the halted field
+ *                  will be set to true.
+ *  - return        The instruction word at the given address.
+ **/
+uint32_t mem_fetch32(cpu_state_t *cpu_state, uint32_t addr)
+{
+    return mem_read_value(cpu_state, &cpu_state->memory.fetch_tlb, addr,
+            sizeof(uint32_t));
+}
 
-    return mem_read_word(segment, addr);
+/**
+ * Writes the byte to the given address in the processor's memory.
+ *
+ * If the address is invalid, then this function will mark the CPU as halted,
+ * and no update to memory happens.
+ *
+ * Inputs:
+ *  - cpu_state     The CPU state structure for the processor.
+ *  - addr          The address to which to write the byte.
+ *  - value         The byte to write to the given address.
+ *
+ * Outputs:
+ *  - cpu_state     If the address is invalid, the halted field will be set to
+ *                  true. The processor memory is also appropriately updated.
+ **/
+void mem_write8(cpu_state_t *cpu_state, uint32_t addr, uint8_t value)
+{
+    mem_write_value(cpu_state, addr, sizeof(uint8_t), value);
+    return;
+}
+
+/**
+ * Writes the halfword to the given address in the processor's memory, in
+ * little-endian order.
+ *
+ * If the address is invalid or it is not aligned to a 2-byte boundary, then
+ * this function will mark the CPU as halted, and no update to memory happens.
+ *
+ * Inputs:
+ *  - cpu_state     The CPU state structure for the processor.
+ *  - addr          The address to which to write the halfword.
+ *  - value         The halfword to write to the given address.
+ *
+ * Outputs:
+ *  - cpu_state     If the address is misaligned or invalid, the halted field
+ *                  will be set to true. The processor memory is also
+ *                  appropriately updated.
+ **/
+void mem_write16(cpu_state_t *cpu_state, uint32_t addr, uint16_t value)
+{
+    mem_write_value(cpu_state, addr, sizeof(uint16_t), value);
+    return;
 }
 
 /**
@@ -126,56 +870,219 @@ uint32_t mem_read32(cpu_state_t *cpu_state, uint32_t addr)
  **/
 void mem_write32(cpu_state_t *cpu_state, uint32_t addr, uint32_t value)
 {
-    // Make sure the address is aligned
-    if (addr % sizeof(uint32_t) != 0) {
-        fprintf(stderr, "Encountered an unaligned memory address 0x%08x. "
-                "Halting simulation.\n", addr);
-        cpu_state->halted = true;
-        return;
+    mem_write_value(cpu_state, addr, sizeof(uint32_t), value);
+    return;
+}
+
+/**
+ * Finds the symbol in the loaded program that names the code or data at the
+ * given address, for profiling and tracing. This is the symbol with the
+ * highest address at or below the address, so long as the address lies within
+ * the symbol's size, if it has one.
+ *
+ * Returns NULL if there is no such symbol, including if the program was not
+ * loaded from an executable with a symbol table.
+ **/
+const mem_symbol_t *mem_find_symbol(const cpu_state_t *cpu_state,
+        uint32_t addr)
+{
+    // Binary search for the number of symbols at or below the address
+    const memory_t *memory = &cpu_state->memory;
+    int low = 0;
+    int high = memory->num_symbols;
+    while (low < high)
+    {
+        int middle = low + (high - low) / 2;
+        if (memory->symbols[middle].addr <= addr) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+
+    if (low == 0) {
+        return NULL;
+    }
+
+    const mem_symbol_t *symbol = &memory->symbols[low - 1];
+    if (symbol->size != 0 && addr - symbol->addr >= symbol->size) {
+        return NULL;
+    }
+    return symbol;
+}
+
+/*----------------------------------------------------------------------------
+ * Shell Interface Functions
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Records the last page of each mapped segment that ends partway in it, so
+ * that accesses past the segment's end can be caught in the flat mode.
+ **/
+static void mem_flat_update_tails(memory_t *memory)
+{
+    memory->flat_tail_mask = 0;
+    memory->num_flat_tails = 0;
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        const mem_segment_t *segment = &memory->segments[i];
+        uint32_t tail_size = segment->size % MEM_PAGE_SIZE;
+        if (memory->flat_base == NULL || segment->mem == NULL ||
+                tail_size == 0) {
+            continue;
+        }
+
+        assert(memory->num_flat_tails < MEM_FLAT_MAX_TAILS);
+        uint32_t page_addr = segment->base_addr + segment->size - tail_size;
+        mem_flat_tail_t *tail = &memory->flat_tails[memory->num_flat_tails];
+        tail->page_addr = page_addr;
+        tail->size = tail_size;
+        memory->flat_tail_mask |= (uint64_t)1 << (page_addr / MEM_PAGE_SIZE %
+                64);
+        memory->num_flat_tails += 1;
+    }
+    return;
+}
+
+/**
+ * Maps the memory for the given segment, which will have segment->size bytes
+ * in it. If a file descriptor is given, the memory is a copy-on-write mapping
+ * of the file, so its pages are only read in when they are first touched.
+ * Otherwise, pass -1, and the memory is zero-filled on first touch.
+ *
+ * No swap space is reserved for the mapping, so a large segment only takes up
+ * host memory for the pages that the program uses. Likewise, the map of dirty
+ * pages is zero-filled on demand by the allocator at large sizes.
+ *
+ * In the flat mode, the memory is mapped at the segment's address in the flat
+ * address space, and is read-only until each page is first written, so that
+ * the fault handler can track the dirty pages.
+ **/
+static int map_mem_segment(memory_t *memory, mem_segment_t *segment, int fd)
+{
+    void *host_addr = NULL;
+    int prot = PROT_READ | PROT_WRITE;
+    int flags = MAP_PRIVATE | MAP_NORESERVE | ((fd < 0) ? MAP_ANONYMOUS : 0);
+    if (memory->flat_base != NULL) {
+        host_addr = &memory->flat_base[segment->base_addr];
+        prot = PROT_READ;
+        flags |= MAP_FIXED;
+    }
+
+    size_t map_size = mem_host_page_round(segment->size);
+    void *mem = mmap(host_addr, map_size, prot, flags, fd, 0);
+    if (mem == MAP_FAILED) {
+        return -errno;
+    }
+
+    // Allocate the map of the pages that are written, which are all clean
+    segment->dirty_pages = calloc(map_size / MEM_PAGE_SIZE,
+            sizeof(segment->dirty_pages[0]));
+    if (segment->dirty_pages == NULL) {
+        fprintf(stderr, "Error: Unable to allocate the dirty page map for "
+                "processor memory segment.\n");
+        exit(ENOMEM);
     }
 
-    // Try to find the specified address
-    mem_segment_t *segment = mem_find_segment(cpu_state, addr);
-    if (segment == NULL) {
-        fprintf(stderr, "Encountered invalid memory address 0x%08x. Halting "
-                "simulation.\n", addr);
-        cpu_state->halted = true;
-        return;
+    segment->mem = mem;
+    mem_flat_update_tails(memory);
+    return 0;
+}
+
+/**
+ * Frees the memory for the given segment, which must have been mapped by
+ * map_mem_segment.
+ **/
+static void free_mem_segment(memory_t *memory, mem_segment_t *segment)
+{
+    if (memory->flat_base == NULL) {
+        munmap(segment->mem, mem_host_page_round(segment->size));
+    } else {
+        mem_flat_reserve(segment->mem, mem_host_page_round(segment->size));
     }
 
-    // Write the value out in little-endian order
-    mem_write_word(segment, addr, value);
+    free(segment->dirty_pages);
+    free(segment->copy);
+    segment->dirty_pages = NULL;
+    segment->copy = NULL;
+    segment->copy_offset = 0;
+    segment->copy_size = 0;
+    segment->mem = NULL;
+    segment->size = 0;
+    mem_flat_update_tails(memory);
     return;
 }
 
-/*----------------------------------------------------------------------------
- * Shell Interface Functions
- *----------------------------------------------------------------------------*/
-
 /**
- * Allocates the memory for the given segment, which will have segment->size
- * bytes in it. Exits on error
+ * Restores the pages of the segment that were written since it was loaded to
+ * their loaded contents. Discarding the private copy of a page reverts it to
+ * the file that is mapped there, or to zeros if there is none, and the loaded
+ * bytes that were copied in are copied again from the segment's saved copy.
+ * Returns true if any page was restored.
  **/
-static void malloc_mem_segment(mem_segment_t *segment)
+static bool reset_mem_segment(memory_t *memory, mem_segment_t *segment)
 {
-    segment->mem = malloc(segment->size * sizeof(segment->mem[0]));
-    if (segment->mem == NULL) {
-        fprintf(stderr, "Error: Unable to allocate memory for processor memory "
-                "segment.\n");
-        exit(ENOMEM);
+    bool restored = false;
+    uint32_t num_pages = mem_host_page_round(segment->size) / MEM_PAGE_SIZE;
+    for (uint32_t start = 0; start < num_pages; start++)
+    {
+        if (!(segment->dirty_pages[start] & MEM_DIRTY_LOAD)) {
+            continue;
+        }
+
+        /* Restore the whole run of dirty pages that begins here at once. The
+         * restored contents may differ from the last checkpoint's. */
+        uint32_t end = start;
+        while (end < num_pages && (segment->dirty_pages[end] & MEM_DIRTY_LOAD))
+        {
+            segment->dirty_pages[end] = MEM_DIRTY_CHECKPOINT;
+            end += 1;
+        }
+
+        uint8_t *run = &segment->mem[start * MEM_PAGE_SIZE];
+        size_t run_size = (end - start) * MEM_PAGE_SIZE;
+        if (madvise(run, run_size, MADV_DONTNEED) < 0) {
+            fprintf(stderr, "Error: Unable to reset processor memory "
+                    "segment: %s.\n", strerror(errno));
+            exit(errno);
+        }
+
+        // The loaded bytes that are not mapped from a file are copied back
+        uint32_t copy_start = max(start * MEM_PAGE_SIZE, segment->copy_offset);
+        uint32_t copy_end = min(end * MEM_PAGE_SIZE, segment->copy_offset +
+                segment->copy_size);
+        if (copy_start < copy_end) {
+            memcpy(&segment->mem[copy_start], &segment->copy[copy_start -
+                    segment->copy_offset], copy_end - copy_start);
+        }
+
+        if (memory->flat_base != NULL && mprotect(run, run_size,
+                PROT_READ) < 0) {
+            fprintf(stderr, "Error: Unable to reset processor memory "
+                    "segment: %s.\n", strerror(errno));
+            exit(errno);
+        }
+
+        restored = true;
+        start = end;
     }
-    return;
+
+    return restored;
 }
 
 /**
  * Loads the memory segment from its corresponding data (binary) file. The size
  * of this file cannot exceed the max_size for the memory segment.
+ *
+ * The file is mapped copy-on-write rather than read, so this takes constant
+ * time, and writes to the segment are never written back to the file.
  **/
-static int load_mem_segment(mem_segment_t *segment, char *data_path)
+static int load_mem_segment(memory_t *memory, mem_segment_t *segment,
+        char *data_path)
 {
     // Try to open the data file
-    FILE *data_file = fopen(data_path, "r");
-    if (data_file == NULL) {
+    int data_fd = open(data_path, O_RDONLY);
+    if (data_fd < 0) {
         int rc = -errno;
         fprintf(stderr, "Error: %s: Unable to open file: %s.\n", data_path,
                 strerror(errno));
@@ -183,44 +1090,146 @@ static int load_mem_segment(mem_segment_t *segment, char *data_path)
     }
 
     // Determine the size of the memory segment in the file.
-    fseek(data_file, 0, SEEK_END);
-    segment->size = ftell(data_file);
-    rewind(data_file);
-    if (segment->size == 0) {
-        return 0;
+    struct stat data_stat;
+    if (fstat(data_fd, &data_stat) < 0) {
+        int rc = -errno;
+        fprintf(stderr, "Error: %s: Unable to stat file: %s.\n", data_path,
+                strerror(errno));
+        close(data_fd);
+        return rc;
     }
 
-    // Allocate memory for the segment only if the size does not exceed the max
-    if (segment->size > segment->max_size) {
+    // Map the segment only if the size does not exceed the max
+    int rc = 0;
+    if ((uint64_t)data_stat.st_size > segment->max_size) {
         fprintf(stderr, "Error: %s: File is too large for memory segment.\n",
                 data_path);
-        fclose(data_file);
-        return -EFBIG;
-    } else if (segment->size % sizeof(uint32_t) != 0) {
+        rc = -EFBIG;
+    } else if (data_stat.st_size % sizeof(uint32_t) != 0) {
         fprintf(stderr, "Error: %s: File size is not aligned to 4 bytes.\n.",
                 data_path);
-        fclose(data_file);
-        return -EINVAL;
+        rc = -EINVAL;
+    } else if (data_stat.st_size > 0) {
+        // Since the data file is binary, map it directly into memory
+        segment->size = data_stat.st_size;
+        rc = map_mem_segment(memory, segment, data_fd);
+        if (rc < 0) {
+            fprintf(stderr, "Error: %s: Unable to map memory section file: "
+                    "%s.\n", data_path, strerror(-rc));
+            segment->size = 0;
+        }
     }
-    malloc_mem_segment(segment);
 
-    // Since the data file is binary, load it directly into memory
-    int rc = 0;
-    size_t elems_read = fread(segment->mem, segment->size, 1, data_file);
-    if (elems_read != 1) {
-        assert(ferror(data_file) || !feof(data_file));
-        rc = -errno;
-        fprintf(stderr, "Error: %s: Unable to read memory section file: %s.\n",
-                data_path, strerror(errno));
+    // The mapping remains valid after the data file is closed
+    close(data_fd);
+    return rc;
+}
+
+/**
+ * Loads the memory segment from the given range of the program's executable,
+ * zero-filling the rest of its size in memory. The whole host pages of the
+ * range are mapped copy-on-write from the executable, if the range starts on a
+ * host page in the file, and the remaining bytes are copied in. The segment
+ * keeps its own copy of those bytes, so that it can be reset without the file.
+ **/
+static int load_elf_segment(memory_t *memory, mem_segment_t *segment,
+        const elf_file_t *elf, const elf_load_t *load, const char *elf_path)
+{
+    // The segment's size is rounded up to a whole number of words
+    uint64_t size = ((uint64_t)load->mem_size + 3) & ~(uint64_t)3;
+    if (size > segment->max_size) {
+        fprintf(stderr, "Error: %s: Program segment is too large for the %s "
+                "segment.\n", elf_path, segment->name);
+        return -EFBIG;
+    }
 
-        free(segment->mem);
-        segment->mem = NULL;
+    segment->size = size;
+    int rc = map_mem_segment(memory, segment, -1);
+    if (rc < 0) {
+        fprintf(stderr, "Error: %s: Unable to map memory segment: %s.\n",
+                elf_path, strerror(-rc));
         segment->size = 0;
+        return rc;
     }
 
-    // Close the data file
-    fclose(data_file);
-    return rc;
+    // In the flat mode, pages stay read-only until they are first written
+    int prot = (memory->flat_base != NULL) ? PROT_READ : PROT_READ | PROT_WRITE;
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    uint32_t mapped_size = (load->file_offset % page_size == 0) ?
+            load->file_size & ~(page_size - 1) : 0;
+    if (mapped_size > 0 && mmap(segment->mem, mapped_size, prot, MAP_PRIVATE |
+            MAP_FIXED | MAP_NORESERVE, elf->fd, load->file_offset) ==
+            MAP_FAILED) {
+        rc = -errno;
+        fprintf(stderr, "Error: %s: Unable to map memory segment: %s.\n",
+                elf_path, strerror(errno));
+        return rc;
+    }
+
+    segment->copy_offset = mapped_size;
+    segment->copy_size = load->file_size - mapped_size;
+    if (segment->copy_size == 0) {
+        return 0;
+    }
+
+    segment->copy = malloc(segment->copy_size);
+    if (segment->copy == NULL) {
+        fprintf(stderr, "Error: Unable to allocate the loaded copy of the "
+                "processor memory segment.\n");
+        exit(ENOMEM);
+    }
+
+    rc = elf_read(elf, segment->copy, segment->copy_size, load->file_offset +
+            mapped_size, elf_path);
+    if (rc < 0) {
+        return rc;
+    }
+
+    /* The copy starts on a host page, so only its pages are made writable in
+     * the flat mode while they are filled. */
+    uint8_t *copy_start = &segment->mem[segment->copy_offset];
+    size_t copy_map_size = mem_host_page_round(segment->copy_size);
+    if (prot == PROT_READ && mprotect(copy_start, copy_map_size, PROT_READ |
+            PROT_WRITE) < 0) {
+        rc = -errno;
+        fprintf(stderr, "Error: %s: Unable to fill memory segment: %s.\n",
+                elf_path, strerror(errno));
+        return rc;
+    }
+
+    memcpy(copy_start, segment->copy, segment->copy_size);
+    if (prot == PROT_READ && mprotect(copy_start, copy_map_size, prot) < 0) {
+        rc = -errno;
+        fprintf(stderr, "Error: %s: Unable to fill memory segment: %s.\n",
+                elf_path, strerror(errno));
+        return rc;
+    }
+
+    return 0;
+}
+
+/**
+ * Resets the hit and miss counters of the fetch, load, and store TLBs.
+ **/
+static void mem_reset_tlb_stats(memory_t *memory)
+{
+    memory->fetch_tlb.hits = memory->fetch_tlb.misses = 0;
+    memory->load_tlb.hits = memory->load_tlb.misses = 0;
+    memory->store_tlb.hits = memory->store_tlb.misses = 0;
+    return;
+}
+
+/**
+ * Points the PC to the program's entry point, the stack pointer (x2) to the
+ * stack segment, and the global pointer (x3) to the user data segment, which
+ * are their values when a program starts.
+ **/
+static void mem_init_registers(cpu_state_t *cpu_state)
+{
+    cpu_state->pc = cpu_state->memory.entry_point;
+    register_write(cpu_state, REG_SP, STACK_END);
+    register_write(cpu_state, REG_GP, USER_DATA_START);
+    return;
 }
 
 /**
@@ -243,51 +1252,293 @@ static char *join_strings(const char *string1, const char *string2)
     return string3;
 }
 
+/**
+ * Sets up the processor's memory with its own copy of the default memory
+ * segments and devices, so that it shares no state with any other processor.
+ * This must be called before any other memory function. Exits on error.
+ **/
+void mem_init(cpu_state_t *cpu_state)
+{
+    memory_t *memory = &cpu_state->memory;
+    memory->segments = malloc(sizeof(MEMORY_SEGMENTS));
+    memory->devices = malloc(sizeof(MEMORY_DEVICES));
+    if (memory->segments == NULL || memory->devices == NULL) {
+        fprintf(stderr, "Error: Unable to allocate the memory segments.\n");
+        exit(ENOMEM);
+    }
+
+    memcpy(memory->segments, MEMORY_SEGMENTS, sizeof(MEMORY_SEGMENTS));
+    memory->num_segments = array_len(MEMORY_SEGMENTS);
+    memcpy(memory->devices, MEMORY_DEVICES, sizeof(MEMORY_DEVICES));
+    memory->num_devices = array_len(MEMORY_DEVICES);
+    return;
+}
+
+/**
+ * Resets the registers of the memory-mapped devices to their initial state, so
+ * that nothing from a previous program is left in them.
+ **/
+void mem_reset_devices(cpu_state_t *cpu_state)
+{
+    memcpy(cpu_state->memory.devices, MEMORY_DEVICES, sizeof(MEMORY_DEVICES));
+    return;
+}
+
+/**
+ * Sets the size of the stack segment, which grows down from STACK_END, and
+ * moves the limit of the user data segment below it to match. The size must
+ * be a non-zero multiple of the page size, and leave room for the user data
+ * segment. This must be called before any program is loaded. Returns a
+ * negative error code on failure.
+ **/
+int mem_set_stack_size(cpu_state_t *cpu_state, uint32_t size)
+{
+    if (size == 0 || size % MEM_PAGE_SIZE != 0 ||
+            size >= STACK_END - USER_DATA_START) {
+        return -EINVAL;
+    }
+
+    // Segments are resized by their limits, so neither can be in use yet
+    memory_t *memory = &cpu_state->memory;
+    assert(!memory->loaded);
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        mem_segment_t *segment = &memory->segments[i];
+        if (segment->base_addr == USER_DATA_START) {
+            segment->max_size = (STACK_END - size) - USER_DATA_START;
+        } else if (segment->extension == NULL &&
+                segment->base_addr + segment->max_size == STACK_END) {
+            segment->base_addr = STACK_END - size;
+            segment->max_size = size;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Loads the program's memory segments from its executable. Each range that the
+ * executable loads must start a segment that has a data file, and no segment
+ * can have more than one. The program starts at the executable's entry point,
+ * and its symbol table is kept for mem_find_symbol.
+ **/
+static int load_elf_program(memory_t *memory, elf_file_t *elf,
+        const char *elf_path)
+{
+    for (int i = 0; i < elf->num_loads; i++)
+    {
+        const elf_load_t *load = &elf->loads[i];
+        mem_segment_t *segment = NULL;
+        for (int j = 0; j < memory->num_segments && segment == NULL; j++)
+        {
+            if (memory->segments[j].base_addr == load->addr &&
+                    memory->segments[j].extension != NULL) {
+                segment = &memory->segments[j];
+            }
+        }
+
+        if (segment == NULL) {
+            fprintf(stderr, "Error: %s: Program segment at 0x%08x does not "
+                    "start a memory segment.\n", elf_path, load->addr);
+            return -EINVAL;
+        } else if (segment->mem != NULL) {
+            fprintf(stderr, "Error: %s: The %s segment has more than one "
+                    "program segment.\n", elf_path, segment->name);
+            return -EINVAL;
+        }
+
+        int rc = load_elf_segment(memory, segment, elf, load, elf_path);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+
+    // Take the symbol table from the executable, which is closed afterwards
+    memory->entry_point = elf->entry;
+    memory->num_symbols = elf->num_symbols;
+    memory->symbols = elf->symbols;
+    memory->symbol_names = elf->symbol_names;
+    elf->symbols = NULL;
+    elf->symbol_names = NULL;
+    return 0;
+}
+
+/**
+ * Loads the program's memory segments from their data (binary) files, whose
+ * paths are the program path followed by each segment's extension. The program
+ * starts at the beginning of the user text segment.
+ **/
+static int load_bin_program(memory_t *memory, const char *program_path)
+{
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        mem_segment_t *segment = &memory->segments[i];
+        if (segment->extension == NULL) {
+            continue;
+        }
+
+        /* Combine the program path and extension to get the path to the data
+         * file, load it, then free the buffer. */
+        char *data_path = join_strings(program_path, segment->extension);
+        int rc = load_mem_segment(memory, segment, data_path);
+        free(data_path);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+
+    memory->entry_point = USER_TEXT_START;
+    return 0;
+}
+
 /**
  * Initializes the memory subsystem part of the CPU state.
  *
  * This loads the memory segments from the specified program into the CPU
- * memory, and initializes them to the values specified in their respective data
- * files. Program name should be the path to the executable file (it has no
- * extension).
+ * memory. The program is loaded from its ELF executable, which is the program
+ * path with a .elf extension, or if there is none, from the data files for each
+ * of its segments. Program name should be the path to the program without any
+ * extension.
  **/
 int mem_load_program(cpu_state_t *cpu_state, const char *program_path)
 {
-    // Initialize each memory segment, loading data from the associated file
-    int rc = 0;
-    for (int i = 0; i < cpu_state->memory.num_segments; i++)
+    // Load the program from its executable, or from its data files
+    memory_t *memory = &cpu_state->memory;
+    char *elf_path = join_strings(program_path, ".elf");
+    elf_file_t elf;
+    int rc = elf_open(&elf, elf_path);
+    if (rc == 0) {
+        rc = load_elf_program(memory, &elf, elf_path);
+        elf_close(&elf);
+    } else if (rc == -ENOENT) {
+        rc = load_bin_program(memory, program_path);
+    }
+    free(elf_path);
+
+    /* The memory segments without a data file are only allocated, so the size
+     * of each one is its max_size. */
+    for (int i = 0; rc >= 0 && i < memory->num_segments; i++)
     {
-        /* If the memory segment doesn't have a data file, we only allocate it.
-         * In this case, the size of the memory segment is max_size. */
-        mem_segment_t *segment = &cpu_state->memory.segments[i];
+        mem_segment_t *segment = &memory->segments[i];
         if (segment->extension == NULL) {
             segment->size = segment->max_size;
-            malloc_mem_segment(segment);
-            continue;
+            if (map_mem_segment(memory, segment, -1) < 0) {
+                fprintf(stderr, "Error: Unable to allocate memory for "
+                        "processor memory segment.\n");
+                exit(ENOMEM);
+            }
         }
+    }
 
-        /* Otherwise, combine the program path and extension to get the path
-         * to the data file, load it, then free the buffer. */
-        char *data_path = join_strings(program_path, segment->extension);
-        rc = load_mem_segment(segment, data_path);
-        free(data_path);
+    // Free the memory segments if the program failed to load
+    if (rc < 0) {
+        mem_unload_program(cpu_state);
+    }
 
-        // Free the other memory segments if we failed to load this one
-        if (rc < 0) {
-            mem_unload_program(cpu_state);
-            break;
+    // Predecode the user text segment, now that its contents are loaded
+    for (int i = 0; rc >= 0 && i < memory->num_segments; i++)
+    {
+        if (memory->segments[i].base_addr == USER_TEXT_START) {
+            decode_cache_build(cpu_state, &memory->segments[i]);
         }
     }
 
-    /* Point the PC to the user text segment, the stack pointer (x2) to the
-     * stack segment, and the global pointer (x3) to the user data segment. */
-    cpu_state->pc = USER_TEXT_START;
-    register_write(cpu_state, REG_SP, STACK_END);
-    register_write(cpu_state, REG_GP, USER_DATA_START);
+    /* Clear the page table, which maps the loaded segments' pages as they are
+     * accessed, and reset the TLB counters. */
+    mem_unmap_all(memory);
+    mem_reset_tlb_stats(memory);
 
+    memory->loaded = (rc >= 0);
+    memory->file_backed = (rc >= 0);
+    mem_init_registers(cpu_state);
     return rc;
 }
 
+/**
+ * Replaces the memory of the loaded program with zero-filled segments of the
+ * given sizes, one for each segment, so that a saved image can be copied into
+ * them. Each size must be a multiple of 4 bytes that does not exceed the
+ * segment's max_size.
+ *
+ * The caller must build the predecoded text segment once the text is copied
+ * in. Since the segments no longer map the program's files, the memory can
+ * not be reset by mem_reset_program afterwards.
+ **/
+void mem_load_image(cpu_state_t *cpu_state, const uint32_t *sizes)
+{
+    mem_unload_program(cpu_state);
+
+    memory_t *memory = &cpu_state->memory;
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        mem_segment_t *segment = &memory->segments[i];
+        assert(sizes[i] <= segment->max_size && sizes[i] % 4 == 0);
+        if (sizes[i] == 0) {
+            continue;
+        }
+
+        segment->size = sizes[i];
+        if (map_mem_segment(memory, segment, -1) < 0) {
+            fprintf(stderr, "Error: Unable to allocate memory for processor "
+                    "memory segment.\n");
+            exit(ENOMEM);
+        }
+    }
+
+    mem_reset_tlb_stats(memory);
+    memory->loaded = true;
+    memory->file_backed = false;
+    return;
+}
+
+/**
+ * Resets the memory of the loaded program to its contents when it was loaded.
+ *
+ * Only the pages that were written since the program was loaded are restored,
+ * by discarding their private copies, so this needs no file I/O. Returns a
+ * negative error code if no program is loaded, or if its memory was replaced
+ * by mem_load_image.
+ **/
+int mem_reset_program(cpu_state_t *cpu_state)
+{
+    memory_t *memory = &cpu_state->memory;
+    if (!memory->loaded || !memory->file_backed) {
+        return -ENOENT;
+    }
+
+    // Restore the dirty pages in each segment that has memory
+    bool text_restored = false;
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        mem_segment_t *segment = &memory->segments[i];
+        if (segment->mem != NULL && reset_mem_segment(memory, segment) &&
+                segment->base_addr == USER_TEXT_START) {
+            text_restored = true;
+        }
+    }
+
+    // Discard the scratch page from an invalid access in the flat mode
+    if (flat_scratch_page != NULL) {
+        mem_flat_reserve(flat_scratch_page, MEM_PAGE_SIZE);
+        flat_scratch_page = NULL;
+    }
+
+    /* The store TLB must be empty, so that the pages are marked dirty again
+     * when they are next written. */
+    mem_tlb_flush(memory);
+    mem_reset_tlb_stats(memory);
+
+    // The predecoded text segment is only stale if the program modified it
+    if (text_restored) {
+        decode_cache_free(cpu_state);
+        decode_cache_build(cpu_state, mem_find_segment(cpu_state,
+                USER_TEXT_START));
+    }
+
+    mem_init_registers(cpu_state);
+    return 0;
+}
+
 /**
  * Unloads a program previously loaded by mem_load_program.
  *
@@ -296,18 +1547,69 @@ int mem_load_program(cpu_state_t *cpu_state, const char *program_path)
  **/
 void mem_unload_program(struct cpu_state *cpu_state)
 {
+    /* Free the predecoded text segment and the page table, which refer to the
+     * memory segments. */
+    decode_cache_free(cpu_state);
+    mem_unmap_all(&cpu_state->memory);
+    cpu_state->memory.loaded = false;
+    cpu_state->memory.file_backed = false;
+
+    // Programs start at the user text segment unless their executable says so
+    cpu_state->memory.entry_point = USER_TEXT_START;
+    free(cpu_state->memory.symbols);
+    free(cpu_state->memory.symbol_names);
+    cpu_state->memory.num_symbols = 0;
+    cpu_state->memory.symbols = NULL;
+    cpu_state->memory.symbol_names = NULL;
+
+    // Checkpoints of the program cannot be extended once it is unloaded
+    free(cpu_state->memory.checkpoint_path);
+    cpu_state->memory.checkpoint_path = NULL;
+
     // Free each of the memory segments, if it has an allocated memory segment
     memory_t *memory = &cpu_state->memory;
     for (int i = 0; i < memory->num_segments; i++)
     {
         mem_segment_t *segment = &memory->segments[i];
         if (segment->mem != NULL) {
-            free(segment->mem);
-            segment->mem = NULL;
-            segment->size = 0;
+            free_mem_segment(memory, segment);
         }
     }
 
+    // Discard the scratch page from an invalid access in the flat mode
+    if (flat_scratch_page != NULL) {
+        mem_flat_reserve(flat_scratch_page, MEM_PAGE_SIZE);
+        flat_scratch_page = NULL;
+    }
+
+    return;
+}
+
+/**
+ * Releases all of the processor's memory, which unloads any loaded program,
+ * releases the flat address space, if it was reserved, and frees the memory
+ * segments and devices from mem_init. In the flat mode, this must be called
+ * on the thread that reserved the address space.
+ **/
+void mem_destroy(cpu_state_t *cpu_state)
+{
+    mem_unload_program(cpu_state);
+
+    memory_t *memory = &cpu_state->memory;
+    if (memory->flat_base != NULL) {
+        munmap(memory->flat_base, MEM_FLAT_SIZE);
+        memory->flat_base = NULL;
+    }
+    if (flat_cpu_state == cpu_state) {
+        flat_cpu_state = NULL;
+    }
+
+    free(memory->segments);
+    free(memory->devices);
+    memory->num_segments = 0;
+    memory->segments = NULL;
+    memory->num_devices = 0;
+    memory->devices = NULL;
     return;
 }
 
@@ -344,23 +1646,13 @@ bool mem_range_valid(const cpu_state_t *cpu_state, uint32_t start_addr,
  **/
 mem_segment_t *mem_find_segment(const cpu_state_t *cpu_state, uint32_t addr)
 {
-    // Iterate over the memory segments, checking if the address lies in them
-    for (int i = 0; i < cpu_state->memory.num_segments; i++)
-    {
-        mem_segment_t *segment = &cpu_state->memory.segments[i];
-        uint32_t segment_end_addr = segment->base_addr + segment->size;
-
-        if (segment->base_addr <= addr && addr < segment_end_addr) {
-            return segment;
-        }
-    }
-
-    return NULL;
+    return mem_lookup_segment(&cpu_state->memory, addr);
 }
 
 /**
  * Writes the specified value out to the given address in the segment in
- * little-endian order.
+ * little-endian order, and marks the pages that it covers as written. The
+ * address need not be aligned, so the word may cover two pages.
  *
  * The address must lie inside the specified segment. Any parts of the word
  * which lie outside of the segment are not written.
@@ -379,6 +1671,69 @@ void mem_write_word(mem_segment_t *segment, uint32_t addr, uint32_t value)
     {
         mem_addr[i] = get_byte(value, i);
     }
+    mem_mark_dirty(segment, addr);
+    mem_mark_dirty(segment, addr + bytes_write - 1);
+
+    return;
+}
+
+/**
+ * Copies the data into the segment at the given offset, and marks the pages
+ * that it covers as written. The range must lie inside the segment.
+ *
+ * This does not invalidate the predecoded text segment, so if the segment is
+ * the user text segment, the caller must rebuild it.
+ **/
+void mem_write_segment(mem_segment_t *segment, uint32_t offset,
+        const void *data, uint32_t size)
+{
+    assert(size <= segment->size && offset <= segment->size - size);
+
+    // In the flat mode, the fault handler makes the pages writable as needed
+    memcpy(&segment->mem[offset], data, size);
+    for (uint32_t page_offset = offset & ~(MEM_PAGE_SIZE - 1);
+            page_offset < offset + size; page_offset += MEM_PAGE_SIZE)
+    {
+        mem_mark_dirty(segment, segment->base_addr + page_offset);
+    }
+
+    return;
+}
+
+/**
+ * Clears the checkpoint flag of every page in memory, so that only the pages
+ * that are written afterwards are saved by the next checkpoint.
+ **/
+void mem_clear_checkpoint_dirty(cpu_state_t *cpu_state)
+{
+    memory_t *memory = &cpu_state->memory;
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        mem_segment_t *segment = &memory->segments[i];
+        if (segment->mem == NULL) {
+            continue;
+        }
+
+        /* In the flat mode, the pages that were written must be write
+         * protected again, so that the fault handler sees their next write. */
+        uint32_t num_pages = mem_host_page_round(segment->size) / MEM_PAGE_SIZE;
+        for (uint32_t j = 0; j < num_pages; j++)
+        {
+            if (!(segment->dirty_pages[j] & MEM_DIRTY_CHECKPOINT)) {
+                continue;
+            } else if (memory->flat_base != NULL && mprotect(
+                        &segment->mem[j * MEM_PAGE_SIZE], MEM_PAGE_SIZE,
+                        PROT_READ) < 0) {
+                fprintf(stderr, "Error: Unable to write protect processor "
+                        "memory: %s.\n", strerror(errno));
+                exit(errno);
+            }
+            segment->dirty_pages[j] &= ~MEM_DIRTY_CHECKPOINT;
+        }
+    }
 
+    /* Pages only enter the store TLB once they are marked, so it must be
+     * emptied for the next writes to the pages to be seen. */
+    memset(memory->store_tlb.entries, 0, sizeof(memory->store_tlb.entries));
     return;
 }
@@ -10,7 +10,8 @@
  *
  * This defines the metadata about each segment in memory, such as its starting
  * address and maximum size. Also, this defines an array that represents all of
- * the available memory segments.
+ * the available memory segments, and an array of the memory-mapped devices
+ * that lie between them.
  *
  * Authors:
  *  - 2017: Brandon Perez
@@ -25,7 +26,10 @@
 #define MEMORY_SEGMENTS_H_
 
 // 18-447 Simulator Includes
-#include <memory.h>         // Memory segment type
+#include <memory.h>         // Memory segment and device types
+
+// Local Includes
+#include "devices.h"        // Callbacks of the memory-mapped devices
 
 /*----------------------------------------------------------------------------
  * Memory Segment Addresses
@@ -47,13 +51,22 @@
 #define KERNEL_TEXT_START   0x80000000
 #define KERNEL_DATA_START   0x90000000
 
+/* The window between the stack and the kernel text that holds the registers of
+ * the memory-mapped devices, and the starting address of each device. */
+#define DEVICES_START       0x7fff0000
+#define DEVICES_END         0x80000000
+#define CONSOLE_START       (DEVICES_START + 0x00)
+#define TIMER_START         (DEVICES_START + 0x10)
+#define COPY_START          (DEVICES_START + 0x20)
+
 /*----------------------------------------------------------------------------
  * Memory Segments
  *----------------------------------------------------------------------------*/
 
-// An array containing metadata about the segments in the processor's memory.
+/* An array containing metadata about the segments in the processor's memory.
+ * This is the default layout, which each processor copies in mem_init. */
 __attribute__((unused))
-static mem_segment_t MEMORY_SEGMENTS[NUM_MEM_SEGMENTS] = {
+static const mem_segment_t MEMORY_SEGMENTS[NUM_MEM_SEGMENTS] = {
     // The user text memory segment, containing user code
     {
         .base_addr          = USER_TEXT_START,
@@ -96,4 +109,41 @@ static mem_segment_t MEMORY_SEGMENTS[NUM_MEM_SEGMENTS] = {
     },
 };
 
+/*----------------------------------------------------------------------------
+ * Memory-Mapped Devices
+ *----------------------------------------------------------------------------*/
+
+/* An array containing the memory-mapped devices in the processor's memory.
+ * This is their initial state, which each processor copies in mem_init. */
+__attribute__((unused))
+static const mem_device_t MEMORY_DEVICES[] = {
+    /* The console, which prints the low byte of each value written to its
+     * transmit register to stdout. */
+    {
+        .base_addr          = CONSOLE_START,
+        .size               = DEVICE_CONSOLE_SIZE,
+        .name               = "Console",
+        .write              = device_console_write,
+    },
+
+    /* The timer, whose two registers are the low and high words of the host's
+     * monotonic clock, in nanoseconds. */
+    {
+        .base_addr          = TIMER_START,
+        .size               = DEVICE_TIMER_SIZE,
+        .name               = "Timer",
+        .read               = device_timer_read,
+    },
+
+    /* The bulk copy engine, which copies the given number of bytes from the
+     * source to the destination address when its length register is written. */
+    {
+        .base_addr          = COPY_START,
+        .size               = DEVICE_COPY_SIZE,
+        .name               = "Bulk Copy",
+        .read               = device_copy_read,
+        .write              = device_copy_write,
+    },
+};
+
 #endif /* MEMORY_SEGMENTS_H_ */
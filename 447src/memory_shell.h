@@ -36,16 +36,79 @@
  * Interface
  *----------------------------------------------------------------------------*/
 
+/**
+ * Sets up the processor's memory with its own copy of the default memory
+ * segments and devices, so that it shares no state with any other processor.
+ * This must be called before any other memory function. Exits on error.
+ **/
+void mem_init(cpu_state_t *cpu_state);
+
+/**
+ * Resets the registers of the memory-mapped devices to their initial state, so
+ * that nothing from a previous program is left in them.
+ **/
+void mem_reset_devices(cpu_state_t *cpu_state);
+
+/**
+ * Switches the memory subsystem to the flat address space mode.
+ *
+ * This reserves the full 4 GiB guest address space in host memory, so that the
+ * segments of programs loaded afterwards are mapped at their guest addresses,
+ * and guest accesses need no translation. Accesses outside of the segments are
+ * caught by a SIGSEGV handler, which halts the CPU. Segments are mapped in
+ * whole host pages, so accesses past the end of a segment but inside its last
+ * page are instead checked against the segment's size. This must be called
+ * before any program is loaded, and only one CPU per thread can use the flat
+ * mode at a time.
+ *
+ * The handler is installed for the whole process, the first time that any CPU
+ * uses the flat mode, and stays installed. Faults outside of the flat address
+ * spaces are passed on to the SIGSEGV action from before it was installed.
+ **/
+int mem_enable_flat(cpu_state_t *cpu_state);
+
+/**
+ * Sets the size of the stack segment, which grows down from STACK_END, and
+ * moves the limit of the user data segment below it to match. The size must
+ * be a non-zero multiple of the page size, and leave room for the user data
+ * segment. This must be called before any program is loaded. Returns a
+ * negative error code on failure.
+ **/
+int mem_set_stack_size(cpu_state_t *cpu_state, uint32_t size);
+
 /**
  * Initializes the memory subsystem part of the CPU state.
  *
  * This loads the memory segments from the specified program into the CPU
- * memory, and initializes them to the values specified in their respective data
- * files. Program name should be the path to the executable file (it has no
- * extension).
+ * memory. The program is loaded from its ELF executable, which is the program
+ * path with a .elf extension, or if there is none, from the data files for each
+ * of its segments. Program name should be the path to the program without any
+ * extension.
  **/
 int mem_load_program(cpu_state_t *cpu_state, const char *program_path);
 
+/**
+ * Replaces the memory of the loaded program with zero-filled segments of the
+ * given sizes, one for each segment, so that a saved image can be copied into
+ * them. Each size must be a multiple of 4 bytes that does not exceed the
+ * segment's max_size.
+ *
+ * The caller must build the predecoded text segment once the text is copied
+ * in. Since the segments no longer map the program's files, the memory can
+ * not be reset by mem_reset_program afterwards.
+ **/
+void mem_load_image(cpu_state_t *cpu_state, const uint32_t *sizes);
+
+/**
+ * Resets the memory of the loaded program to its contents when it was loaded.
+ *
+ * Only the pages that were written since the program was loaded are restored,
+ * by discarding their private copies, so this needs no file I/O. Returns a
+ * negative error code if no program is loaded, or if its memory was replaced
+ * by mem_load_image.
+ **/
+int mem_reset_program(cpu_state_t *cpu_state);
+
 /**
  * Unloads a program previously loaded by mem_load_program.
  *
@@ -54,6 +117,14 @@ int mem_load_program(cpu_state_t *cpu_state, const char *program_path);
  **/
 void mem_unload_program(cpu_state_t *cpu_state);
 
+/**
+ * Releases all of the processor's memory, which unloads any loaded program,
+ * releases the flat address space, if it was reserved, and frees the memory
+ * segments and devices from mem_init. In the flat mode, this must be called
+ * on the thread that reserved the address space.
+ **/
+void mem_destroy(cpu_state_t *cpu_state);
+
 /**
  * Checks if the given memory range from start to end (inclusive) is valid.
  *
@@ -72,11 +143,28 @@ mem_segment_t *mem_find_segment(const cpu_state_t *cpu_state, uint32_t addr);
 
 /**
  * Writes the specified value out to the given address in the segment in
- * little-endian order.
+ * little-endian order, and marks the pages that it covers as written. The
+ * address need not be aligned, so the word may cover two pages.
  *
  * The address must lie inside the specified segment. Any parts of the word
  * which lie outside of the segment are not written.
  **/
 void mem_write_word(mem_segment_t *segment, uint32_t addr, uint32_t value);
 
+/**
+ * Copies the data into the segment at the given offset, and marks the pages
+ * that it covers as written. The range must lie inside the segment.
+ *
+ * This does not invalidate the predecoded text segment, so if the segment is
+ * the user text segment, the caller must rebuild it.
+ **/
+void mem_write_segment(mem_segment_t *segment, uint32_t offset,
+        const void *data, uint32_t size);
+
+/**
+ * Clears the checkpoint flag of every page in memory, so that only the pages
+ * that are written afterwards are saved by the next checkpoint.
+ **/
+void mem_clear_checkpoint_dirty(cpu_state_t *cpu_state);
+
 #endif /* MEMORY_SHELL_H_ */
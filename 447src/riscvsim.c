@@ -0,0 +1,346 @@
+/**
+ * riscvsim.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the simulator library, libriscvsim, which lets other
+ * programs run the simulator without its shell.
+ *
+ * Each instance wraps a processor with its own memory segments and devices,
+ * from mem_init, and points the processor's interrupt flag at the instance's
+ * own stop flag, instead of the shell's SIGINT flag. Programs are loaded and
+ * run in the same way as batch mode, so the library and the simulator agree on
+ * how each run ends.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+// Standard Includes
+#include <stdlib.h>                 // Malloc and related functions
+#include <stdio.h>                  // Printf and related functions
+#include <stdint.h>                 // Fixed-size integral types
+#include <stdbool.h>                // Definition of the boolean type
+#include <string.h>                 // Memcpy and string functions
+#include <errno.h>                  // Error codes
+
+// 18-447 Simulator Includes
+#include <sim.h>                    // Definition of cpu_state_t
+#include <register_file.h>          // Interface to the register file
+#include <riscvsim.h>               // This file's interface
+
+// Local Includes
+#include "libc_extensions.h"        // The min function
+#include "commands.h"               // Loading and running of programs
+#include "memory_shell.h"           // Interface to the processor memory
+#include "memory_segments.h"        // Default stack size, user text segment
+
+/*----------------------------------------------------------------------------
+ * Internal Definitions
+ *----------------------------------------------------------------------------*/
+
+// An instance of the simulator
+struct riscvsim {
+    cpu_state_t cpu_state;      // The instance's processor
+    volatile bool stop;         // Flag that stops the processor's current run
+    char *program_path;         // Path of the loaded program, or NULL if none
+};
+
+/*----------------------------------------------------------------------------
+ * Helper Functions
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Checks that a program is loaded, printing an error for the given operation
+ * if there is none.
+ **/
+static bool riscvsim_loaded(const riscvsim_t *sim, const char *operation)
+{
+    if (sim->program_path == NULL) {
+        fprintf(stderr, "Error: %s: No program is loaded.\n", operation);
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Finds the segment of the loaded program's memory that holds the address, and
+ * gets the number of bytes of the range from the address that lie in it.
+ * Returns NULL if the address is not in any segment.
+ **/
+static mem_segment_t *riscvsim_find_range(const riscvsim_t *sim, uint32_t addr,
+        uint32_t size, uint32_t *range_size)
+{
+    mem_segment_t *segment = mem_find_segment(&sim->cpu_state, addr);
+    if (segment == NULL) {
+        return NULL;
+    }
+
+    uint32_t offset = addr - segment->base_addr;
+    *range_size = min(size, segment->size - offset);
+    return segment;
+}
+
+/*----------------------------------------------------------------------------
+ * Instances
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Creates an instance of the simulator with the given options, or with the
+ * default options if they are NULL, which are the interpreter, the paged
+ * memory mode, and the default stack size. No program is loaded. Returns NULL
+ * on failure.
+ **/
+riscvsim_t *riscvsim_create(const riscvsim_options_t *options)
+{
+    riscvsim_t *sim = calloc(1, sizeof(*sim));
+    if (sim == NULL) {
+        fprintf(stderr, "Error: Unable to allocate the simulator.\n");
+        return NULL;
+    }
+
+    // Set up the processor, which is stopped by the instance's own flag
+    cpu_state_t *cpu_state = &sim->cpu_state;
+    cpu_state->engine = (options == NULL) ? SIM_ENGINE_INTERPRETER :
+            options->engine;
+    cpu_state->interrupt = &sim->stop;
+    cpu_state->halted = true;
+    cpu_state->halt_reason = SIM_HALT_STOPPED;
+    mem_init(cpu_state);
+
+    uint32_t stack_size = (options == NULL || options->stack_size == 0) ?
+            STACK_SIZE : options->stack_size;
+    if (mem_set_stack_size(cpu_state, stack_size) < 0) {
+        fprintf(stderr, "Error: The stack size must be a multiple of %u bytes "
+                "that leaves room for the user data segment.\n",
+                MEM_PAGE_SIZE);
+        riscvsim_destroy(sim);
+        return NULL;
+    } else if (options != NULL && options->flat_memory &&
+            mem_enable_flat(cpu_state) < 0) {
+        riscvsim_destroy(sim);
+        return NULL;
+    }
+
+    return sim;
+}
+
+/**
+ * Destroys the instance, unloading its program, and freeing all of its memory.
+ **/
+void riscvsim_destroy(riscvsim_t *sim)
+{
+    mem_destroy(&sim->cpu_state);
+    free(sim->program_path);
+    free(sim);
+    return;
+}
+
+/**
+ * Loads the given program, replacing any loaded program, and resets the
+ * registers. The path is the same as the one given to the simulator on the
+ * command line, and any extension on it is ignored.
+ **/
+int riscvsim_load(riscvsim_t *sim, const char *program_path)
+{
+    // The processor keeps the path, without its extension, as its program
+    char *path = strdup(program_path);
+    if (path == NULL) {
+        fprintf(stderr, "Error: Unable to allocate the program path.\n");
+        return -ENOMEM;
+    }
+
+    mem_unload_program(&sim->cpu_state);
+    mem_reset_devices(&sim->cpu_state);
+    free(sim->program_path);
+    sim->program_path = NULL;
+
+    int rc = init_cpu_state(&sim->cpu_state, path);
+    if (rc < 0) {
+        free(path);
+        return rc;
+    }
+
+    sim->program_path = path;
+    return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * Running
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Runs the loaded program until it halts, or until the given maximum number of
+ * instructions have retired, if it is not 0. A run that reached the limit can
+ * be continued with another call. Returns how the run ended, or a negative
+ * error code if no program is loaded.
+ **/
+int riscvsim_run(riscvsim_t *sim, uint32_t max_instrs)
+{
+    if (!riscvsim_loaded(sim, "run")) {
+        return -EINVAL;
+    }
+
+    // A stop request only applies to a single run
+    switch (run_program(&sim->cpu_state, max_instrs))
+    {
+        case BATCH_HALTED:
+            return RISCVSIM_HALTED;
+
+        case BATCH_LIMIT:
+            return RISCVSIM_LIMIT;
+
+        case BATCH_INTERRUPTED:
+            sim->stop = false;
+            return RISCVSIM_STOPPED;
+
+        default:
+            return RISCVSIM_FAULTED;
+    }
+}
+
+/**
+ * Stops the instance's current run, or its next run if there is none, which
+ * then returns RISCVSIM_STOPPED. This can be called from any thread, or from a
+ * signal handler.
+ **/
+void riscvsim_stop(riscvsim_t *sim)
+{
+    sim->stop = true;
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * Processor State
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Gets the number of instructions that the loaded program has retired.
+ **/
+uint64_t riscvsim_instructions(const riscvsim_t *sim)
+{
+    return sim->cpu_state.cycle;
+}
+
+/**
+ * Gets the program counter, which is the address of the next instruction.
+ **/
+uint32_t riscvsim_read_pc(const riscvsim_t *sim)
+{
+    return sim->cpu_state.pc;
+}
+
+/**
+ * Reads the value of the given register, x0 to x31.
+ **/
+int riscvsim_read_register(const riscvsim_t *sim, unsigned int reg,
+        uint32_t *value)
+{
+    if (reg >= RISCV_NUM_REGS) {
+        fprintf(stderr, "Error: Register x%u does not exist.\n", reg);
+        return -EINVAL;
+    }
+
+    *value = register_read(&sim->cpu_state, reg);
+    return 0;
+}
+
+/**
+ * Writes the value to the given register, x0 to x31. Writes to x0 are ignored.
+ **/
+int riscvsim_write_register(riscvsim_t *sim, unsigned int reg,
+        uint32_t value)
+{
+    if (reg >= RISCV_NUM_REGS) {
+        fprintf(stderr, "Error: Register x%u does not exist.\n", reg);
+        return -EINVAL;
+    }
+
+    register_write(&sim->cpu_state, reg, value);
+    return 0;
+}
+
+/**
+ * Reads the given number of bytes at the address from the loaded program's
+ * memory. The whole range must lie in its memory segments, and not in the
+ * memory-mapped devices.
+ **/
+int riscvsim_read_memory(const riscvsim_t *sim, uint32_t addr, void *data,
+        uint32_t size)
+{
+    if (!riscvsim_loaded(sim, "read memory")) {
+        return -EINVAL;
+    }
+
+    // Check the whole range first, so that nothing is read on failure
+    for (uint32_t done = 0, range_size; done < size; done += range_size)
+    {
+        if (riscvsim_find_range(sim, addr + done, size - done,
+                    &range_size) == NULL) {
+            fprintf(stderr, "Error: Address 0x%08x is not in memory.\n",
+                    addr + done);
+            return -EFAULT;
+        }
+    }
+
+    for (uint32_t done = 0, range_size; done < size; done += range_size)
+    {
+        const mem_segment_t *segment = riscvsim_find_range(sim, addr + done,
+                size - done, &range_size);
+        memcpy((uint8_t *)data + done, &segment->mem[addr + done -
+                segment->base_addr], range_size);
+    }
+    return 0;
+}
+
+/**
+ * Writes the given number of bytes to the address in the loaded program's
+ * memory. The whole range must lie in its memory segments, and not in the
+ * memory-mapped devices. Writes to the program's text take effect the next
+ * time that the instructions are run.
+ **/
+int riscvsim_write_memory(riscvsim_t *sim, uint32_t addr, const void *data,
+        uint32_t size)
+{
+    if (!riscvsim_loaded(sim, "write memory")) {
+        return -EINVAL;
+    }
+
+    // Check the whole range first, so that nothing is written on failure
+    for (uint32_t done = 0, range_size; done < size; done += range_size)
+    {
+        if (riscvsim_find_range(sim, addr + done, size - done,
+                    &range_size) == NULL) {
+            fprintf(stderr, "Error: Address 0x%08x is not in memory.\n",
+                    addr + done);
+            return -EFAULT;
+        }
+    }
+
+    /* Writes to the user text segment make its predecoded entries stale, so
+     * each word that is written there is decoded again. */
+    for (uint32_t done = 0, range_size; done < size; done += range_size)
+    {
+        mem_segment_t *segment = riscvsim_find_range(sim, addr + done,
+                size - done, &range_size);
+        uint32_t start = addr + done;
+        mem_write_segment(segment, start - segment->base_addr,
+                (const uint8_t *)data + done, range_size);
+        if (segment->base_addr != USER_TEXT_START) {
+            continue;
+        }
+
+        uint64_t end = (uint64_t)start + range_size;
+        for (uint64_t word = start & ~(uint32_t)(sizeof(uint32_t) - 1);
+                word < end; word += sizeof(uint32_t))
+        {
+            decode_cache_invalidate(&sim->cpu_state, word);
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,391 @@
+/**
+ * runner.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the test runner, which runs and verifies a list of
+ * programs on a pool of worker threads.
+ *
+ * The workers take the next test from a shared counter, so a long test does
+ * not hold up the tests behind it. Each worker sets up its own processor on
+ * its own thread, since the flat memory mode is tracked per thread, with its
+ * own memory segments and devices, so no state is shared between the tests.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+// Standard Includes
+#include <stdlib.h>                 // Malloc and related functions
+#include <stdio.h>                  // Printf and related functions
+#include <stdint.h>                 // Fixed-size integral types
+#include <stdbool.h>                // Definition of the boolean type
+#include <string.h>                 // Memset and string functions
+#include <errno.h>                  // Error codes
+#include <inttypes.h>               // Format specifiers for fixed-size types
+#include <stdatomic.h>              // Atomic counter for the next test
+#include <time.h>                   // Monotonic clock for the wall time
+#include <fcntl.h>                  // Opening of /dev/null
+#include <unistd.h>                 // Dup and sysconf functions
+#include <pthread.h>                // Worker threads
+
+// 18-447 Simulator Includes
+#include <sim.h>                    // Definition of cpu_state_t
+
+// Local Includes
+#include "libc_extensions.h"        // The min function
+#include "commands.h"               // Loading and running of programs
+#include "memory_shell.h"           // Interface to the processor memory
+#include "verify.h"                 // Verification against a reference
+#include "runner.h"                 // This file's interface
+
+/*----------------------------------------------------------------------------
+ * Internal Definitions
+ *----------------------------------------------------------------------------*/
+
+// The extension of the reference register dump for each program
+#define REFERENCE_EXTENSION     ".reg"
+
+// The result of running and verifying a single test
+typedef struct runner_result {
+    const char *error;          // Why the test could not run, or NULL if it did
+    batch_status_t status;      // How the run ended
+    int num_mismatches;         // Number of registers that did not match
+    uint64_t instructions;      // Number of instructions retired
+    double wall_time;           // Time to load, run, and verify, in seconds
+    double run_time;            // Time to run the program alone, in seconds
+} runner_result_t;
+
+// The state shared by the worker threads
+typedef struct runner_pool {
+    const runner_options_t *options;    // Options for the workers' processors
+    char **programs;                    // Programs to run, in the given order
+    int num_programs;                   // Number of programs to run
+    runner_result_t *results;           // Result of each program
+    atomic_int next_test;               // Index of the next test to be taken
+} runner_pool_t;
+
+/*----------------------------------------------------------------------------
+ * Helper Functions
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Gets the current time from the monotonic clock, in seconds.
+ **/
+static double runner_time()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return now.tv_sec + now.tv_nsec / 1e9;
+}
+
+/**
+ * Checks if the test passed, which requires it to have completed, by halting
+ * or stopping on an error like the reference may have, with every register
+ * matching the reference.
+ **/
+static bool runner_passed(const runner_result_t *result)
+{
+    return result->error == NULL && (result->status == BATCH_HALTED ||
+            result->status == BATCH_FAULTED) && result->num_mismatches == 0;
+}
+
+/**
+ * Copies the given string, exiting on error.
+ **/
+static char *runner_strdup(const char *string)
+{
+    char *copy = strdup(string);
+    if (copy == NULL) {
+        fprintf(stderr, "Error: Unable to allocate the program path.\n");
+        exit(ENOMEM);
+    }
+    return copy;
+}
+
+/*----------------------------------------------------------------------------
+ * Worker Threads
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Loads, runs, and verifies the program on the processor, recording the
+ * result. The devices are reset first, and the program is unloaded after, so
+ * that each test starts from the same state.
+ **/
+static void runner_run_test(cpu_state_t *cpu_state,
+        const runner_options_t *options, const char *program,
+        runner_result_t *result)
+{
+    double start_time = runner_time();
+    mem_reset_devices(cpu_state);
+
+    // Loading the program strips the extension from its path, so use a copy
+    char *program_path = runner_strdup(program);
+    if (init_cpu_state(cpu_state, program_path) < 0) {
+        result->error = "load failed";
+        free(program_path);
+        return;
+    }
+
+    // The reference is next to the program, with its own extension
+    char *reference_path = malloc(strlen(program_path) +
+            sizeof(REFERENCE_EXTENSION));
+    if (reference_path == NULL) {
+        fprintf(stderr, "Error: Unable to allocate the reference path.\n");
+        exit(ENOMEM);
+    }
+    sprintf(reference_path, "%s%s", program_path, REFERENCE_EXTENSION);
+
+    verify_reference_t reference;
+    if (verify_load_reference(&reference, reference_path) < 0) {
+        result->error = "bad reference";
+    } else {
+        double run_start = runner_time();
+        result->status = run_program(cpu_state, options->max_instrs);
+        result->run_time = runner_time() - run_start;
+        result->instructions = cpu_state->cycle;
+
+        bool completed = (result->status == BATCH_HALTED ||
+                result->status == BATCH_FAULTED);
+        result->num_mismatches = verify_registers(cpu_state, &reference,
+                batch_outcome_name(result->status), completed, NULL);
+        result->error = NULL;
+    }
+
+    mem_unload_program(cpu_state);
+    free(reference_path);
+    free(program_path);
+    result->wall_time = runner_time() - start_time;
+    return;
+}
+
+/**
+ * The body of a worker thread, which sets up its processor, and then runs tests
+ * until there are none left, or the user sends a keyboard interrupt (SIGINT).
+ **/
+static void *runner_worker(void *arg)
+{
+    runner_pool_t *pool = arg;
+    const runner_options_t *options = pool->options;
+
+    // Set up the processor, with its own memory segments and devices
+    cpu_state_t cpu_state;
+    memset(&cpu_state, 0, sizeof(cpu_state));
+    cpu_state.engine = options->engine;
+    cpu_state.interrupt = &SIGINT_RECEIVED;
+    mem_init(&cpu_state);
+
+    // The tests that this worker would have taken are left as not run
+    if (mem_set_stack_size(&cpu_state, options->stack_size) < 0 ||
+            (options->flat_memory && mem_enable_flat(&cpu_state) < 0)) {
+        mem_destroy(&cpu_state);
+        return NULL;
+    }
+
+    while (!SIGINT_RECEIVED)
+    {
+        int test = atomic_fetch_add(&pool->next_test, 1);
+        if (test >= pool->num_programs) {
+            break;
+        }
+        runner_run_test(&cpu_state, options, pool->programs[test],
+                &pool->results[test]);
+    }
+
+    mem_destroy(&cpu_state);
+    return NULL;
+}
+
+/*----------------------------------------------------------------------------
+ * Output Redirection
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Redirects the given file descriptor to /dev/null, saving the original in the
+ * given location. Returns a negative error code on failure.
+ **/
+static int runner_silence(int fd, int *saved_fd)
+{
+    int null_fd = open("/dev/null", O_WRONLY);
+    if (null_fd < 0) {
+        int rc = -errno;
+        fprintf(stderr, "Error: /dev/null: Unable to open file: %s.\n",
+                strerror(errno));
+        return rc;
+    }
+
+    *saved_fd = dup(fd);
+    if (*saved_fd < 0 || dup2(null_fd, fd) < 0) {
+        int rc = -errno;
+        fprintf(stderr, "Error: Unable to redirect the output of the tests: "
+                "%s.\n", strerror(errno));
+        if (*saved_fd >= 0) {
+            close(*saved_fd);
+        }
+        close(null_fd);
+        return rc;
+    }
+
+    close(null_fd);
+    return 0;
+}
+
+/**
+ * Restores the file descriptor that was redirected to /dev/null.
+ **/
+static void runner_restore(int fd, int saved_fd)
+{
+    dup2(saved_fd, fd);
+    close(saved_fd);
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * Results Table
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Prints the table of the tests' results to stdout, in the order that the tests
+ * were given, followed by a summary. Returns the number of tests that passed.
+ **/
+static int runner_print_results(const runner_pool_t *pool, int num_workers,
+        double wall_time)
+{
+    fprintf(stdout, "%-30s %-8s %-16s %12s %10s %9s\n", "Test", "Result",
+            "Outcome", "Instructions", "Time (ms)", "MIPS");
+    fprintf(stdout, "%.90s\n", "-------------------------------------------"
+            "-----------------------------------------------");
+
+    int num_passed = 0;
+    for (int i = 0; i < pool->num_programs; i++)
+    {
+        const runner_result_t *result = &pool->results[i];
+        bool passed = runner_passed(result);
+        num_passed += passed ? 1 : 0;
+
+        /* Describe why the test failed, or how the run ended. A run that was
+         * cut short fails whether or not its registers match. */
+        bool completed = (result->status == BATCH_HALTED ||
+                result->status == BATCH_FAULTED);
+        char detail[32];
+        if (result->error != NULL) {
+            snprintf(detail, sizeof(detail), "%s", result->error);
+        } else if (completed && result->num_mismatches > 0) {
+            snprintf(detail, sizeof(detail), "%d mismatch%s",
+                    result->num_mismatches,
+                    (result->num_mismatches == 1) ? "" : "es");
+        } else {
+            snprintf(detail, sizeof(detail), "%s",
+                    batch_outcome_name(result->status));
+        }
+
+        double mips = (result->run_time > 0) ? result->instructions /
+                result->run_time / 1e6 : 0;
+        fprintf(stdout, "%-30s %-8s %-16s %12" PRIu64 " %10.3f %9.2f\n",
+                pool->programs[i], passed ? "Passed" : "Failed", detail,
+                result->instructions, result->wall_time * 1e3, mips);
+    }
+
+    fprintf(stdout, "\n%d of %d tests passed, on %d worker%s in %.3f s.\n",
+            num_passed, pool->num_programs, num_workers,
+            (num_workers == 1) ? "" : "s", wall_time);
+    return num_passed;
+}
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Runs and verifies each of the given programs against its reference register
+ * dump, spreading them over a pool of worker threads. The output of the
+ * programs and the simulator is suppressed while they run. Afterwards, a table
+ * with the result, the instructions retired, the wall time, and the speed in
+ * millions of instructions per second (MIPS) of each test is printed to stdout.
+ *
+ * Returns the exit status for the run, which is BATCH_HALTED if every test
+ * passed, BATCH_INTERRUPTED if the run was stopped by a keyboard interrupt, and
+ * BATCH_TESTS_FAILED otherwise.
+ **/
+batch_status_t run_tests(const runner_options_t *options, char *programs[],
+        int num_programs)
+{
+    // Use one worker per core by default, but never more than there are tests
+    int num_workers = options->num_workers;
+    if (num_workers <= 0) {
+        num_workers = sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    num_workers = (num_workers < 1) ? 1 : min(num_workers, num_programs);
+
+    runner_result_t *results = calloc(num_programs, sizeof(results[0]));
+    pthread_t *workers = calloc(num_workers, sizeof(workers[0]));
+    if (results == NULL || workers == NULL) {
+        fprintf(stderr, "Error: Unable to allocate the test runner.\n");
+        exit(ENOMEM);
+    }
+    for (int i = 0; i < num_programs; i++)
+    {
+        results[i].error = "not run";
+    }
+
+    runner_pool_t pool = {
+        .options            = options,
+        .programs           = programs,
+        .num_programs       = num_programs,
+        .results            = results,
+    };
+    atomic_init(&pool.next_test, 0);
+
+    // Suppress the output of the tests, including the simulator's errors
+    int saved_stdout, saved_stderr;
+    fflush(stdout);
+    fflush(stderr);
+    if (runner_silence(STDOUT_FILENO, &saved_stdout) < 0) {
+        return BATCH_TESTS_FAILED;
+    } else if (runner_silence(STDERR_FILENO, &saved_stderr) < 0) {
+        runner_restore(STDOUT_FILENO, saved_stdout);
+        return BATCH_TESTS_FAILED;
+    }
+
+    /* Start the workers, running the tests on this thread instead if none of
+     * them could be started. */
+    SIGINT_RECEIVED = false;
+    double start_time = runner_time();
+    int num_started = 0;
+    while (num_started < num_workers && pthread_create(&workers[num_started],
+                NULL, runner_worker, &pool) == 0)
+    {
+        num_started += 1;
+    }
+    if (num_started == 0) {
+        runner_worker(&pool);
+    }
+    for (int i = 0; i < num_started; i++)
+    {
+        pthread_join(workers[i], NULL);
+    }
+    double wall_time = runner_time() - start_time;
+    bool interrupted = SIGINT_RECEIVED;
+    SIGINT_RECEIVED = false;
+
+    // Drop any output the tests left buffered, before the output is restored
+    fflush(stdout);
+    fflush(stderr);
+    runner_restore(STDERR_FILENO, saved_stderr);
+    runner_restore(STDOUT_FILENO, saved_stdout);
+
+    int num_passed = runner_print_results(&pool, (num_started == 0) ? 1 :
+            num_started, wall_time);
+    free(workers);
+    free(results);
+
+    if (interrupted) {
+        return BATCH_INTERRUPTED;
+    }
+    return (num_passed == num_programs) ? BATCH_HALTED : BATCH_TESTS_FAILED;
+}
@@ -0,0 +1,68 @@
+/**
+ * runner.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the test runner, which runs and verifies
+ * a list of programs on a pool of worker threads.
+ *
+ * Each program is verified against the reference register dump next to it,
+ * with the same name and a .reg extension, in the same way as batch mode. Each
+ * worker has its own processor, with its own memory segments and devices, so
+ * the programs are run in parallel within a single simulator process, instead
+ * of starting the simulator once per program.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+#ifndef RUNNER_H_
+#define RUNNER_H_
+
+// Standard Includes
+#include <stdint.h>             // Fixed-size integral types
+#include <stdbool.h>            // Definition of the boolean type
+
+// 18-447 Simulator Includes
+#include <sim.h>                // Definition of sim_engine_t
+
+// Local Includes
+#include "commands.h"           // Definition of batch_status_t
+
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+// The options for the processors that the test runner's workers use
+typedef struct runner_options {
+    sim_engine_t engine;        // Engine used to run instructions
+    bool flat_memory;           // Indicates if the flat memory mode is used
+    uint32_t stack_size;        // Size of the stack segment in bytes
+    uint32_t max_instrs;        // Maximum instructions per test, 0 if no limit
+    int num_workers;            // Number of worker threads, 0 for one per core
+} runner_options_t;
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Runs and verifies each of the given programs against its reference register
+ * dump, spreading them over a pool of worker threads. The output of the
+ * programs and the simulator is suppressed while they run. Afterwards, a table
+ * with the result, the instructions retired, the wall time, and the speed in
+ * millions of instructions per second (MIPS) of each test is printed to stdout.
+ *
+ * Returns the exit status for the run, which is BATCH_HALTED if every test
+ * passed, BATCH_INTERRUPTED if the run was stopped by a keyboard interrupt, and
+ * BATCH_TESTS_FAILED otherwise.
+ **/
+batch_status_t run_tests(const runner_options_t *options, char *programs[],
+        int num_programs);
+
+#endif /* RUNNER_H_ */
@@ -10,7 +10,10 @@
  *
  * The shell is the user-interactive interface that lets the user view the
  * processor state, run programs, and view other information about the program
- * being simulated on the processor.
+ * being simulated on the processor. Alternately, in batch mode, the program is
+ * run to completion from the command line, without the shell, and in test mode,
+ * a list of programs are run and verified in parallel. As a fork server, the
+ * program is run on many inputs, which are sent to the simulator over stdin.
  *
  * Authors:
  *  - 2016 - 2017: Brandon Perez
@@ -32,6 +35,7 @@
 #include <string.h>             // String manipulation functions and memset
 #include <errno.h>              // Error codes and perror
 #include <signal.h>             // Signal numbers and sigaction function
+#include <getopt.h>             // Parsing of command line options
 
 // Readline Includes
 #include <readline/readline.h>  // Interface to the readline library
@@ -44,14 +48,17 @@
 #include "libc_extensions.h"    // The array_len function
 #include "commands.h"           // Interface to the shell commands
 #include "memory_shell.h"       // Interface to the processor memory
-#include "memory_segments.h"    // Definition of memory segments array
+#include "memory_segments.h"    // Default size of the stack segment
+#include "runner.h"             // Interface to the test runner
+#include "fork_server.h"        // Interface to the fork server
 
 /*----------------------------------------------------------------------------
  * Internal Definitions
  *----------------------------------------------------------------------------*/
 
-// The expected number of command line arguments, including the program name
-static const int NUM_CMDLINE_ARGS       = 2;
+/* The expected number of command line arguments, after any options. In test
+ * mode, this is the least number of programs. */
+static const int NUM_CMDLINE_ARGS       = 1;
 
 // The maximum line length the user can type in for a command
 static const int COMMAND_MAX_LEN        = 100;
@@ -64,38 +71,314 @@ static const int COMMAND_MAX_ARGS       = 4;
 static const int HISTORY_MAX_LINES      = 100;
 static const char *HISTORY_FILE         = ".riscv_sim_history";
 
-// Indicates that a SIGINT signal was received by the program
-volatile bool SIGINT_RECEIVED           = false;
-
 /*----------------------------------------------------------------------------
  * Command Line Parsing
  *----------------------------------------------------------------------------*/
 
+// The names of the execution engines that can be selected on the command line
+static const struct {
+    const char *name;           // Name of the engine on the command line
+    sim_engine_t engine;        // The corresponding engine
+} ENGINE_NAMES[] = {
+    { .name = "interpreter",    .engine = SIM_ENGINE_INTERPRETER, },
+    { .name = "threaded",       .engine = SIM_ENGINE_THREADED, },
+    { .name = "block",          .engine = SIM_ENGINE_BLOCK, },
+    { .name = "jit",            .engine = SIM_ENGINE_JIT, },
+    { .name = "aot",            .engine = SIM_ENGINE_AOT, },
+};
+
+// The names of the memory modes that can be selected on the command line
+static const struct {
+    const char *name;           // Name of the memory mode on the command line
+    bool flat;                  // Indicates if the mode is the flat mode
+} MEMORY_MODE_NAMES[] = {
+    { .name = "paged",          .flat = false, },
+    { .name = "flat",           .flat = true, },
+};
+
+// The command line options accepted by the simulator
+static const struct option CMDLINE_OPTIONS[] = {
+    { .name = "engine", .has_arg = required_argument, .val = 'e', },
+    { .name = "memory", .has_arg = required_argument, .val = 'm', },
+    { .name = "stack-size", .has_arg = required_argument, .val = 's', },
+    { .name = "run", .has_arg = no_argument, .val = 'r', },
+    { .name = "rdump", .has_arg = required_argument, .val = 'd', },
+    { .name = "max-instrs", .has_arg = required_argument, .val = 'n', },
+    { .name = "verify", .has_arg = required_argument, .val = 'V', },
+    { .name = "json", .has_arg = required_argument, .val = 'j', },
+    { .name = "tests", .has_arg = no_argument, .val = 't', },
+    { .name = "workers", .has_arg = required_argument, .val = 'w', },
+    { .name = "fork-server", .has_arg = no_argument, .val = 'f', },
+    { .name = NULL, },
+};
+
 /**
  * Prints the usage message for the program.
  **/
 static void print_usage()
 {
-    fprintf(stdout, "Usage: riscv-sim <program>\n");
+    fprintf(stdout, "Usage: riscv-sim [-e|--engine <engine>] "
+            "[-m|--memory <mode>]\n"
+            "                [-s|--stack-size <size>] [-r|--run "
+            "[-d|--rdump <file>]\n"
+            "                [-n|--max-instrs <count>] "
+            "[-V|--verify <reference>\n"
+            "                [-j|--json <file>]]] <program>\n");
+    fprintf(stdout, "       riscv-sim [-e|--engine <engine>] "
+            "[-m|--memory <mode>]\n"
+            "                [-s|--stack-size <size>] -t|--tests "
+            "[-w|--workers <count>]\n"
+            "                [-n|--max-instrs <count>] <program> ...\n");
+    fprintf(stdout, "       riscv-sim [-e|--engine <engine>] "
+            "[-m|--memory <mode>]\n"
+            "                [-s|--stack-size <size>] -f|--fork-server\n"
+            "                [-n|--max-instrs <count>] <program>\n");
+    fprintf(stdout, "Engines: interpreter (default), threaded, block, jit, "
+            "aot\n");
+    fprintf(stdout, "Memory modes: paged (default), flat\n");
+    fprintf(stdout, "Stack size: In bytes, or with a K, M, or G suffix "
+            "(default 1M)\n");
+    fprintf(stdout, "Batch mode: Runs the program without the shell, "
+            "optionally dumping the\n"
+            "    registers to a file and stopping after a count of "
+            "instructions (default no\n"
+            "    limit). Exits with %d if the program halts, %d on a "
+            "simulation error, %d\n"
+            "    if it reaches the limit, %d if the dump fails, and %d if "
+            "interrupted.\n",
+            BATCH_HALTED, BATCH_FAULTED, BATCH_LIMIT, BATCH_DUMP_FAILED,
+            BATCH_INTERRUPTED);
+    fprintf(stdout, "Verification: Checks the registers against a reference "
+            "register dump, writing\n"
+            "    the result as JSON to a file or stdout. Exits with %d if "
+            "they match, %d if\n"
+            "    they do not, and %d if the reference cannot be read.\n",
+            BATCH_HALTED, BATCH_MISMATCH, BATCH_BAD_REFERENCE);
+    fprintf(stdout, "Test mode: Verifies each program against the reference "
+            "next to it, with a .reg\n"
+            "    extension, on a pool of worker threads (default one per "
+            "core), and prints a\n"
+            "    table of the results. Exits with %d if every test passes, "
+            "and %d otherwise.\n", BATCH_HALTED, BATCH_TESTS_FAILED);
+    fprintf(stdout, "Fork server: Loads the program once, then runs it on "
+            "each input patched into\n"
+            "    its data segment by a request on stdin, in a forked child, "
+            "and writes the\n"
+            "    registers and the exit status of each run to stdout. See "
+            "fork_server.h.\n");
     fprintf(stdout, "Example: riscv-sim 447inputs/additest.S\n");
+    fprintf(stdout, "Example: riscv-sim --run --rdump additest.reg "
+            "447inputs/additest.S\n");
+    fprintf(stdout, "Example: riscv-sim --run --verify "
+            "447inputs/additest.reg 447inputs/additest.S\n");
+    fprintf(stdout, "Example: riscv-sim --tests 447inputs/*.S\n");
+    fprintf(stdout, "Example: riscv-sim --fork-server 447inputs/memtest0.S "
+            "< requests\n");
     return;
 }
 
 /**
- * Parses the command-line arguments to the program, which only consist of an
- * optional path to the program to run.
+ * Parses the name of an execution engine, returning a negative error code if it
+ * does not match any engine.
+ **/
+static int parse_engine(const char *engine_name, sim_engine_t *engine)
+{
+    for (int i = 0; i < (int)array_len(ENGINE_NAMES); i++)
+    {
+        if (strcmp(engine_name, ENGINE_NAMES[i].name) == 0) {
+            *engine = ENGINE_NAMES[i].engine;
+            return 0;
+        }
+    }
+
+    return -ENOENT;
+}
+
+/**
+ * Parses the name of a memory mode, returning a negative error code if it does
+ * not match any mode.
+ **/
+static int parse_memory_mode(const char *mode_name, bool *flat)
+{
+    for (int i = 0; i < (int)array_len(MEMORY_MODE_NAMES); i++)
+    {
+        if (strcmp(mode_name, MEMORY_MODE_NAMES[i].name) == 0) {
+            *flat = MEMORY_MODE_NAMES[i].flat;
+            return 0;
+        }
+    }
+
+    return -ENOENT;
+}
+
+/**
+ * Parses a size in bytes, or a count, which may have a K, M, or G suffix for
+ * the binary multiples, returning a negative error code if it is not a valid
+ * size that fits in 32 bits.
+ **/
+static int parse_size(const char *size_string, uint32_t *size)
+{
+    char *suffix;
+    errno = 0;
+    unsigned long long value = strtoull(size_string, &suffix, 0);
+    if (errno != 0 || suffix == size_string || size_string[0] == '-') {
+        return -EINVAL;
+    }
+
+    // Scale the size by its suffix, if it has one
+    int shift = 0;
+    if (strcmp(suffix, "K") == 0) {
+        shift = 10;
+    } else if (strcmp(suffix, "M") == 0) {
+        shift = 20;
+    } else if (strcmp(suffix, "G") == 0) {
+        shift = 30;
+    } else if (*suffix != '\0') {
+        return -EINVAL;
+    }
+
+    if (value > (UINT32_MAX >> shift)) {
+        return -ERANGE;
+    }
+    *size = value << shift;
+    return 0;
+}
+
+/**
+ * Parses the command-line arguments to the program, which consist of the path
+ * to the program to run, optionally preceded by the execution engine, the
+ * memory mode, the stack size to use, and the options for batch mode. In test
+ * mode, there is a list of programs instead, and the number of workers to run
+ * them on. The fork server also takes a single program.
  **/
-static int parse_arguments(int argc, char *argv[], char **program_path)
+static int parse_arguments(int argc, char *argv[], char ***programs,
+        int *num_programs, sim_engine_t *engine, bool *flat_memory,
+        uint32_t *stack_size, batch_options_t *batch, bool *tests,
+        int *num_workers, bool *fork_server)
 {
+    // Parse the command line options, which are all optional
+    int option;
+    while ((option = getopt_long(argc, argv, "e:m:s:rd:n:V:j:tw:f",
+                    CMDLINE_OPTIONS, NULL)) != -1)
+    {
+        switch (option) {
+            case 'e':
+                if (parse_engine(optarg, engine) < 0) {
+                    fprintf(stderr, "Error: Unknown engine '%s'.\n", optarg);
+                    print_usage();
+                    return -EINVAL;
+                }
+                break;
+
+            case 'm':
+                if (parse_memory_mode(optarg, flat_memory) < 0) {
+                    fprintf(stderr, "Error: Unknown memory mode '%s'.\n",
+                            optarg);
+                    print_usage();
+                    return -EINVAL;
+                }
+                break;
+
+            case 's':
+                if (parse_size(optarg, stack_size) < 0) {
+                    fprintf(stderr, "Error: Invalid stack size '%s'.\n",
+                            optarg);
+                    print_usage();
+                    return -EINVAL;
+                }
+                break;
+
+            case 'r':
+                batch->run = true;
+                break;
+
+            case 'd':
+                batch->rdump_path = optarg;
+                break;
+
+            case 'n':
+                if (parse_size(optarg, &batch->max_instrs) < 0) {
+                    fprintf(stderr, "Error: Invalid instruction count '%s'.\n",
+                            optarg);
+                    print_usage();
+                    return -EINVAL;
+                }
+                break;
+
+            case 'V':
+                batch->verify_path = optarg;
+                break;
+
+            case 'j':
+                batch->json_path = optarg;
+                break;
+
+            case 't':
+                *tests = true;
+                break;
+
+            case 'w':
+                if (parse_int(optarg, num_workers) < 0 || *num_workers < 1) {
+                    fprintf(stderr, "Error: Invalid worker count '%s'.\n",
+                            optarg);
+                    print_usage();
+                    return -EINVAL;
+                }
+                break;
+
+            case 'f':
+                *fork_server = true;
+                break;
+
+            default:
+                print_usage();
+                return -EINVAL;
+        }
+    }
+
+    /* The dump and verification options only apply to batch mode, and the
+     * limit also applies to test mode and the fork server, which exclude
+     * batch mode and each other. */
+    if (*fork_server && (*tests || batch->run || batch->rdump_path != NULL ||
+                batch->verify_path != NULL || batch->json_path != NULL)) {
+        fprintf(stderr, "Error: The --fork-server option cannot be used with "
+                "the batch or test mode options.\n");
+        print_usage();
+        return -EINVAL;
+    } else if (*tests && (batch->run || batch->rdump_path != NULL ||
+                batch->verify_path != NULL || batch->json_path != NULL)) {
+        fprintf(stderr, "Error: The --tests option cannot be used with the "
+                "batch mode options.\n");
+        print_usage();
+        return -EINVAL;
+    } else if (!*tests && *num_workers != 0) {
+        fprintf(stderr, "Error: The --workers option requires --tests.\n");
+        print_usage();
+        return -EINVAL;
+    } else if (!batch->run && !*tests && !*fork_server &&
+            (batch->rdump_path != NULL || batch->max_instrs != 0 ||
+             batch->verify_path != NULL)) {
+        fprintf(stderr, "Error: The --rdump, --max-instrs, and --verify "
+                "options require --run.\n");
+        print_usage();
+        return -EINVAL;
+    } else if (batch->verify_path == NULL && batch->json_path != NULL) {
+        fprintf(stderr, "Error: The --json option requires --verify.\n");
+        print_usage();
+        return -EINVAL;
+    }
+
     // Check that the proper number of command line arguments was specified
-    if (argc != NUM_CMDLINE_ARGS) {
+    if ((*tests && argc - optind < NUM_CMDLINE_ARGS) ||
+            (!*tests && argc - optind != NUM_CMDLINE_ARGS)) {
         fprintf(stderr, "Error: Improper number of command line arguments.\n");
         print_usage();
         return -EINVAL;
     }
 
-    // Get the program path from the command line arguments
-    *program_path = argv[1];
+    // Get the program paths from the command line arguments
+    *programs = &argv[optind];
+    *num_programs = argc - optind;
     return 0;
 }
 
@@ -216,6 +499,16 @@ static bool process_long_command(cpu_state_t *cpu_state, const char *command,
         command_restart(cpu_state, args, num_args);
     } else if (strcmp(command, "load") == 0) {
         command_load(cpu_state, args, num_args);
+    } else if (strcmp(command, "checkpoint") == 0) {
+        command_checkpoint(cpu_state, args, num_args);
+    } else if (strcmp(command, "restore") == 0) {
+        command_restore(cpu_state, args, num_args);
+    } else if (strcmp(command, "save") == 0) {
+        command_save(cpu_state, args, num_args);
+    } else if (strcmp(command, "load-snapshot") == 0) {
+        command_load_snapshot(cpu_state, args, num_args);
+    } else if (strcmp(command, "tlb") == 0) {
+        command_tlb(cpu_state, args, num_args);
     } else if (strcmp(command, "verbose") == 0) {
         command_verbose(cpu_state, args, num_args);
     } else if (strcmp(command, "quit") == 0) {
@@ -389,22 +682,67 @@ static void simulator_repl(cpu_state_t *cpu_state)
  * The main method for the simulator.
  *
  * This parses the command line arguments, initializes the CPU and starts up the
- * REPL for the simulator.
+ * REPL for the simulator. In batch mode, the program is run to completion
+ * instead, without setting up readline, and the simulator exits with the
+ * outcome of the run. In test mode, the list of programs is run on the test
+ * runner's workers instead, which set up their own processors. As a fork
+ * server, the program is loaded, then run for each request on stdin.
  **/
 int main(int argc, char *argv[])
 {
-    // Parse the program filename from the command line
-    char *program_path;
-    int rc = parse_arguments(argc, argv, &program_path);
+    /* Parse the program filenames, execution engine, memory mode, stack size,
+     * and batch, test, and fork server options from the command line. */
+    char **programs;
+    int num_programs;
+    sim_engine_t engine = SIM_ENGINE_INTERPRETER;
+    bool flat_memory = false;
+    uint32_t stack_size = STACK_SIZE;
+    batch_options_t batch = { .run = false, .rdump_path = NULL,
+            .max_instrs = 0, .verify_path = NULL, .json_path = NULL, };
+    bool tests = false;
+    int num_workers = 0;
+    bool fork_server = false;
+    int rc = parse_arguments(argc, argv, &programs, &num_programs, &engine,
+            &flat_memory, &stack_size, &batch, &tests, &num_workers,
+            &fork_server);
     if (rc < 0) {
         return -rc;
     }
+    char *program_path = programs[0];
 
-    // Instantiate a CPU state, zero it out, and setup the memory segments
+    /* Instantiate a CPU state, zero it out, and setup the memory segments and
+     * the memory-mapped devices. */
     cpu_state_t cpu_state;
     memset(&cpu_state, 0, sizeof(cpu_state));
-    cpu_state.memory.num_segments = array_len(MEMORY_SEGMENTS);
-    cpu_state.memory.segments = MEMORY_SEGMENTS;
+    cpu_state.engine = engine;
+    cpu_state.interrupt = &SIGINT_RECEIVED;
+    mem_init(&cpu_state);
+
+    // Resize the stack segment, which only needs memory for the pages used
+    rc = mem_set_stack_size(&cpu_state, stack_size);
+    if (rc < 0) {
+        fprintf(stderr, "Error: The stack size must be a multiple of %u bytes "
+                "that leaves room for the user data segment.\n",
+                MEM_PAGE_SIZE);
+        return -rc;
+    }
+
+    // In test mode, run the list of programs on the test runner's workers
+    if (tests) {
+        runner_options_t runner = { .engine = engine,
+                .flat_memory = flat_memory, .stack_size = stack_size,
+                .max_instrs = batch.max_instrs, .num_workers = num_workers, };
+        setup_signals();
+        return run_tests(&runner, programs, num_programs);
+    }
+
+    // Reserve the flat address space, if that memory mode was selected
+    if (flat_memory) {
+        rc = mem_enable_flat(&cpu_state);
+        if (rc < 0) {
+            return -rc;
+        }
+    }
 
     // Initialize the CPU state, and load the program
     rc = init_cpu_state(&cpu_state, program_path);
@@ -414,9 +752,20 @@ int main(int argc, char *argv[])
         return -rc;
     }
 
+    /* As a fork server, serve requests to run the program, which are stopped
+     * when the client closes stdin, rather than by SIGINT. */
+    if (fork_server) {
+        return -run_fork_server(&cpu_state, batch.max_instrs);
+    }
+
     // Setup the signal handling for the program
     setup_signals();
 
+    // In batch mode, run the program without the shell
+    if (batch.run) {
+        return run_batch(&cpu_state, &batch);
+    }
+
     // Setup the readline library
     rc = setup_readline(HISTORY_FILE);
     if (rc < 0) {
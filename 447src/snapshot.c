@@ -0,0 +1,442 @@
+/**
+ * snapshot.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the snapshots of the processor's state.
+ *
+ * A snapshot file holds the following parts in order. All integers are stored
+ * in little-endian order.
+ *
+ *  - Header:   The magic number, the format version, and the number of memory
+ *              segments, as 32-bit integers.
+ *  - Layout:   The base address and the size of each segment.
+ *  - CPU:      The PC, the halt reason, the cycle count as a 64-bit integer,
+ *              and the registers.
+ *  - Memory:   For each segment, the number of its pages in the snapshot,
+ *              followed by each page as its index and its contents. Pages that
+ *              are all zeros are left out. The last page of a segment only
+ *              holds the bytes that lie in the segment.
+ *  - Checksum: The CRC-32 of all of the preceding bytes.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+// Standard Includes
+#include <stdlib.h>                 // Malloc and related functions
+#include <stdio.h>                  // Printf and related functions
+#include <stdint.h>                 // Fixed-size integral types
+#include <stdbool.h>                // Definition of the boolean type
+#include <string.h>                 // Memcmp and strerror functions
+#include <errno.h>                  // Error codes
+
+// 18-447 Simulator Includes
+#include <sim.h>                    // Interface to the core simulator
+#include <memory.h>                 // Memory segments and their pages
+
+// Local Includes
+#include "libc_extensions.h"        // Definition of array_len and min
+#include "memory_segments.h"        // Definition of memory segment constants
+#include "memory_shell.h"           // Interface to the processor memory
+#include "stream.h"                 // Little-endian binary streams
+#include "snapshot.h"               // This file's interface
+
+/*----------------------------------------------------------------------------
+ * Internal Definitions
+ *----------------------------------------------------------------------------*/
+
+// The magic number that starts a snapshot file
+static const uint32_t SNAPSHOT_MAGIC            = 0x4e533734;   // "47SN"
+
+// The version of the snapshot file format
+static const uint32_t SNAPSHOT_VERSION          = 2;
+
+// A page of zeros, which pages are compared against to leave them out
+static const uint8_t ZERO_PAGE[MEM_PAGE_SIZE];
+
+/**
+ * Gets the number of bytes of the given page of the segment that lie in it.
+ **/
+static uint32_t segment_page_size(const mem_segment_t *segment, uint32_t page)
+{
+    return min(MEM_PAGE_SIZE, segment->size - page * MEM_PAGE_SIZE);
+}
+
+/*----------------------------------------------------------------------------
+ * Saving Snapshots
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Indicates if the given page of the segment is saved in the snapshot, which
+ * is the case if it holds any non-zero byte.
+ **/
+static bool page_saved(const mem_segment_t *segment, uint32_t page)
+{
+    return memcmp(&segment->mem[page * MEM_PAGE_SIZE], ZERO_PAGE,
+            segment_page_size(segment, page)) != 0;
+}
+
+/**
+ * Writes the saved pages of the segment to the stream. Returns false on
+ * failure.
+ **/
+static bool write_segment(stream_t *stream, const mem_segment_t *segment)
+{
+    // Count the saved pages first, so that the file can be read as a stream
+    uint32_t num_pages = (segment->size + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE;
+    uint32_t num_saved = 0;
+    for (uint32_t page = 0; page < num_pages; page++)
+    {
+        num_saved += page_saved(segment, page);
+    }
+
+    if (!stream_write_u32(stream, num_saved)) {
+        return false;
+    }
+
+    for (uint32_t page = 0; page < num_pages; page++)
+    {
+        if (!page_saved(segment, page)) {
+            continue;
+        } else if (!stream_write_u32(stream, page) ||
+                !stream_write(stream, &segment->mem[page * MEM_PAGE_SIZE],
+                    segment_page_size(segment, page))) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/**
+ * Writes the whole snapshot of the processor's state to the stream. Returns
+ * false on failure.
+ **/
+static bool write_snapshot(stream_t *stream, const cpu_state_t *cpu_state)
+{
+    const memory_t *memory = &cpu_state->memory;
+    if (!stream_write_u32(stream, SNAPSHOT_MAGIC) ||
+            !stream_write_u32(stream, SNAPSHOT_VERSION) ||
+            !stream_write_u32(stream, memory->num_segments)) {
+        return false;
+    }
+
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        const mem_segment_t *segment = &memory->segments[i];
+        if (!stream_write_u32(stream, segment->base_addr) ||
+                !stream_write_u32(stream, segment->size)) {
+            return false;
+        }
+    }
+
+    if (!stream_write_u32(stream, cpu_state->pc) ||
+            !stream_write_u32(stream, cpu_state->halt_reason) ||
+            !stream_write_u64(stream, cpu_state->cycle)) {
+        return false;
+    }
+
+    for (int i = 0; i < (int)array_len(cpu_state->registers); i++)
+    {
+        if (!stream_write_u32(stream, cpu_state->registers[i])) {
+            return false;
+        }
+    }
+
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        if (!write_segment(stream, &memory->segments[i])) {
+            return false;
+        }
+    }
+
+    // The checksum itself is not part of the checksum
+    return stream_write_u32(stream, stream->checksum);
+}
+
+/**
+ * Saves a snapshot of the processor's whole state to the given file, replacing
+ * it. Returns a negative error code on failure.
+ **/
+int snapshot_save(const cpu_state_t *cpu_state, const char *path)
+{
+    if (!cpu_state->memory.loaded) {
+        fprintf(stderr, "Error: save: No program is loaded.\n");
+        return -ENOENT;
+    }
+
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        int rc = -errno;
+        fprintf(stderr, "Error: save: %s: Unable to open file: %s.\n", path,
+                strerror(errno));
+        return rc;
+    }
+
+    stream_t stream;
+    stream_init(&stream, file);
+    bool written = write_snapshot(&stream, cpu_state);
+    if (fclose(file) != 0 || !written) {
+        int rc = -errno;
+        fprintf(stderr, "Error: save: %s: Unable to write file: %s.\n", path,
+                strerror(errno));
+        return rc;
+    }
+
+    return 0;
+}
+
+/*----------------------------------------------------------------------------
+ * Loading Snapshots
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Checks the checksum of the whole snapshot file, and then rewinds it, so that
+ * a corrupted snapshot is found before any of the processor's state is
+ * changed. Returns a negative error code on failure.
+ **/
+static int verify_checksum(FILE *file, const char *path)
+{
+    // Find the size of the file, without its checksum
+    long size;
+    if (fseek(file, 0, SEEK_END) != 0 || (size = ftell(file)) < 0 ||
+            fseek(file, 0, SEEK_SET) != 0) {
+        int rc = -errno;
+        fprintf(stderr, "Error: load-snapshot: %s: Unable to read file: %s.\n",
+                path, strerror(errno));
+        return rc;
+    } else if (size < (long)sizeof(uint32_t)) {
+        return -EIO;
+    }
+
+    stream_t stream;
+    stream_init(&stream, file);
+    uint8_t chunk[MEM_PAGE_SIZE];
+    long left = size - (long)sizeof(uint32_t);
+    while (left > 0)
+    {
+        long chunk_size = min(left, (long)sizeof(chunk));
+        if (!stream_read(&stream, chunk, chunk_size)) {
+            return -EIO;
+        }
+        left -= chunk_size;
+    }
+
+    uint32_t checksum = stream.checksum;
+    uint32_t saved_checksum;
+    if (!stream_read_u32(&stream, &saved_checksum)) {
+        return -EIO;
+    } else if (saved_checksum != checksum) {
+        fprintf(stderr, "Error: load-snapshot: %s: The snapshot is corrupted "
+                "(checksum 0x%08x, expected 0x%08x).\n", path, checksum,
+                saved_checksum);
+        return -EINVAL;
+    }
+
+    rewind(file);
+    return 0;
+}
+
+/**
+ * Reads the layout of the memory segments from the stream into the sizes, and
+ * checks that it fits the processor's segments. Returns a negative error code
+ * on failure.
+ **/
+static int read_layout(stream_t *stream, const memory_t *memory,
+        uint32_t *sizes, const char *path)
+{
+    uint32_t magic, version, num_segments;
+    if (!stream_read_u32(stream, &magic) ||
+            !stream_read_u32(stream, &version) ||
+            !stream_read_u32(stream, &num_segments) ||
+            magic != SNAPSHOT_MAGIC) {
+        fprintf(stderr, "Error: load-snapshot: %s: Not a snapshot file.\n",
+                path);
+        return -EINVAL;
+    } else if (version != SNAPSHOT_VERSION) {
+        fprintf(stderr, "Error: load-snapshot: %s: Unsupported snapshot "
+                "version %u.\n", path, version);
+        return -EINVAL;
+    } else if (num_segments != (uint32_t)memory->num_segments) {
+        fprintf(stderr, "Error: load-snapshot: %s: The memory segments do not "
+                "match the simulator's.\n", path);
+        return -EINVAL;
+    }
+
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        const mem_segment_t *segment = &memory->segments[i];
+        uint32_t base_addr;
+        if (!stream_read_u32(stream, &base_addr) ||
+                !stream_read_u32(stream, &sizes[i])) {
+            return -EIO;
+        } else if (base_addr != segment->base_addr ||
+                sizes[i] > segment->max_size || sizes[i] % 4 != 0) {
+            fprintf(stderr, "Error: load-snapshot: %s: The %s segment does not "
+                    "fit the simulator's.\n", path, segment->name);
+            return -EINVAL;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the saved pages of the segment from the stream, and copies them into
+ * the segment. Returns a negative error code on failure.
+ **/
+static int read_segment(stream_t *stream, mem_segment_t *segment,
+        const char *path)
+{
+    uint32_t num_saved;
+    if (!stream_read_u32(stream, &num_saved)) {
+        return -EIO;
+    }
+
+    uint32_t num_pages = (segment->size + MEM_PAGE_SIZE - 1) / MEM_PAGE_SIZE;
+    uint8_t page_data[MEM_PAGE_SIZE];
+    for (uint32_t i = 0; i < num_saved; i++)
+    {
+        uint32_t page;
+        if (!stream_read_u32(stream, &page)) {
+            return -EIO;
+        } else if (page >= num_pages) {
+            fprintf(stderr, "Error: load-snapshot: %s: Page %u is outside of "
+                    "the %s segment.\n", path, page, segment->name);
+            return -EINVAL;
+        }
+
+        uint32_t page_size = segment_page_size(segment, page);
+        if (!stream_read(stream, page_data, page_size)) {
+            return -EIO;
+        }
+        mem_write_segment(segment, page * MEM_PAGE_SIZE, page_data, page_size);
+    }
+
+    return 0;
+}
+
+/**
+ * Reads the memory and the checksum of the snapshot from the stream, copying
+ * the pages into the processor's memory. Returns a negative error code on
+ * failure.
+ **/
+static int read_memory(stream_t *stream, cpu_state_t *cpu_state,
+        const char *path)
+{
+    memory_t *memory = &cpu_state->memory;
+    for (int i = 0; i < memory->num_segments; i++)
+    {
+        int rc = read_segment(stream, &memory->segments[i], path);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+
+    uint32_t checksum = stream->checksum;
+    uint32_t saved_checksum;
+    if (!stream_read_u32(stream, &saved_checksum)) {
+        return -EIO;
+    } else if (saved_checksum != checksum) {
+        fprintf(stderr, "Error: load-snapshot: %s: The snapshot is corrupted "
+                "(checksum 0x%08x, expected 0x%08x).\n", path, checksum,
+                saved_checksum);
+        return -EINVAL;
+    }
+
+    return 0;
+}
+
+/**
+ * Loads the processor's state from the snapshot in the given file.
+ *
+ * The memory is replaced by the snapshot's segments, so afterwards, restarting
+ * reloads the program from its files. The checksum is verified before anything
+ * else is read, so if the snapshot is corrupted or invalid, then the processor
+ * is left unchanged, unless the error is only found once its memory is
+ * replaced, such as a page outside of its segment, in which case the processor
+ * is halted. Returns a negative error code on failure.
+ **/
+int snapshot_load(cpu_state_t *cpu_state, const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        int rc = -errno;
+        fprintf(stderr, "Error: load-snapshot: %s: Unable to open file: %s.\n",
+                path, strerror(errno));
+        return rc;
+    }
+
+    // Read the layout and the CPU state, before any of the state is changed
+    memory_t *memory = &cpu_state->memory;
+    uint32_t *sizes = malloc(memory->num_segments * sizeof(sizes[0]));
+    if (sizes == NULL) {
+        fprintf(stderr, "Error: Unable to allocate the snapshot segment "
+                "sizes.\n");
+        exit(ENOMEM);
+    }
+
+    stream_t stream;
+    stream_init(&stream, file);
+    uint32_t pc, halt_reason, registers[array_len(cpu_state->registers)];
+    uint64_t cycle;
+    int rc = verify_checksum(file, path);
+    if (rc == 0) {
+        rc = read_layout(&stream, memory, sizes, path);
+    }
+    if (rc == 0 && (!stream_read_u32(&stream, &pc) ||
+                !stream_read_u32(&stream, &halt_reason) ||
+                !stream_read_u64(&stream, &cycle))) {
+        rc = -EIO;
+    } else if (rc == 0 && halt_reason > SIM_HALT_STOPPED) {
+        fprintf(stderr, "Error: load-snapshot: %s: The snapshot has an "
+                "invalid halt reason %u.\n", path, halt_reason);
+        rc = -EINVAL;
+    }
+    for (int i = 0; rc == 0 && i < (int)array_len(registers); i++)
+    {
+        rc = stream_read_u32(&stream, &registers[i]) ? 0 : -EIO;
+    }
+
+    // Replace the memory, and copy the saved pages into it
+    bool replaced = (rc == 0);
+    if (replaced) {
+        mem_load_image(cpu_state, sizes);
+        rc = read_memory(&stream, cpu_state, path);
+    }
+    free(sizes);
+    fclose(file);
+
+    if (rc == -EIO) {
+        fprintf(stderr, "Error: load-snapshot: %s: The snapshot file is "
+                "truncated.\n", path);
+    }
+
+    // Predecode the user text segment, now that its contents are copied in
+    const mem_segment_t *text = mem_find_segment(cpu_state, USER_TEXT_START);
+    if (replaced && text != NULL) {
+        decode_cache_build(cpu_state, text);
+    }
+
+    // If the memory was replaced, it is incomplete, so the processor is halted
+    if (rc < 0 && replaced) {
+        cpu_state->halted = true;
+        cpu_state->halt_reason = SIM_HALT_STOPPED;
+        return rc;
+    } else if (rc < 0) {
+        return rc;
+    }
+
+    cpu_state->pc = pc;
+    cpu_state->halted = (halt_reason != SIM_HALT_NONE);
+    cpu_state->halt_reason = halt_reason;
+    cpu_state->cycle = cycle;
+    memcpy(cpu_state->registers, registers, sizeof(cpu_state->registers));
+    return 0;
+}
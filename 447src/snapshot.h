@@ -0,0 +1,51 @@
+/**
+ * snapshot.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the snapshots of the processor's state.
+ *
+ * Unlike a checkpoint, a snapshot is a single self-contained image of the CPU
+ * state and the size and contents of every memory segment, so it can be loaded
+ * without the program that it was saved from. Snapshots are written and read
+ * as a stream, and end with a checksum, so that they can be shared between
+ * hosts.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+#ifndef SNAPSHOT_H_
+#define SNAPSHOT_H_
+
+// 18-447 Simulator Includes
+#include <sim.h>                // Definition of cpu_state_t
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Saves a snapshot of the processor's whole state to the given file, replacing
+ * it. Returns a negative error code on failure.
+ **/
+int snapshot_save(const cpu_state_t *cpu_state, const char *path);
+
+/**
+ * Loads the processor's state from the snapshot in the given file.
+ *
+ * The memory is replaced by the snapshot's segments, so afterwards, restarting
+ * reloads the program from its files. The checksum is verified before anything
+ * else is read, so if the snapshot is corrupted or invalid, then the processor
+ * is left unchanged, unless the error is only found once its memory is
+ * replaced, such as a page outside of its segment, in which case the processor
+ * is halted. Returns a negative error code on failure.
+ **/
+int snapshot_load(cpu_state_t *cpu_state, const char *path);
+
+#endif /* SNAPSHOT_H_ */
@@ -0,0 +1,169 @@
+/**
+ * stream.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the binary streams that the processor's state is saved to
+ * and restored from.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+// Standard Includes
+#include <stdio.h>                  // Reading and writing files
+#include <stdint.h>                 // Fixed-size integral types
+#include <stdbool.h>                // Definition of the boolean type
+#include <stddef.h>                 // Definition of size_t
+#include <pthread.h>                // One-time setup of the CRC table
+
+// Local Includes
+#include "libc_extensions.h"        // Byte manipulation functions
+#include "stream.h"                 // This file's interface
+
+/*----------------------------------------------------------------------------
+ * Checksum
+ *----------------------------------------------------------------------------*/
+
+// The reversed polynomial of the CRC-32 used by zlib, PNG, and Ethernet
+static const uint32_t CRC32_POLYNOMIAL  = 0xedb88320;
+
+// The CRC of each byte, which is computed once, by the first stream to need it
+static uint32_t crc_table[256];
+static pthread_once_t crc_table_once = PTHREAD_ONCE_INIT;
+
+/**
+ * Computes the table of the CRCs of each byte.
+ **/
+static void crc32_init_table()
+{
+    for (uint32_t i = 0; i < array_len(crc_table); i++)
+    {
+        uint32_t value = i;
+        for (int bit = 0; bit < 8; bit++)
+        {
+            value = (value >> 1) ^ ((value & 1) ? CRC32_POLYNOMIAL : 0);
+        }
+        crc_table[i] = value;
+    }
+    return;
+}
+
+/**
+ * Adds the data to the given CRC-32, and returns the updated CRC. The table of
+ * the CRCs of each byte is computed on the first call, even if several threads
+ * make their first call at once.
+ **/
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data, size_t size)
+{
+    pthread_once(&crc_table_once, crc32_init_table);
+
+    crc = ~crc;
+    for (size_t i = 0; i < size; i++)
+    {
+        crc = (crc >> 8) ^ crc_table[(crc ^ data[i]) & 0xFF];
+    }
+    return ~crc;
+}
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Initializes the stream over the given file, with an empty checksum.
+ **/
+void stream_init(stream_t *stream, FILE *file)
+{
+    stream->file = file;
+    stream->checksum = 0;
+    return;
+}
+
+/**
+ * Writes the data to the stream, and adds it to the checksum. Returns false on
+ * failure.
+ **/
+bool stream_write(stream_t *stream, const void *data, size_t size)
+{
+    stream->checksum = crc32_update(stream->checksum, data, size);
+    return fwrite(data, size, 1, stream->file) == 1;
+}
+
+/**
+ * Reads the data from the stream, and adds it to the checksum. Returns false on
+ * failure, including if the stream ends first.
+ **/
+bool stream_read(stream_t *stream, void *data, size_t size)
+{
+    if (fread(data, size, 1, stream->file) != 1) {
+        return false;
+    }
+
+    stream->checksum = crc32_update(stream->checksum, data, size);
+    return true;
+}
+
+/**
+ * Writes the 32-bit value to the stream in little-endian order. Returns false
+ * on failure.
+ **/
+bool stream_write_u32(stream_t *stream, uint32_t value)
+{
+    uint8_t bytes[sizeof(value)];
+    for (int i = 0; i < (int)sizeof(value); i++)
+    {
+        bytes[i] = get_byte(value, i);
+    }
+
+    return stream_write(stream, bytes, sizeof(bytes));
+}
+
+/**
+ * Reads a 32-bit value in little-endian order from the stream. Returns false on
+ * failure.
+ **/
+bool stream_read_u32(stream_t *stream, uint32_t *value)
+{
+    uint8_t bytes[sizeof(*value)];
+    if (!stream_read(stream, bytes, sizeof(bytes))) {
+        return false;
+    }
+
+    *value = 0;
+    for (int i = 0; i < (int)sizeof(*value); i++)
+    {
+        *value |= set_byte(bytes[i], i);
+    }
+    return true;
+}
+
+/**
+ * Writes the 64-bit value to the stream in little-endian order. Returns false
+ * on failure.
+ **/
+bool stream_write_u64(stream_t *stream, uint64_t value)
+{
+    return stream_write_u32(stream, value) &&
+            stream_write_u32(stream, value >> 32);
+}
+
+/**
+ * Reads a 64-bit value in little-endian order from the stream. Returns false on
+ * failure.
+ **/
+bool stream_read_u64(stream_t *stream, uint64_t *value)
+{
+    uint32_t low, high;
+    if (!stream_read_u32(stream, &low) || !stream_read_u32(stream, &high)) {
+        return false;
+    }
+
+    *value = ((uint64_t)high << 32) | low;
+    return true;
+}
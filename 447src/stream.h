@@ -0,0 +1,87 @@
+/**
+ * stream.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the binary streams that the processor's
+ * state is saved to and restored from.
+ *
+ * A stream reads or writes a file sequentially, so that it can also be a pipe,
+ * and keeps a running CRC-32 of the bytes that pass through it. Integers are
+ * always stored in little-endian order, so that files can be shared between
+ * hosts.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+#ifndef STREAM_H_
+#define STREAM_H_
+
+// Standard Includes
+#include <stdio.h>              // Definition of the FILE type
+#include <stdint.h>             // Fixed-size integral types
+#include <stdbool.h>            // Definition of the boolean type
+#include <stddef.h>             // Definition of size_t
+
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+// A binary stream over a file
+typedef struct stream {
+    FILE *file;                 // File that is read or written
+    uint32_t checksum;          // CRC-32 of the bytes so far
+} stream_t;
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Initializes the stream over the given file, with an empty checksum.
+ **/
+void stream_init(stream_t *stream, FILE *file);
+
+/**
+ * Writes the data to the stream, and adds it to the checksum. Returns false on
+ * failure.
+ **/
+bool stream_write(stream_t *stream, const void *data, size_t size);
+
+/**
+ * Reads the data from the stream, and adds it to the checksum. Returns false on
+ * failure, including if the stream ends first.
+ **/
+bool stream_read(stream_t *stream, void *data, size_t size);
+
+/**
+ * Writes the 32-bit value to the stream in little-endian order. Returns false
+ * on failure.
+ **/
+bool stream_write_u32(stream_t *stream, uint32_t value);
+
+/**
+ * Reads a 32-bit value in little-endian order from the stream. Returns false on
+ * failure.
+ **/
+bool stream_read_u32(stream_t *stream, uint32_t *value);
+
+/**
+ * Writes the 64-bit value to the stream in little-endian order. Returns false
+ * on failure.
+ **/
+bool stream_write_u64(stream_t *stream, uint64_t value);
+
+/**
+ * Reads a 64-bit value in little-endian order from the stream. Returns false on
+ * failure.
+ **/
+bool stream_read_u64(stream_t *stream, uint64_t *value);
+
+#endif /* STREAM_H_ */
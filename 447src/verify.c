@@ -0,0 +1,200 @@
+/**
+ * verify.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the verification of the processor's final state against a
+ * reference register dump.
+ *
+ * The result is written as a single JSON object, with the following fields:
+ *  - program:      The program that was run, without its extension.
+ *  - reference:    The path to the reference register dump.
+ *  - outcome:      How the run ended (halted, faulted, limit, or interrupted).
+ *  - instructions: The number of instructions that the program retired.
+ *  - passed:       Whether the run completed, and every register matches the
+ *                  reference.
+ *  - mismatches:   For each register that does not match, its ISA and ABI
+ *                  names, and its expected and actual values, as hex strings.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+// Standard Includes
+#include <stdlib.h>                 // Free function
+#include <stdio.h>                  // Printf and related functions
+#include <stdint.h>                 // Fixed-size integral types
+#include <stdbool.h>                // Definition of the boolean type
+#include <string.h>                 // Memset and strerror functions
+#include <errno.h>                  // Error codes
+#include <inttypes.h>               // Format specifiers for fixed-size types
+
+// 18-447 Simulator Includes
+#include <sim.h>                    // Definition of cpu_state_t
+#include <register_file.h>          // Interface to the register file
+
+// Local Includes
+#include "riscv_register_names.h"   // Names for the RISC-V registers
+#include "verify.h"                 // This file's interface
+
+/*----------------------------------------------------------------------------
+ * Reference Parsing
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Parses a line of a register dump that holds a register's value, which starts
+ * with the register's ISA name, its ABI name in parentheses, and then its hex
+ * value after an equals sign. Returns false if the line is not a register.
+ **/
+static bool parse_register_line(const char *line, unsigned int *reg_num,
+        uint32_t *value)
+{
+    return sscanf(line, " x%u (%*[^)]) = 0x%" SCNx32, reg_num, value) == 2 &&
+            *reg_num < RISCV_NUM_REGS;
+}
+
+/**
+ * Reads the reference register dump in the given file, which must have a
+ * value for every register. Lines that do not hold a register's value, such
+ * as the header, are skipped. Returns a negative error code on failure.
+ **/
+int verify_load_reference(verify_reference_t *reference, const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == NULL) {
+        int rc = -errno;
+        fprintf(stderr, "Error: %s: Unable to open reference register dump: "
+                "%s.\n", path, strerror(errno));
+        return rc;
+    }
+
+    // Record the value of each register line, and which registers were seen
+    bool found[RISCV_NUM_REGS];
+    memset(found, 0, sizeof(found));
+    memset(reference->registers, 0, sizeof(reference->registers));
+    reference->path = path;
+
+    int rc = 0;
+    char *line = NULL;
+    size_t line_size = 0;
+    while (rc == 0 && getline(&line, &line_size, file) >= 0)
+    {
+        unsigned int reg_num;
+        uint32_t value;
+        if (!parse_register_line(line, &reg_num, &value)) {
+            continue;
+        } else if (found[reg_num]) {
+            fprintf(stderr, "Error: %s: Register x%u appears more than once in "
+                    "the reference register dump.\n", path, reg_num);
+            rc = -EINVAL;
+        }
+
+        found[reg_num] = true;
+        reference->registers[reg_num] = value;
+    }
+    if (rc == 0 && ferror(file)) {
+        fprintf(stderr, "Error: %s: Unable to read reference register dump.\n",
+                path);
+        rc = -EIO;
+    }
+    free(line);
+    fclose(file);
+
+    // Every register must have a reference value
+    for (int i = 0; rc == 0 && i < RISCV_NUM_REGS; i++)
+    {
+        if (!found[i]) {
+            fprintf(stderr, "Error: %s: Register x%d is missing from the "
+                    "reference register dump.\n", path, i);
+            rc = -EINVAL;
+        }
+    }
+    return rc;
+}
+
+/*----------------------------------------------------------------------------
+ * Verification
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Writes the string to the file as a JSON string, escaping the quotes,
+ * backslashes, and control characters in it.
+ **/
+static void write_json_string(FILE *file, const char *string)
+{
+    fputc('"', file);
+    for (const char *c = string; *c != '\0'; c++)
+    {
+        if (*c == '"' || *c == '\\') {
+            fprintf(file, "\\%c", *c);
+        } else if ((unsigned char)*c < ' ') {
+            fprintf(file, "\\u%04x", (unsigned char)*c);
+        } else {
+            fputc(*c, file);
+        }
+    }
+    fputc('"', file);
+    return;
+}
+
+/**
+ * Compares the processor's registers against the reference, printing each
+ * mismatch to stderr. The result is written as JSON to the given file, if it
+ * is not NULL, along with the outcome of the run that is being checked. The
+ * run only passes if it completed, by halting or stopping on an error like the
+ * reference may have, rather than being cut short.
+ *
+ * Returns the number of registers that do not match. Errors writing the result
+ * are left on the file for the caller to check.
+ **/
+int verify_registers(const cpu_state_t *cpu_state,
+        const verify_reference_t *reference, const char *outcome,
+        bool completed, FILE *json_file)
+{
+    // Find the registers that do not match, and tell the user about each one
+    int num_mismatches = 0;
+    riscv_isa_reg_t mismatches[RISCV_NUM_REGS];
+    for (int i = 0; i < RISCV_NUM_REGS; i++)
+    {
+        uint32_t value = register_read(cpu_state, i);
+        if (value != reference->registers[i]) {
+            fprintf(stderr, "Error: %s: Register %s (%s) is 0x%08" PRIx32 ", "
+                    "but the reference is 0x%08" PRIx32 ".\n", reference->path,
+                    RISCV_REGISTER_NAMES[i].isa_name,
+                    RISCV_REGISTER_NAMES[i].abi_name, value,
+                    reference->registers[i]);
+            mismatches[num_mismatches] = i;
+            num_mismatches += 1;
+        }
+    }
+
+    if (json_file == NULL) {
+        return num_mismatches;
+    }
+
+    // Write out the result, with the registers that did not match
+    fprintf(json_file, "{\"program\": ");
+    write_json_string(json_file, cpu_state->program);
+    fprintf(json_file, ", \"reference\": ");
+    write_json_string(json_file, reference->path);
+    fprintf(json_file, ", \"outcome\": \"%s\", \"instructions\": %" PRIu64 ", "
+            "\"passed\": %s, \"mismatches\": [", outcome, cpu_state->cycle,
+            (completed && num_mismatches == 0) ? "true" : "false");
+    for (int i = 0; i < num_mismatches; i++)
+    {
+        riscv_isa_reg_t reg = mismatches[i];
+        fprintf(json_file, "%s{\"register\": \"%s\", \"abi_name\": \"%s\", "
+                "\"expected\": \"0x%08" PRIx32 "\", \"actual\": \"0x%08" PRIx32
+                "\"}", (i == 0) ? "" : ", ", RISCV_REGISTER_NAMES[reg].isa_name,
+                RISCV_REGISTER_NAMES[reg].abi_name, reference->registers[reg],
+                register_read(cpu_state, reg));
+    }
+    fprintf(json_file, "]}\n");
+
+    return num_mismatches;
+}
@@ -0,0 +1,70 @@
+/**
+ * verify.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the verification of the processor's
+ * final state against a reference register dump.
+ *
+ * The reference is a register dump in the format written by the rdump command,
+ * so the simulator can check its own registers directly, instead of writing
+ * its dump and comparing the text with another program. The result of the
+ * check is written as a single line of JSON, so that the results for many
+ * programs can be collected by scripts.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+#ifndef VERIFY_H_
+#define VERIFY_H_
+
+// Standard Includes
+#include <stdio.h>              // Definition of FILE
+#include <stdint.h>             // Fixed-size integral types
+#include <stdbool.h>            // Definition of the boolean type
+
+// 18-447 Simulator Includes
+#include <sim.h>                // Definition of cpu_state_t
+
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+// The register values that a program's final state is checked against
+typedef struct verify_reference {
+    const char *path;                       // Path to the reference dump
+    uint32_t registers[RISCV_NUM_REGS];     // Expected value of each register
+} verify_reference_t;
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Reads the reference register dump in the given file, which must have a
+ * value for every register. Lines that do not hold a register's value, such
+ * as the header, are skipped. Returns a negative error code on failure.
+ **/
+int verify_load_reference(verify_reference_t *reference, const char *path);
+
+/**
+ * Compares the processor's registers against the reference, printing each
+ * mismatch to stderr. The result is written as JSON to the given file, if it
+ * is not NULL, along with the outcome of the run that is being checked. The
+ * run only passes if it completed, by halting or stopping on an error like the
+ * reference may have, rather than being cut short.
+ *
+ * Returns the number of registers that do not match. Errors writing the result
+ * are left on the file for the caller to check.
+ **/
+int verify_registers(const cpu_state_t *cpu_state,
+        const verify_reference_t *reference, const char *outcome,
+        bool completed, FILE *json_file);
+
+#endif /* VERIFY_H_ */
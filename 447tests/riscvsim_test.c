@@ -0,0 +1,195 @@
+/**
+ * riscvsim_test.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains a program that tests the simulator library, libriscvsim,
+ * by using it the way that other programs do.
+ *
+ * The given program is run on each engine by two instances at once, one in the
+ * paged memory mode and one in the flat memory mode, which take turns running
+ * a single instruction. Any state that the instances shared would make their
+ * runs diverge, so every run must halt with the same state. Afterwards, the
+ * registers are written to the given file in hex, one per line, so that they
+ * can be compared against the program's reference register dump. They are not
+ * printed, since the program's own output goes to stdout.
+ **/
+
+/*----------------------------------------------------------------------------*
+ *                          DO NOT MODIFY THIS FILE!                          *
+ *          You should only add or change files in the src directory!         *
+ *----------------------------------------------------------------------------*/
+
+// Standard Includes
+#include <stdlib.h>                 // Exit statuses
+#include <stdio.h>                  // Printf and related functions
+#include <stdint.h>                 // Fixed-size integral types
+#include <string.h>                 // Memset, memcmp, and strerror functions
+#include <errno.h>                  // Error codes
+#include <inttypes.h>               // Format specifiers for fixed-size types
+
+// 18-447 Simulator Includes
+#include <riscvsim.h>               // Interface to the simulator library
+
+/*----------------------------------------------------------------------------
+ * Internal Definitions
+ *----------------------------------------------------------------------------*/
+
+// The maximum number of turns that the instances take, in case a run hangs
+#define MAX_TURNS               1000000
+
+// The number of instances that run the program at once, one per memory mode
+#define NUM_INSTANCES           2
+
+// The names of the engines, which are tested in order
+static const char *const ENGINE_NAMES[] = {
+    [SIM_ENGINE_INTERPRETER]    = "interpreter",
+    [SIM_ENGINE_THREADED]       = "threaded",
+    [SIM_ENGINE_BLOCK]          = "block",
+    [SIM_ENGINE_JIT]            = "jit",
+    [SIM_ENGINE_AOT]            = "aot",
+};
+
+// The names of the memory modes, indexed by the instance
+static const char *const MEMORY_MODE_NAMES[NUM_INSTANCES] = { "paged", "flat" };
+
+// The state of an instance after its run
+typedef struct run_state {
+    uint64_t instructions;                  // Number of instructions retired
+    uint32_t pc;                            // Final program counter
+    uint32_t registers[RISCV_NUM_REGS];     // Final value of each register
+} run_state_t;
+
+/*----------------------------------------------------------------------------
+ * Helper Functions
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Reads the state of the instance after its run, checking that a register past
+ * the last one is rejected. Returns a negative error code on failure.
+ **/
+static int read_state(const riscvsim_t *sim, run_state_t *state)
+{
+    // Clear the padding, so that states can be compared with memcmp
+    memset(state, 0, sizeof(*state));
+    state->instructions = riscvsim_instructions(sim);
+    state->pc = riscvsim_read_pc(sim);
+    for (unsigned int reg = 0; reg < RISCV_NUM_REGS; reg++)
+    {
+        int rc = riscvsim_read_register(sim, reg, &state->registers[reg]);
+        if (rc < 0) {
+            return rc;
+        }
+    }
+
+    uint32_t value;
+    if (riscvsim_read_register(sim, RISCV_NUM_REGS, &value) != -EINVAL) {
+        fprintf(stderr, "Error: Register x%d was not rejected.\n",
+                RISCV_NUM_REGS);
+        return -EINVAL;
+    }
+    return 0;
+}
+
+/**
+ * Runs the program on the engine with an instance in each memory mode, which
+ * take turns running a single instruction until both have stopped, and reads
+ * the state of each. Returns a negative error code on failure.
+ **/
+static int run_engine(sim_engine_t engine, const char *program,
+        run_state_t states[NUM_INSTANCES])
+{
+    riscvsim_t *sims[NUM_INSTANCES] = { NULL };
+    int rc = 0;
+    for (int i = 0; rc == 0 && i < NUM_INSTANCES; i++)
+    {
+        riscvsim_options_t options = { .engine = engine,
+                .flat_memory = (i == 1), .stack_size = 0, };
+        sims[i] = riscvsim_create(&options);
+        rc = (sims[i] == NULL) ? -ENOMEM : riscvsim_load(sims[i], program);
+    }
+
+    // Take turns until both instances have stopped
+    int status[NUM_INSTANCES] = { RISCVSIM_LIMIT, RISCVSIM_LIMIT };
+    for (int turn = 0; rc == 0 && turn < MAX_TURNS &&
+            (status[0] == RISCVSIM_LIMIT || status[1] == RISCVSIM_LIMIT);
+            turn++)
+    {
+        for (int i = 0; i < NUM_INSTANCES; i++)
+        {
+            if (status[i] == RISCVSIM_LIMIT) {
+                status[i] = riscvsim_run(sims[i], 1);
+            }
+        }
+    }
+
+    for (int i = 0; rc == 0 && i < NUM_INSTANCES; i++)
+    {
+        if (status[i] != RISCVSIM_HALTED) {
+            fprintf(stderr, "Error: %s engine, %s memory: The program did not "
+                    "halt (status %d).\n", ENGINE_NAMES[engine],
+                    MEMORY_MODE_NAMES[i], status[i]);
+            rc = -EINVAL;
+        } else {
+            rc = read_state(sims[i], &states[i]);
+        }
+    }
+
+    for (int i = 0; i < NUM_INSTANCES; i++)
+    {
+        if (sims[i] != NULL) {
+            riscvsim_destroy(sims[i]);
+        }
+    }
+    return rc;
+}
+
+/*----------------------------------------------------------------------------
+ * Main Function
+ *----------------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+    if (argc != 3) {
+        fprintf(stderr, "Usage: riscvsim_test <program> <registers_file>\n");
+        return EXIT_FAILURE;
+    }
+
+    // Every run must end in the same state as the interpreter's paged run
+    run_state_t expected;
+    for (int engine = 0; engine < (int)(sizeof(ENGINE_NAMES) /
+            sizeof(ENGINE_NAMES[0])); engine++)
+    {
+        run_state_t states[NUM_INSTANCES];
+        if (run_engine(engine, argv[1], states) < 0) {
+            return EXIT_FAILURE;
+        } else if (engine == SIM_ENGINE_INTERPRETER) {
+            expected = states[0];
+        }
+
+        for (int i = 0; i < NUM_INSTANCES; i++)
+        {
+            if (memcmp(&states[i], &expected, sizeof(expected)) != 0) {
+                fprintf(stderr, "Error: %s engine, %s memory: The state does "
+                        "not match the interpreter's.\n", ENGINE_NAMES[engine],
+                        MEMORY_MODE_NAMES[i]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    FILE *file = fopen(argv[2], "w");
+    if (file == NULL) {
+        fprintf(stderr, "Error: %s: Unable to open file: %s.\n", argv[2],
+                strerror(errno));
+        return EXIT_FAILURE;
+    }
+    for (int reg = 0; reg < RISCV_NUM_REGS; reg++)
+    {
+        fprintf(file, "%08" PRIx32 "\n", expected.registers[reg]);
+    }
+    return (fclose(file) == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,689 @@
+/**
+ * aot.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the ahead-of-time translator, which translates a whole
+ * text segment into C, builds it into a shared object with the host compiler,
+ * and runs it with the AOT engine.
+ *
+ * The translated program is a single function, with a label for each basic
+ * block that a direct branch or jump can reach. Guest registers are held in
+ * locals, and direct branches become gotos. Indirect jumps dispatch through a
+ * switch over the block addresses, and a target that is not the start of a
+ * translated block returns to the engine, which runs it in the interpreter.
+ *
+ * Shared objects are cached in AOT_CACHE_DIR, or the directory named by the
+ * RISCV_SIM_AOT_CACHE environment variable, under a hash of the text segment,
+ * so a program is only translated and compiled the first time it is run. The
+ * host compiler is cc, or the one named by the CC environment variable, and
+ * the translation is expected to compile without warnings.
+ **/
+
+// Standard Includes
+#include <stdlib.h>             // Malloc, getenv, and related functions
+#include <stdio.h>              // Printf and related functions
+#include <stdbool.h>            // Boolean type and definitions
+#include <stddef.h>             // Definition of NULL
+#include <stdint.h>             // Fixed-size integral types
+#include <inttypes.h>           // Format specifiers for fixed-size types
+#include <string.h>             // String manipulation functions
+#include <errno.h>              // Error codes and perror
+#include <unistd.h>             // Fork, exec, access, and close
+#include <dlfcn.h>              // Loading shared objects
+#include <sys/stat.h>           // Mkdir
+#include <sys/types.h>          // Process ID type
+#include <sys/wait.h>           // Waiting for the host compiler
+
+// 18-447 Simulator Includes
+#include <riscv_isa.h>          // The number of RISC-V registers
+#include <sim.h>                // Definitions for the simulator
+
+// Local Includes
+#include "decode.h"             // Predecoded instructions and the decoder
+#include "isa_table.h"          // The table of instructions in the ISA
+#include "block.h"              // Operations that end a basic block
+#include "aot.h"                // This file's interface
+
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+/* The version of the translator, which is part of the key for cached shared
+ * objects. This must change whenever the generated code changes. */
+#define AOT_VERSION             "riscv-sim-aot-3"
+
+// The default directory in which translated programs are cached
+#define AOT_CACHE_DIR           ".riscv_sim_aot"
+
+// The maximum length of a path to a file in the cache
+#define AOT_MAX_PATH_LEN        4096
+
+// The name of the function that runs a translated program
+#define AOT_RUN_SYMBOL          "riscv_aot_run"
+
+/* The interface between the simulator and a translated program. The same
+ * definition is written into the generated code, so any change to it must
+ * also change AOT_VERSION. */
+#define AOT_ENV_DEFINITION \
+    "typedef struct aot_env {\n" \
+    "    struct cpu_state *cpu_state;\n" \
+    "    uint32_t *registers;\n" \
+    "    uint32_t *pc;\n" \
+    "    bool *halted;\n" \
+    "    bool *modified;\n" \
+    "    uint32_t (*read32)(struct cpu_state *cpu_state, uint32_t addr);\n" \
+    "    void (*write32)(struct cpu_state *cpu_state, uint32_t addr,\n" \
+    "            uint32_t value);\n" \
+    "    void (*step)(struct cpu_state *cpu_state);\n" \
+    "} aot_env_t;\n"
+
+/* The actions of the computations and branches in the ISA table, which are
+ * written into the generated code as macros, such as RV_ADD(RS1, RS2, IMM,
+ * PC). These are also part of the key for cached shared objects. */
+#define AOT_ACTION_DEFINITIONS \
+    RV32I_ALU_OPS(AOT_ACTION_DEFINITION) \
+    RV32I_BRANCH_OPS(AOT_ACTION_DEFINITION)
+#define AOT_ACTION_DEFINITION(NAME, name, format, opcode, funct3, funct7, \
+        action) \
+    "#define RV_" #NAME "(RS1, RS2, IMM, PC) (" #action ")\n"
+
+// The interface between the simulator and a translated program
+typedef struct aot_env {
+    struct cpu_state *cpu_state;    // The CPU being simulated
+    uint32_t *registers;            // The CPU's register file
+    uint32_t *pc;                   // The CPU's program counter
+    bool *halted;                   // Indicates if the CPU is halted
+    bool *modified;                 // Indicates if the text was written
+    uint32_t (*read32)(struct cpu_state *cpu_state, uint32_t addr);
+    void (*write32)(struct cpu_state *cpu_state, uint32_t addr,
+            uint32_t value);
+    void (*step)(struct cpu_state *cpu_state);  // Interprets the PC's instr
+} aot_env_t;
+
+/* Runs the translated program from the PC for up to budget instructions,
+ * returning the part of the budget that was not used. */
+typedef int (*aot_run_t)(aot_env_t *env, int budget);
+
+// A loaded ahead-of-time translation of a text segment
+typedef struct aot_program {
+    void *handle;               // Handle for the loaded shared object
+    aot_run_t run;              // Entry point, or NULL if translation failed
+} aot_program_t;
+
+/*----------------------------------------------------------------------------
+ * Translation
+ *----------------------------------------------------------------------------*/
+
+// Adds the bytes of a word to a 64-bit FNV-1a hash, in little-endian order
+static uint64_t hash_word(uint64_t hash, uint32_t word)
+{
+    for (int byte = 0; byte < (int)sizeof(word); byte++)
+    {
+        hash = (hash ^ ((word >> (8 * byte)) & 0xFF)) *
+                UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+/**
+ * Computes the 64-bit FNV-1a hash of the translator version and the text
+ * segment, which identifies its shared object in the cache.
+ **/
+static uint64_t hash_text(const decode_cache_t *cache)
+{
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (const char *c = AOT_VERSION AOT_ACTION_DEFINITIONS; *c != '\0'; c++)
+    {
+        hash = (hash ^ (uint8_t)*c) * UINT64_C(0x100000001b3);
+    }
+
+    hash = hash_word(hash, cache->base_addr);
+    for (uint32_t i = 0; i < cache->num_entries; i++)
+    {
+        hash = hash_word(hash, cache->entries[i].instr);
+    }
+    return hash;
+}
+
+// Determines if an operation is a conditional branch or a jal
+static bool direct_op(instr_op_t op)
+{
+    switch (op)
+    {
+        case INSTR_BEQ: case INSTR_BNE: case INSTR_BLT: case INSTR_BGE:
+        case INSTR_BLTU: case INSTR_BGEU: case INSTR_JAL: case INSTR_JUMP:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * Finds the index in the segment of the given address, returning false if it
+ * is misaligned or outside the segment.
+ **/
+static bool text_index(const decode_cache_t *cache, uint32_t addr,
+        uint32_t *index)
+{
+    if (decode_cache_lookup(cache, addr) == NULL) {
+        return false;
+    }
+    *index = (addr - cache->base_addr) / sizeof(uint32_t);
+    return true;
+}
+
+/**
+ * Marks the instructions that start a basic block, which are the first
+ * instruction, the targets of direct branches and jumps, and the instruction
+ * after any operation that ends a block.
+ **/
+static void find_leaders(const decode_cache_t *cache, bool *leaders)
+{
+    for (uint32_t i = 0; i < cache->num_entries; i++)
+    {
+        leaders[i] = (i == 0);
+    }
+
+    for (uint32_t i = 0; i < cache->num_entries; i++)
+    {
+        const decoded_instr_t *instr = &cache->entries[i];
+        uint32_t pc = cache->base_addr + i * sizeof(uint32_t);
+        uint32_t target;
+        if (direct_op(instr->op) &&
+                text_index(cache, pc + (uint32_t)instr->imm, &target)) {
+            leaders[target] = true;
+        }
+        if (block_is_terminator(instr->op) && i + 1 < cache->num_entries) {
+            leaders[i + 1] = true;
+        }
+    }
+    return;
+}
+
+/* Returns the C expression for reading the given guest register. Register x0
+ * is a constant local, rather than a literal, so that the compiler does not
+ * warn about comparisons that are always true or false for it. */
+static const char *reg_name(int reg)
+{
+    static const char *const NAMES[RISCV_NUM_REGS] = {
+        "x0", "x1", "x2", "x3", "x4", "x5", "x6", "x7", "x8", "x9", "x10",
+        "x11", "x12", "x13", "x14", "x15", "x16", "x17", "x18", "x19", "x20",
+        "x21", "x22", "x23", "x24", "x25", "x26", "x27", "x28", "x29", "x30",
+        "x31",
+    };
+    return NAMES[reg];
+}
+
+// Writes a goto to the block at the given address, or a return to the engine
+static void write_jump(FILE *file, const decode_cache_t *cache, uint32_t addr)
+{
+    uint32_t index;
+    if (text_index(cache, addr, &index)) {
+        fprintf(file, "goto L_%08" PRIx32 ";", addr);
+    } else {
+        fprintf(file, "{ pc = 0x%08" PRIx32 "u; goto leave; }", addr);
+    }
+    return;
+}
+
+/**
+ * Writes the C code for the instruction at the given index, given the number
+ * of instructions that remain after it in its block, which are refunded to the
+ * budget if it stops the block early.
+ **/
+static void write_instr(FILE *file, const decode_cache_t *cache,
+        uint32_t index, uint32_t refund)
+{
+    const decoded_instr_t *instr = &cache->entries[index];
+    uint32_t pc = cache->base_addr + index * sizeof(uint32_t);
+    uint32_t imm = (uint32_t)instr->imm;
+    const char *rd = reg_name(instr->rd);
+    const char *rs1 = reg_name(instr->rs1);
+    const char *rs2 = reg_name(instr->rs2);
+    const char *macro = NULL;
+
+    // A write to x0 is discarded, but loads still have to check the address
+    bool writes_x0 = (instr->rd == 0);
+
+    /* Computations and branches use the actions from the ISA table. The decoder
+     * turns computations that write x0 into no-ops. */
+    switch (instr->op)
+    {
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+        case INSTR_##NAME: \
+            macro = "RV_" #NAME; \
+            break;
+        RV32I_ALU_OPS(X)
+        RV32I_BRANCH_OPS(X)
+#undef X
+
+        default:
+            break;
+    }
+    /* The immediate is also passed through a local, since guest code can
+     * compare against an immediate of zero, such as with sltiu. */
+    if (macro != NULL && !block_is_terminator(instr->op)) {
+        fprintf(file, "    imm = 0x%08" PRIx32 "u; %s = %s(%s, %s, imm, 0x%08"
+                PRIx32 "u);\n", imm, rd, macro, rs1, rs2, pc);
+        return;
+    } else if (macro != NULL) {
+        fprintf(file, "    if (%s(%s, %s, 0x%08" PRIx32 "u, 0x%08" PRIx32
+                "u)) ", macro, rs1, rs2, imm, pc);
+        write_jump(file, cache, pc + imm);
+        fprintf(file, "\n    ");
+        write_jump(file, cache, pc + sizeof(uint32_t));
+        fprintf(file, "\n");
+        return;
+    }
+
+    // A faulting load or store halts without advancing the PC
+    const char *halt_check = "    if (*env->halted) { pc = 0x%08" PRIx32 "u; "
+            "budget += %" PRIu32 "; goto leave; }\n";
+    switch (instr->op)
+    {
+        // Operations that the decoder specializes instructions to
+        case INSTR_NOP:
+            break;
+
+        case INSTR_LI:
+            fprintf(file, "    %s = 0x%08" PRIx32 "u;\n", rd, imm);
+            break;
+
+        case INSTR_JUMP:
+            fprintf(file, "    ");
+            write_jump(file, cache, pc + imm);
+            fprintf(file, "\n");
+            break;
+
+        case INSTR_LW:
+            fprintf(file, "    t = env->read32(env->cpu_state, %s + 0x%08"
+                    PRIx32 "u);\n", rs1, imm);
+            fprintf(file, halt_check, pc, refund);
+            if (!writes_x0) {
+                fprintf(file, "    %s = t;\n", rd);
+            }
+            break;
+
+        // The rest of the block is stale if the store wrote to the text
+        case INSTR_SW:
+            fprintf(file, "    env->write32(env->cpu_state, %s + 0x%08" PRIx32
+                    "u, %s);\n", rs1, imm, rs2);
+            fprintf(file, halt_check, pc, refund);
+            fprintf(file, "    if (*env->modified) { pc = 0x%08" PRIx32 "u; "
+                    "budget += %" PRIu32 "; goto leave; }\n",
+                    pc + (uint32_t)sizeof(uint32_t), refund);
+            break;
+
+        case INSTR_JAL:
+            if (!writes_x0) {
+                fprintf(file, "    %s = 0x%08" PRIx32 "u;\n", rd,
+                        pc + (uint32_t)sizeof(uint32_t));
+            }
+            fprintf(file, "    ");
+            write_jump(file, cache, pc + imm);
+            fprintf(file, "\n");
+            break;
+
+        case INSTR_JALR:
+            fprintf(file, "    pc = (%s + 0x%08" PRIx32 "u) & ~1u;\n", rs1,
+                    imm);
+            if (!writes_x0) {
+                fprintf(file, "    %s = 0x%08" PRIx32 "u;\n", rd,
+                        pc + (uint32_t)sizeof(uint32_t));
+            }
+            fprintf(file, "    goto dispatch;\n");
+            break;
+
+        // Everything else runs in the interpreter, which updates the PC
+        default:
+            fprintf(file, "    SYNC_OUT(); *env->pc = 0x%08" PRIx32 "u; "
+                    "env->step(env->cpu_state); SYNC_IN();\n", pc);
+            fprintf(file, "    pc = *env->pc;\n");
+            fprintf(file, "    if (*env->halted || *env->modified) { "
+                    "budget += %" PRIu32 "; goto leave; }\n", refund);
+            if (block_is_terminator(instr->op)) {
+                fprintf(file, "    goto dispatch;\n");
+            }
+            break;
+    }
+    return;
+}
+
+/**
+ * Writes the C translation of the text segment to the given file. Returns a
+ * negative error code on failure.
+ **/
+static int write_program(FILE *file, const decode_cache_t *cache)
+{
+    bool *leaders = malloc(cache->num_entries * sizeof(leaders[0]) + 1);
+    if (leaders == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for the AOT "
+                "translation.\n");
+        exit(ENOMEM);
+    }
+    find_leaders(cache, leaders);
+
+    fprintf(file, "/* Generated by the simulator (%s), do not edit. */\n",
+            AOT_VERSION);
+    fprintf(file, "#include <stdbool.h>\n#include <stdint.h>\n\n");
+    fprintf(file, "struct cpu_state;\n\n%s\n", AOT_ENV_DEFINITION);
+    fprintf(file, "%s\n", AOT_ACTION_DEFINITIONS);
+
+    // Guest registers live in locals, which are synced around interpreter calls
+    fprintf(file, "#define SYNC_IN() do { \\\n");
+    for (int reg = 1; reg < RISCV_NUM_REGS; reg++)
+    {
+        fprintf(file, "    x%d = env->registers[%d]; \\\n", reg, reg);
+    }
+    fprintf(file, "} while (0)\n\n#define SYNC_OUT() do { \\\n");
+    for (int reg = 1; reg < RISCV_NUM_REGS; reg++)
+    {
+        fprintf(file, "    env->registers[%d] = x%d; \\\n", reg, reg);
+    }
+    fprintf(file, "} while (0)\n\n");
+
+    fprintf(file, "int %s(aot_env_t *env, int budget)\n{\n", AOT_RUN_SYMBOL);
+    fprintf(file, "    uint32_t t, imm, pc = *env->pc;\n    uint32_t x1");
+    for (int reg = 2; reg < RISCV_NUM_REGS; reg++)
+    {
+        fprintf(file, ", x%d", reg);
+    }
+    fprintf(file, ";\n    const uint32_t x0 = 0;\n    (void)t;\n"
+            "    (void)imm;\n    (void)x0;\n    SYNC_IN();\n    goto dispatch;\n\n");
+
+    // Each block checks that the budget covers it before running
+    uint32_t block_len = 0;
+    for (uint32_t i = 0; i < cache->num_entries; i++)
+    {
+        uint32_t pc = cache->base_addr + i * sizeof(uint32_t);
+        if (leaders[i]) {
+            block_len = 0;
+            while (i + block_len < cache->num_entries) {
+                block_len += 1;
+                if (block_is_terminator(cache->entries[i + block_len - 1].op) ||
+                        (i + block_len < cache->num_entries &&
+                         leaders[i + block_len])) {
+                    break;
+                }
+            }
+
+            fprintf(file, "L_%08" PRIx32 ":\n", pc);
+            fprintf(file, "    if (budget < %" PRIu32 ") { pc = 0x%08" PRIx32
+                    "u; goto leave; }\n", block_len, pc);
+            fprintf(file, "    budget -= %" PRIu32 ";\n", block_len);
+        }
+
+        block_len -= 1;
+        write_instr(file, cache, i, block_len);
+    }
+
+    // A block without a control transfer at the end of the segment leaves it
+    fprintf(file, "    pc = 0x%08" PRIx32 "u;\n    goto leave;\n\n",
+            cache->base_addr + cache->num_entries *
+            (uint32_t)sizeof(uint32_t));
+
+    // Indirect jumps can only enter the translation at the start of a block
+    fprintf(file, "dispatch:\n    switch (pc)\n    {\n");
+    for (uint32_t i = 0; i < cache->num_entries; i++)
+    {
+        if (leaders[i]) {
+            uint32_t pc = cache->base_addr + i * sizeof(uint32_t);
+            fprintf(file, "        case 0x%08" PRIx32 "u: goto L_%08" PRIx32
+                    ";\n", pc, pc);
+        }
+    }
+    fprintf(file, "        default: goto leave;\n    }\n\n");
+    fprintf(file, "leave:\n    SYNC_OUT();\n    *env->pc = pc;\n"
+            "    return budget;\n}\n");
+
+    free(leaders);
+    return ferror(file) ? -EIO : 0;
+}
+
+/**
+ * Runs the host compiler to build the given C file into a shared object, with
+ * warnings enabled, since they point to bugs in the translation. Returns a
+ * negative error code on failure.
+ **/
+static int compile_program(const char *source_path, const char *object_path)
+{
+    const char *compiler = getenv("CC");
+    if (compiler == NULL || *compiler == '\0') {
+        compiler = "cc";
+    }
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        return -errno;
+    } else if (pid == 0) {
+        execlp(compiler, compiler, "-O2", "-shared", "-fPIC", "-Wall",
+                "-Wextra", "-o", object_path, source_path, (char *)NULL);
+        _exit(127);
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) < 0) {
+        return -errno;
+    } else if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "Error: The compiler '%s' failed to build the AOT "
+                "translation '%s'.\n", compiler, source_path);
+        return -ECHILD;
+    }
+    return 0;
+}
+
+/**
+ * Writes the C translation of the text segment to a new file with a unique
+ * name made from the template, which ends with the given suffix. Returns a
+ * negative error code on failure.
+ **/
+static int write_program_file(const decode_cache_t *cache, char *path,
+        int suffix_len)
+{
+    int fd = mkstemps(path, suffix_len);
+    FILE *file = (fd < 0) ? NULL : fdopen(fd, "w");
+    if (file == NULL) {
+        int rc = -errno;
+        fprintf(stderr, "Error: %s: Unable to open file.\n", path);
+        if (fd >= 0) {
+            close(fd);
+            remove(path);
+        }
+        return rc;
+    }
+
+    int rc = write_program(file, cache);
+    if (fclose(file) != 0 && rc == 0) {
+        rc = -errno;
+    }
+    if (rc < 0) {
+        fprintf(stderr, "Error: %s: Unable to write the AOT translation.\n",
+                path);
+        remove(path);
+    }
+    return rc;
+}
+
+/**
+ * Translates the text segment into C, and builds it into a shared object at the
+ * given path, leaving the C source beside it. Both are written under unique
+ * temporary names first, so that other simulators, or other threads building
+ * the same program, never load a partially written object. Returns a negative
+ * error code on failure.
+ **/
+static int build_program(const decode_cache_t *cache, const char *object_path)
+{
+    int base_len = strlen(object_path) - strlen(".so");
+    char source_path[AOT_MAX_PATH_LEN];
+    char temp_source_path[AOT_MAX_PATH_LEN];
+    char temp_path[AOT_MAX_PATH_LEN];
+    snprintf(source_path, sizeof(source_path), "%.*s.c", base_len,
+            object_path);
+    snprintf(temp_source_path, sizeof(temp_source_path), "%.*s.XXXXXX.c",
+            base_len, object_path);
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", object_path);
+
+    int rc = write_program_file(cache, temp_source_path, strlen(".c"));
+    if (rc < 0) {
+        return rc;
+    }
+
+    // Reserve the object's temporary name, which the compiler replaces
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        rc = -errno;
+        fprintf(stderr, "Error: %s: Unable to open file.\n", temp_path);
+        remove(temp_source_path);
+        return rc;
+    }
+    close(fd);
+
+    rc = compile_program(temp_source_path, temp_path);
+    if (rc == 0 && (rename(temp_path, object_path) < 0 ||
+                rename(temp_source_path, source_path) < 0)) {
+        rc = -errno;
+        fprintf(stderr, "Error: %s: Unable to rename the AOT translation.\n",
+                temp_path);
+    }
+    if (rc < 0) {
+        remove(temp_path);
+        remove(temp_source_path);
+    }
+    return rc;
+}
+
+/**
+ * Loads the translation of the text segment, translating and building it first
+ * if it is not already in the cache. If anything fails, the returned program
+ * has no entry point, and the AOT engine falls back to the basic-block engine.
+ **/
+static aot_program_t *load_program(const decode_cache_t *cache)
+{
+    aot_program_t *program = malloc(sizeof(*program));
+    if (program == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for the AOT "
+                "program.\n");
+        exit(ENOMEM);
+    }
+    program->handle = NULL;
+    program->run = NULL;
+
+    const char *cache_dir = getenv("RISCV_SIM_AOT_CACHE");
+    if (cache_dir == NULL || *cache_dir == '\0') {
+        cache_dir = AOT_CACHE_DIR;
+    }
+    if (mkdir(cache_dir, 0755) < 0 && errno != EEXIST) {
+        fprintf(stderr, "Error: %s: Unable to create the AOT cache "
+                "directory.\n", cache_dir);
+        return program;
+    }
+
+    char object_path[AOT_MAX_PATH_LEN];
+    snprintf(object_path, sizeof(object_path), "%s/text-%016" PRIx64 ".so",
+            cache_dir, hash_text(cache));
+    if (access(object_path, R_OK) < 0 &&
+            build_program(cache, object_path) < 0) {
+        return program;
+    }
+
+    program->handle = dlopen(object_path, RTLD_NOW | RTLD_LOCAL);
+    if (program->handle == NULL) {
+        fprintf(stderr, "Error: %s: Unable to load the AOT translation: %s.\n",
+                object_path, dlerror());
+        return program;
+    }
+
+    // Function pointers cannot be converted from object pointers directly
+    void *run = dlsym(program->handle, AOT_RUN_SYMBOL);
+    if (run == NULL) {
+        fprintf(stderr, "Error: %s: The AOT translation has no entry point.\n",
+                object_path);
+        return program;
+    }
+    program->run = (aot_run_t)(uintptr_t)run;
+    return program;
+}
+
+/**
+ * Unloads the given translated program. The program may be NULL, in which case
+ * nothing happens.
+ **/
+void aot_program_free(aot_program_t *program)
+{
+    if (program == NULL) {
+        return;
+    }
+
+    if (program->handle != NULL) {
+        dlclose(program->handle);
+    }
+    free(program);
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * AOT Engine
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Simulates up to max_instrs cycles on the CPU with the AOT engine.
+ *
+ * This has the same effect as calling process_instruction max_instrs times,
+ * but runs the ahead-of-time translation of the text segment. Instructions
+ * that the translation cannot enter, such as the middle of a block, are run by
+ * the interpreter. Once the program writes to its text, the translation is no
+ * longer valid, and the basic-block engine is used instead.
+ **/
+int process_instructions_aot(cpu_state_t *cpu_state, int max_instrs)
+{
+    decode_cache_t *cache = cpu_state->decode_cache;
+    if (cache == NULL || cache->modified) {
+        return process_instructions_block(cpu_state, max_instrs);
+    }
+
+    if (cache->aot == NULL) {
+        cache->aot = load_program(cache);
+    }
+    aot_run_t run = cache->aot->run;
+    if (run == NULL) {
+        return process_instructions_block(cpu_state, max_instrs);
+    }
+
+    aot_env_t env = {
+        .cpu_state = cpu_state,
+        .registers = cpu_state->registers,
+        .pc = &cpu_state->pc,
+        .halted = &cpu_state->halted,
+        .modified = &cache->modified,
+        .read32 = mem_read32,
+        .write32 = mem_write32,
+        .step = process_instruction,
+    };
+
+    int executed = 0;
+    while (executed < max_instrs && !cpu_state->halted)
+    {
+        if (cache->modified) {
+            executed += process_instructions_block(cpu_state,
+                    max_instrs - executed);
+            break;
+        }
+
+        /* When the translation cannot run the next block, because the PC is
+         * not the start of one or the budget cannot cover it, interpret it. */
+        int budget = max_instrs - executed;
+        int ran = budget - run(&env, budget);
+        executed += ran;
+        if (ran == 0 && !cpu_state->halted) {
+            process_instruction(cpu_state);
+            executed += 1;
+        }
+    }
+
+    return executed;
+}
@@ -0,0 +1,34 @@
+/**
+ * aot.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the ahead-of-time translator, which
+ * translates a whole text segment into C, and builds it into a shared object
+ * that the simulator loads and runs.
+ **/
+
+#ifndef AOT_H_
+#define AOT_H_
+
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+// A loaded ahead-of-time translation of a text segment
+struct aot_program;
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Unloads the given translated program. The program may be NULL, in which case
+ * nothing happens.
+ **/
+void aot_program_free(struct aot_program *program);
+
+#endif /* AOT_H_ */
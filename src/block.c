@@ -0,0 +1,381 @@
+/**
+ * block.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the basic-block translation cache and the engine that
+ * runs a whole block per dispatch.
+ *
+ * Blocks are translated on demand from the predecoded text segment. The engine
+ * only checks its instruction budget once per block, and follows the links
+ * between blocks instead of looking up the next PC, while still counting every
+ * instruction exactly. Instructions outside the predecoded segment, and blocks
+ * that would overrun the budget, are run one at a time by the reference
+ * engine.
+ **/
+
+// Standard Includes
+#include <stdlib.h>             // Malloc and related functions
+#include <stdio.h>              // Printf and related functions
+#include <stdbool.h>            // Boolean type and definitions
+#include <stddef.h>             // Definition of NULL
+#include <stdint.h>             // Fixed-size integral types
+#include <errno.h>              // Error codes and perror
+
+// 18-447 Simulator Includes
+#include <sim.h>                // Definitions for the simulator
+#include <memory.h>             // Interface to the processor memory
+
+// Local Includes
+#include "decode.h"             // Predecoded instructions and the decoder
+#include "isa_table.h"          // The table of instructions in the ISA
+#include "block.h"              // This file's interface
+#include "jit.h"                // Native code for compiled blocks
+
+/*----------------------------------------------------------------------------
+ * Block Table
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Marks the translated blocks for the given predecoded segment as stale.
+ *
+ * Blocks may be running when the text segment is written, so they are only
+ * freed once the block engine reaches the end of the current block.
+ **/
+void block_table_invalidate(decode_cache_t *cache)
+{
+    if (cache->blocks != NULL) {
+        cache->blocks->stale = true;
+    }
+    return;
+}
+
+/**
+ * Frees all of the translated blocks for the given predecoded segment.
+ **/
+void block_table_free(decode_cache_t *cache)
+{
+    block_table_t *table = cache->blocks;
+    if (table == NULL) {
+        return;
+    }
+
+    for (uint32_t i = 0; i < cache->num_entries; i++)
+    {
+        free(table->blocks[i]);
+    }
+    jit_code_free(table->code);
+    free(table);
+    cache->blocks = NULL;
+    return;
+}
+
+/**
+ * Determines if the given operation ends a basic block. These are the
+ * operations that can change the PC to anything but the next instruction.
+ **/
+bool block_is_terminator(instr_op_t op)
+{
+    switch (op)
+    {
+        case INSTR_JAL:
+        case INSTR_JALR:
+        case INSTR_BEQ:
+        case INSTR_BNE:
+        case INSTR_BLT:
+        case INSTR_BGE:
+        case INSTR_BLTU:
+        case INSTR_BGEU:
+        case INSTR_JUMP:
+        case INSTR_ECALL:
+        case INSTR_UNKNOWN_OPCODE:
+        case INSTR_UNKNOWN_FUNCT3:
+        case INSTR_UNKNOWN_FUNCT7:
+        case INSTR_UNKNOWN_FUNCT12:
+            return true;
+
+        default:
+            return false;
+    }
+}
+
+/**
+ * Translates the basic block starting at the given index in the predecoded
+ * segment. Exits on error.
+ **/
+static block_t *translate_block(const decode_cache_t *cache, uint32_t index)
+{
+    /* Find the end of the block, which is either a control transfer, the end
+     * of the segment, or the maximum block length. */
+    uint32_t num_instrs = 0;
+    while (index + num_instrs < cache->num_entries &&
+            num_instrs < BLOCK_MAX_INSTRS)
+    {
+        num_instrs += 1;
+        if (block_is_terminator(cache->entries[index + num_instrs - 1].op)) {
+            break;
+        }
+    }
+
+    block_t *block = malloc(sizeof(*block) +
+            num_instrs * sizeof(block->ops[0]));
+    if (block == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for a translated "
+                "block.\n");
+        exit(ENOMEM);
+    }
+    block->start_pc = cache->base_addr + index * sizeof(uint32_t);
+    block->num_instrs = num_instrs;
+    block->exec_count = 0;
+    block->native = NULL;
+    block->native_body = NULL;
+    for (int i = 0; i < BLOCK_NUM_LINKS; i++)
+    {
+        block->links[i] = NULL;
+    }
+
+    for (uint32_t i = 0; i < num_instrs; i++)
+    {
+        const decoded_instr_t *decoded = &cache->entries[index + i];
+        block->ops[i] = (block_op_t){
+            .op = decoded->op,
+            .rd = decoded->rd,
+            .rs1 = decoded->rs1,
+            .rs2 = decoded->rs2,
+            .imm = decoded->imm,
+        };
+    }
+
+    return block;
+}
+
+/**
+ * Looks up the block starting at the given address, translating it if this is
+ * the first time it has been reached. Returns NULL if the address lies outside
+ * the predecoded segment. Exits on error.
+ **/
+block_t *block_lookup(decode_cache_t *cache, uint32_t pc)
+{
+    if (decode_cache_lookup(cache, pc) == NULL) {
+        return NULL;
+    }
+
+    // Allocate the table of blocks the first time any block is needed
+    if (cache->blocks == NULL) {
+        cache->blocks = calloc(1, sizeof(*cache->blocks) +
+                cache->num_entries * sizeof(cache->blocks->blocks[0]));
+        if (cache->blocks == NULL) {
+            fprintf(stderr, "Error: Unable to allocate memory for the block "
+                    "table.\n");
+            exit(ENOMEM);
+        }
+    }
+
+    uint32_t index = (pc - cache->base_addr) / sizeof(uint32_t);
+    block_t **block = &cache->blocks->blocks[index];
+    if (*block == NULL) {
+        *block = translate_block(cache, index);
+    }
+    return *block;
+}
+
+/*----------------------------------------------------------------------------
+ * Block Engine
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Runs all of the instructions in the given block, adding the number that
+ * were executed to the count, and updating the PC to the next instruction.
+ *
+ * The block stops early if the processor is halted, or if the program writes
+ * to the text segment, since the rest of the block may no longer be valid.
+ **/
+block_exit_t block_run(cpu_state_t *cpu_state, decode_cache_t *cache,
+        const block_t *block, int *executed)
+{
+    uint32_t *regs = cpu_state->registers;
+    uint32_t pc = block->start_pc;
+    block_exit_t exit;
+    bool taken;
+
+    const block_op_t *op = block->ops;
+    const block_op_t *end = &block->ops[block->num_instrs];
+    for (; op < end; op++, pc += sizeof(uint32_t))
+    {
+        uint32_t rs1 = regs[op->rs1];
+        uint32_t rs2 = regs[op->rs2];
+        uint32_t imm = (uint32_t)op->imm;
+        uint32_t result;
+
+// The operands of the operation, as the ISA table refers to them
+#define RS1     rs1
+#define RS2     rs2
+#define IMM     imm
+#define PC      pc
+        switch ((instr_op_t)op->op)
+        {
+            // Computations, generated from the ISA table
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+            case INSTR_##NAME: \
+                result = (action); \
+                break;
+            RV32I_ALU_OPS(X)
+#undef X
+
+            // Operations that the decoder specializes instructions to
+            case INSTR_NOP:
+                continue;
+
+            case INSTR_LI:
+                result = imm;
+                break;
+
+            case INSTR_JUMP:
+                pc += imm;
+                exit = BLOCK_EXIT_TAKEN;
+                goto done;
+
+            // Word loads and stores, which can halt the processor
+            case INSTR_LW:
+                result = mem_read32(cpu_state, rs1 + imm);
+                if (cpu_state->halted) {
+                    goto stop;
+                }
+                break;
+
+            case INSTR_SW:
+                mem_write32(cpu_state, rs1 + imm, rs2);
+                if (cpu_state->halted) {
+                    goto stop;
+                } else if (cache->blocks->stale) {
+                    pc += sizeof(uint32_t);
+                    goto stop;
+                }
+                continue;
+
+            // Branches and jumps, which always end a block
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+            case INSTR_##NAME: \
+                taken = (action); \
+                goto branch;
+            RV32I_BRANCH_OPS(X)
+#undef X
+
+            case INSTR_JAL:
+                regs[op->rd] = pc + sizeof(uint32_t);
+                regs[0] = 0;
+                pc += imm;
+                exit = BLOCK_EXIT_TAKEN;
+                goto done;
+
+            case INSTR_JALR:
+                regs[op->rd] = pc + sizeof(uint32_t);
+                regs[0] = 0;
+                pc = (rs1 + imm) & ~(uint32_t)1;
+                exit = BLOCK_EXIT_INDIRECT;
+                goto done;
+
+            /* Rare operations, such as sub-word memory accesses, system calls,
+             * and undecodable instructions, are carried out by their handlers,
+             * which update the PC themselves. */
+            default: {
+                const decoded_instr_t *decoded = decode_cache_lookup(cache,
+                        pc);
+                cpu_state->pc = pc;
+                decoded->handler(cpu_state, decoded);
+                if (cpu_state->halted || cache->blocks->stale) {
+                    pc = cpu_state->pc;
+                    goto stop;
+                } else if (block_is_terminator(op->op)) {
+                    pc = cpu_state->pc;
+                    exit = BLOCK_EXIT_INDIRECT;
+                    goto done;
+                }
+                continue;
+            }
+        }
+#undef RS1
+#undef RS2
+#undef IMM
+#undef PC
+
+        // Loads may still write x0, which is restored afterwards
+        regs[op->rd] = result;
+        regs[0] = 0;
+    }
+
+    // The block ran off its end without a control transfer
+    cpu_state->pc = pc;
+    *executed += block->num_instrs;
+    return BLOCK_EXIT_NEXT;
+
+    // A conditional branch ended the block
+branch:
+    exit = taken ? BLOCK_EXIT_TAKEN : BLOCK_EXIT_NEXT;
+    pc += taken ? (uint32_t)op->imm : sizeof(uint32_t);
+
+done:
+    cpu_state->pc = pc;
+    *executed += block->num_instrs;
+    return exit;
+
+    /* The instruction that halted the processor or wrote to the text segment
+     * still counts as executed. */
+stop:
+    cpu_state->pc = pc;
+    *executed += op - block->ops + 1;
+    return BLOCK_EXIT_STOP;
+}
+
+/**
+ * Simulates up to max_instrs cycles on the CPU with the basic-block engine.
+ *
+ * This has the same effect as calling process_instruction max_instrs times,
+ * but runs a whole basic block per dispatch, following the links between
+ * blocks. Simulation stops early if the processor is halted.
+ **/
+int process_instructions_block(cpu_state_t *cpu_state, int max_instrs)
+{
+    decode_cache_t *cache = cpu_state->decode_cache;
+    block_t *block = NULL;
+    int executed = 0;
+
+    while (executed < max_instrs && !cpu_state->halted)
+    {
+        // Discard the translations once the text segment has been written
+        if (cache != NULL && cache->blocks != NULL && cache->blocks->stale) {
+            block_table_free(cache);
+            block = NULL;
+        }
+
+        if (block == NULL) {
+            block = block_lookup(cache, cpu_state->pc);
+        }
+
+        /* Instructions outside the predecoded segment, and blocks that would
+         * overrun the budget, are run one at a time by the reference engine. */
+        if (block == NULL || (int)block->num_instrs > max_instrs - executed) {
+            process_instruction(cpu_state);
+            executed += 1;
+            block = NULL;
+            continue;
+        }
+
+        /* Follow the link for a direct exit, filling it in the first time it is
+         * taken. Other exits look up the next block by its PC. */
+        block_exit_t exit = block_run(cpu_state, cache, block, &executed);
+        if (exit == BLOCK_EXIT_TAKEN || exit == BLOCK_EXIT_NEXT) {
+            if (block->links[exit] == NULL) {
+                block->links[exit] = block_lookup(cache, cpu_state->pc);
+            }
+            block = block->links[exit];
+        } else {
+            block = NULL;
+        }
+    }
+
+    return executed;
+}
@@ -0,0 +1,119 @@
+/**
+ * block.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the basic-block translation cache.
+ *
+ * A basic block is a run of straight-line instructions in the text segment,
+ * ending with a branch, jump, or system call. Each block is translated once,
+ * the first time its starting address is executed, into a compact array of
+ * operations. Blocks are linked directly to the blocks that follow their
+ * direct exits, so that hot loops run from block to block without looking up
+ * the next PC.
+ **/
+
+#ifndef BLOCK_H_
+#define BLOCK_H_
+
+// Standard Includes
+#include <stdbool.h>            // Boolean type and definitions
+#include <stdint.h>             // Fixed-size integral types
+
+// Local Includes
+#include "decode.h"             // Definition of decode_cache_t
+
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+// The maximum number of instructions translated into a single block
+#define BLOCK_MAX_INSTRS        64
+
+/* The ways in which the execution of a block can end. Only the direct exits,
+ * which come first, can be linked to a successor block. */
+typedef enum block_exit {
+    BLOCK_EXIT_TAKEN,           // Left through a taken branch or a jal
+    BLOCK_EXIT_NEXT,            // Fell through to the following instruction
+    BLOCK_EXIT_INDIRECT,        // Left through a jalr or a system call
+    BLOCK_EXIT_STOP,            // Halted, or the text segment was written
+} block_exit_t;
+
+// The number of direct exits of a block, which are indexed by their exit
+#define BLOCK_NUM_LINKS         (BLOCK_EXIT_NEXT + 1)
+
+// A single translated operation, packed to keep blocks compact
+typedef struct block_op {
+    uint8_t op;                 // Operation the instruction was decoded to
+    uint8_t rd;                 // Destination register
+    uint8_t rs1;                // First source register
+    uint8_t rs2;                // Second source register
+    int32_t imm;                // Sign-extended immediate value
+} block_op_t;
+
+// Forward declaration of the native code cache, defined by the JIT
+struct jit_code;
+
+// A translated basic block
+typedef struct block {
+    uint32_t start_pc;          // Address of the first instruction
+    uint32_t num_instrs;        // Number of instructions in the block
+    uint32_t exec_count;        // Times the block ran before being compiled
+    uint8_t *native;            // Native code for the block, if compiled
+    uint8_t *native_body;       // Native code past the entry, for chaining
+    struct block *links[BLOCK_NUM_LINKS];   // Chained successor blocks
+    block_op_t ops[];           // Translated operation for each instruction
+} block_t;
+
+// The translated blocks for a text segment, indexed like the decode cache
+typedef struct block_table {
+    bool stale;                 // The text was written, blocks must be flushed
+    struct jit_code *code;      // Native code for the compiled blocks
+    block_t *blocks[];          // Block starting at each word, if translated
+} block_table_t;
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Looks up the block starting at the given address, translating it if this is
+ * the first time it has been reached. Returns NULL if the address lies outside
+ * the predecoded segment. Exits on error.
+ **/
+block_t *block_lookup(decode_cache_t *cache, uint32_t pc);
+
+/**
+ * Runs all of the instructions in the given block, adding the number that
+ * were executed to the count, and updating the PC to the next instruction.
+ * Returns how the block was left.
+ *
+ * The block stops early if the processor is halted, or if the program writes
+ * to the text segment, since the rest of the block may no longer be valid.
+ **/
+block_exit_t block_run(cpu_state_t *cpu_state, decode_cache_t *cache,
+        const block_t *block, int *executed);
+
+/**
+ * Determines if the given operation ends a basic block. These are the
+ * operations that can change the PC to anything but the next instruction.
+ **/
+bool block_is_terminator(instr_op_t op);
+
+/**
+ * Marks the translated blocks for the given predecoded segment as stale.
+ *
+ * Blocks may be running when the text segment is written, so they are only
+ * freed once the block engine reaches the end of the current block.
+ **/
+void block_table_invalidate(decode_cache_t *cache);
+
+/**
+ * Frees all of the translated blocks for the given predecoded segment.
+ **/
+void block_table_free(decode_cache_t *cache);
+
+#endif /* BLOCK_H_ */
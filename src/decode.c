@@ -0,0 +1,752 @@
+/**
+ * decode.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the instruction decoder and the predecoded form of the
+ * user text segment.
+ *
+ * The text segment does not change once the program is loaded, except when the
+ * program stores to it, so each of its words is decoded once when the program
+ * is loaded. The simulator then only has to look up the handler and operands
+ * for the current PC, instead of extracting them from the instruction word on
+ * every cycle.
+ *
+ * If the RISCV_SIM_DECODE_CACHE environment variable names a directory, then
+ * the predecoded segments are also kept there, under a hash of the decoder and
+ * the segment's contents. A program whose text is already in the directory is
+ * read back from its file instead of being decoded again, so that repeated
+ * runs of the same program skip the decoder.
+ **/
+
+// Standard Includes
+#include <stdlib.h>             // Malloc and related functions
+#include <stdio.h>              // Printf and related functions
+#include <stdint.h>             // Fixed-size integral types
+#include <stdbool.h>            // Boolean type and definitions
+
+// Standard Includes
+#include <errno.h>              // Error codes and perror
+#include <inttypes.h>           // Format specifiers for fixed-size types
+#include <string.h>             // Strerror and memcmp
+#include <unistd.h>             // Closing of files
+#include <sys/stat.h>           // Creation of the cache directory
+#include <stdatomic.h>          // Flag for reporting a failed save once
+
+// 18-447 Simulator Includes
+#include <riscv_isa.h>          // Definition of RISC-V opcodes and functions
+#include <sim.h>                // Definitions for the simulator
+#include <memory.h>             // Interface to the processor memory
+
+// Local Includes
+#include "instructions.h"       // Handlers for each instruction
+#include "decode.h"             // This file's interface
+#include "block.h"              // Translated basic blocks
+#include "aot.h"                // Ahead-of-time translated programs
+
+/*----------------------------------------------------------------------------
+ * Handler Tables
+ *----------------------------------------------------------------------------*/
+
+// Handlers for each decoded operation
+static const instr_handler_t INSTR_HANDLERS[INSTR_NUM_OPS] = {
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+    [INSTR_##NAME]          = exec_##name,
+    RV32I_OPS(X)
+#undef X
+    [INSTR_ECALL]           = exec_ecall,
+    [INSTR_NOP]             = exec_nop,
+    [INSTR_LI]              = exec_li,
+    [INSTR_JUMP]            = exec_jump,
+    [INSTR_UNKNOWN_OPCODE]  = exec_unknown_opcode,
+    [INSTR_UNKNOWN_FUNCT3]  = exec_unknown_funct3,
+    [INSTR_UNKNOWN_FUNCT7]  = exec_unknown_funct7,
+    [INSTR_UNKNOWN_FUNCT12] = exec_unknown_funct12,
+};
+
+/*----------------------------------------------------------------------------
+ * Immediate Decoding
+ *----------------------------------------------------------------------------*/
+
+/**
+ * R-type instructions have no immediate.
+ **/
+static int32_t rtype_imm(uint32_t instr)
+{
+    (void)instr;
+    return 0;
+}
+
+/**
+ * Extracts the shift amount for a shift by an immediate, which is held in the
+ * low bits of the I-type immediate.
+ **/
+static int32_t shamt_imm(uint32_t instr)
+{
+    return (instr >> 20) & 0x1F;
+}
+
+/**
+ * Extracts the sign-extended immediate for an I-type instruction.
+ **/
+static int32_t itype_imm(uint32_t instr)
+{
+    return ((int32_t)instr) >> 20;
+}
+
+/**
+ * Extracts the sign-extended immediate for an S-type instruction.
+ **/
+static int32_t stype_imm(uint32_t instr)
+{
+    return ((((int32_t)instr) >> 25) << 5) | ((instr >> 7) & 0x1F);
+}
+
+/**
+ * Extracts the sign-extended branch offset for an SB-type instruction.
+ **/
+static int32_t sbtype_imm(uint32_t instr)
+{
+    return ((((int32_t)instr) >> 31) << 12) | (((instr >> 7) & 0x1) << 11) |
+            (((instr >> 25) & 0x3F) << 5) | (((instr >> 8) & 0xF) << 1);
+}
+
+/**
+ * Extracts the immediate for a U-type instruction, already shifted into the
+ * upper 20 bits.
+ **/
+static int32_t utype_imm(uint32_t instr)
+{
+    return (int32_t)(instr & 0xFFFFF000);
+}
+
+/**
+ * Extracts the sign-extended jump offset for a UJ-type instruction.
+ **/
+static int32_t ujtype_imm(uint32_t instr)
+{
+    return ((((int32_t)instr) >> 31) << 20) | (instr & 0xFF000) |
+            (((instr >> 20) & 0x1) << 11) | (((instr >> 21) & 0x3FF) << 1);
+}
+
+/*----------------------------------------------------------------------------
+ * Instruction Decoding
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Finds the operation in the ISA table with the given opcode and function
+ * codes. Returns INSTR_NUM_OPS if there is no such operation.
+ **/
+static instr_op_t lookup_op(opcode_t opcode, uint32_t funct3, uint32_t funct7)
+{
+#define X(NAME, name, format, op_opcode, op_funct3, op_funct7, action) \
+    if (opcode == (op_opcode) && \
+            ((op_funct3) == ISA_ANY || funct3 == (uint32_t)(op_funct3)) && \
+            ((op_funct7) == ISA_ANY || funct7 == (uint32_t)(op_funct7))) { \
+        return INSTR_##NAME; \
+    }
+    RV32I_OPS(X)
+#undef X
+
+    return INSTR_NUM_OPS;
+}
+
+/**
+ * Extracts the sign-extended immediate for the given operation, based on the
+ * instruction format that the ISA table lists for it.
+ **/
+static int32_t decode_imm(instr_op_t op, uint32_t instr)
+{
+    switch (op)
+    {
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+        case INSTR_##NAME: \
+            return format##_imm(instr);
+        RV32I_OPS(X)
+#undef X
+
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Selects the error for an instruction word that is not in the ISA table,
+ * based on which of its fields could not be decoded.
+ **/
+static instr_op_t decode_unknown(opcode_t opcode, uint32_t funct3,
+        itype_funct12_t funct12)
+{
+    switch (opcode)
+    {
+        // Every 3-bit function code is used, so the 7-bit one is unknown
+        case OP_OP:
+        case OP_IMM:
+            return INSTR_UNKNOWN_FUNCT7;
+
+        case OP_LOAD:
+        case OP_STORE:
+        case OP_JALR:
+        case OP_BRANCH:
+            return INSTR_UNKNOWN_FUNCT3;
+
+        case OP_SYSTEM:
+            return (funct12 == FUNCT12_ECALL && funct3 == 0) ? INSTR_ECALL :
+                    INSTR_UNKNOWN_FUNCT12;
+
+        default:
+            return INSTR_UNKNOWN_OPCODE;
+    }
+}
+
+/**
+ * Evaluates a computation from the ISA table whose register operands are all
+ * x0, which gives the constant that it always writes.
+ **/
+static uint32_t evaluate_constant(instr_op_t op, uint32_t imm)
+{
+    uint32_t rs1 = 0;
+    uint32_t rs2 = 0;
+
+#define RS1     rs1
+#define RS2     rs2
+#define IMM     imm
+#define PC      0U
+    switch (op)
+    {
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+        case INSTR_##NAME: \
+            return (action);
+        RV32I_ALU_OPS(X)
+#undef X
+
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Evaluates the condition of a branch from the ISA table that compares a
+ * register with itself, which is either always or never taken.
+ **/
+static bool evaluate_self_branch(instr_op_t op)
+{
+    uint32_t rs1 = 0;
+    uint32_t rs2 = 0;
+
+    switch (op)
+    {
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+        case INSTR_##NAME: \
+            return (action);
+        RV32I_BRANCH_OPS(X)
+#undef X
+
+        default:
+            return false;
+    }
+#undef RS1
+#undef RS2
+#undef IMM
+#undef PC
+}
+
+/**
+ * Specializes a decoded instruction to a simpler operation when its register
+ * operands allow it, which removes those checks from every execution of it.
+ *
+ * Computations that write x0 become no-ops, and computations whose register
+ * operands are all x0 become immediate moves of the constant they compute.
+ * This leaves every computation with a destination other than x0. Branches
+ * that compare a register with itself become an unconditional jump or a no-op.
+ **/
+static void specialize_instruction(opcode_t opcode, decoded_instr_t *decoded)
+{
+    switch (decoded->op)
+    {
+#define X(NAME, name, format, op_opcode, funct3, funct7, action) \
+        case INSTR_##NAME:
+        RV32I_ALU_OPS(X)
+#undef X
+            if (decoded->rd == REG_X0) {
+                decoded->op = INSTR_NOP;
+            } else if ((opcode == OP_IMM && decoded->rs1 == REG_X0) ||
+                    (opcode == OP_OP && decoded->rs1 == REG_X0 &&
+                     decoded->rs2 == REG_X0)) {
+                decoded->imm = evaluate_constant(decoded->op, decoded->imm);
+                decoded->op = INSTR_LI;
+            }
+            break;
+
+#define X(NAME, name, format, op_opcode, funct3, funct7, action) \
+        case INSTR_##NAME:
+        RV32I_BRANCH_OPS(X)
+#undef X
+            if (decoded->rs1 == decoded->rs2) {
+                decoded->op = evaluate_self_branch(decoded->op) ?
+                        INSTR_JUMP : INSTR_NOP;
+            }
+            break;
+
+        default:
+            break;
+    }
+    return;
+}
+
+/**
+ * Decodes the given instruction word, filling in the decoded instruction.
+ *
+ * The operation and the format of its immediate are looked up in the ISA
+ * table. Instructions that are unknown or unimplemented are decoded to a
+ * handler that reports the error and halts the processor when it is executed.
+ **/
+void decode_instruction(uint32_t instr, decoded_instr_t *decoded)
+{
+    // Decode the opcode, function codes, and registers
+    opcode_t opcode = instr & 0x7F;
+    uint32_t funct3 = (instr >> 12) & 0x7;
+    uint32_t funct7 = (instr >> 25) & 0x7F;
+    itype_funct12_t funct12 = (instr >> 20) & 0xFFF;
+
+    decoded->instr = instr;
+    decoded->rd = (instr >> 7) & 0x1F;
+    decoded->rs1 = (instr >> 15) & 0x1F;
+    decoded->rs2 = (instr >> 20) & 0x1F;
+    decoded->fusion = FUSION_NONE;
+    decoded->fused_len = 1;
+
+    // Select the operation, and sign-extend the immediate based on its format
+    decoded->op = lookup_op(opcode, funct3, funct7);
+    if (decoded->op == INSTR_NUM_OPS) {
+        decoded->op = decode_unknown(opcode, funct3, funct12);
+    }
+    decoded->imm = decode_imm(decoded->op, instr);
+
+    specialize_instruction(opcode, decoded);
+    decoded->handler = INSTR_HANDLERS[decoded->op];
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * Instruction Fusion
+ *----------------------------------------------------------------------------*/
+
+// Returns true if the instruction is a set-less-than of two registers
+static bool is_slt(const decoded_instr_t *instr)
+{
+    return instr->op == INSTR_SLT || instr->op == INSTR_SLTU;
+}
+
+// Returns true if the instruction is a word store relative to the stack pointer
+static bool is_sp_store(const decoded_instr_t *instr)
+{
+    return instr->op == INSTR_SW && instr->rs1 == REG_X2;
+}
+
+/**
+ * Finds the fused sequence, if any, that starts at the given entry of the
+ * decode cache, and records it on the entry.
+ *
+ * The second instruction of each pair must consume the register written by the
+ * first one, so that the pair can be carried out as one operation. Pairs whose
+ * first instruction writes x0 are never fused, since the write is discarded.
+ **/
+static void fuse_instruction(decode_cache_t *cache, uint32_t index)
+{
+    decoded_instr_t *first = &cache->entries[index];
+    const decoded_instr_t *next = (index + 1 < cache->num_entries) ?
+            &cache->entries[index + 1] : NULL;
+
+    first->fusion = FUSION_NONE;
+    first->fused_len = 1;
+    if (next == NULL) {
+        return;
+    }
+
+    // Constant materialization and PC-relative calls
+    if (first->op == INSTR_LUI && first->rd != REG_X0 &&
+            next->op == INSTR_ADDI && next->rs1 == first->rd) {
+        first->fusion = FUSION_LUI_ADDI;
+        first->fused_len = 2;
+    } else if (first->op == INSTR_AUIPC && first->rd != REG_X0 &&
+            next->op == INSTR_JALR && next->rs1 == first->rd) {
+        first->fusion = FUSION_AUIPC_JALR;
+        first->fused_len = 2;
+
+    // Compare-and-branch, where the branch tests the result against x0
+    } else if (is_slt(first) && first->rd != REG_X0 &&
+            (next->op == INSTR_BEQ || next->op == INSTR_BNE) &&
+            ((next->rs1 == first->rd && next->rs2 == REG_X0) ||
+             (next->rs1 == REG_X0 && next->rs2 == first->rd))) {
+        first->fusion = FUSION_SLT_BRANCH;
+        first->fused_len = 2;
+
+    // Function prologues, which allocate a stack frame and then fill it
+    } else if (first->op == INSTR_ADDI && first->rd == REG_X2 &&
+            first->rs1 == REG_X2 && is_sp_store(next)) {
+        uint32_t stores = 0;
+        while (stores < FUSION_MAX_STORES &&
+                index + 1 + stores < cache->num_entries &&
+                is_sp_store(&cache->entries[index + 1 + stores]))
+        {
+            stores += 1;
+        }
+        first->fusion = FUSION_SP_STORES;
+        first->fused_len = 1 + stores;
+    }
+    return;
+}
+
+/**
+ * Recomputes the fused sequences that start at the entries in the range
+ * [first, last] of the decode cache. The range is clamped to the cache.
+ **/
+static void fuse_instructions(decode_cache_t *cache, uint32_t first,
+        uint32_t last)
+{
+    for (uint32_t i = first; i <= last && i < cache->num_entries; i++)
+    {
+        fuse_instruction(cache, i);
+    }
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * Persistent Decode Cache
+ *----------------------------------------------------------------------------*/
+
+// The environment variable that names the directory of predecoded segments
+#define DECODE_CACHE_ENV        "RISCV_SIM_DECODE_CACHE"
+
+/* The version of the decoder, which is part of the key for cached segments.
+ * This must change whenever the decoder's output for a word changes. Changes to
+ * the layout of the entries and to the number of operations are part of the
+ * key on their own. */
+#define DECODE_VERSION          "riscv-sim-decode-1"
+
+// The maximum length of a path to a file in the cache
+#define DECODE_MAX_PATH_LEN     4096
+
+// The magic number that starts a cached segment file ("47DC")
+#define DECODE_FILE_MAGIC       0x43443734
+
+// The number of entries that are written to a cached segment file at once
+#define DECODE_FILE_BUFFER_LEN  256
+
+// Set once a segment could not be saved, so that this is only reported once
+static atomic_flag save_failure_reported = ATOMIC_FLAG_INIT;
+
+/* The operations in the ISA table, which are also part of the key for cached
+ * segments, since the decoded operations are numbered in their order. */
+#define DECODE_ISA_DEFINITIONS \
+    RV32I_OPS(DECODE_ISA_DEFINITION)
+#define DECODE_ISA_DEFINITION(NAME, name, format, opcode, funct3, funct7, \
+        action) \
+    #NAME " " #format " " #opcode " " #funct3 " " #funct7 "\n"
+
+/* The header of a cached segment file, which is followed by the segment's
+ * predecoded entries. The entries are saved as they are in memory, except that
+ * their handlers are recomputed from their operations when they are loaded. */
+typedef struct decode_file_header {
+    uint32_t magic;             // The magic number for cached segments
+    uint32_t entry_size;        // The size of each predecoded entry
+    uint64_t key;               // Hash of the decoder and the segment
+    uint32_t base_addr;         // Base address of the segment
+    uint32_t num_entries;       // Number of predecoded entries that follow
+} decode_file_header_t;
+
+// Adds the bytes to a 64-bit FNV-1a hash
+static uint64_t hash_bytes(uint64_t hash, const void *data, size_t size)
+{
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++)
+    {
+        hash = (hash ^ bytes[i]) * UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+/**
+ * Computes the 64-bit FNV-1a hash of the decoder version, the ISA table, the
+ * size of the entries and the number of operations, and the base address and
+ * contents of the text segment, which identifies its predecoded form in the
+ * cache.
+ **/
+static uint64_t hash_segment(const mem_segment_t *segment)
+{
+    static const char DECODER[] = DECODE_VERSION DECODE_ISA_DEFINITIONS;
+    const uint32_t layout[] = { sizeof(decoded_instr_t), INSTR_NUM_OPS };
+    uint64_t hash = hash_bytes(UINT64_C(0xcbf29ce484222325), DECODER,
+            sizeof(DECODER) - 1);
+    hash = hash_bytes(hash, layout, sizeof(layout));
+    hash = hash_bytes(hash, &segment->base_addr, sizeof(segment->base_addr));
+    return hash_bytes(hash, segment->mem, segment->size);
+}
+
+/**
+ * Checks that the fields of a loaded entry are in range, and that it was
+ * decoded from the given instruction word. Since the entries only depend on
+ * the words, this ensures that a hash collision is never run, and that a
+ * damaged file cannot make the engines index out of bounds. Like the AOT
+ * engine's objects, the files are otherwise trusted, and they are only ever
+ * replaced whole.
+ **/
+static bool entry_valid(const decoded_instr_t *entry, uint32_t instr)
+{
+    return entry->instr == instr && entry->op < INSTR_NUM_OPS &&
+            entry->rd < RISCV_NUM_REGS && entry->rs1 < RISCV_NUM_REGS &&
+            entry->rs2 < RISCV_NUM_REGS && entry->fusion <= FUSION_SP_STORES &&
+            entry->fused_len >= 1 && entry->fused_len <= FUSION_MAX_LEN;
+}
+
+/**
+ * Loads the predecoded entries for the text segment from the given cached
+ * file into the cache, which has room for them. Each entry is checked and
+ * given its handler once it is read. Returns false if the file does not exist
+ * or does not match the segment.
+ *
+ * The entries are read into the cache rather than used from a mapping of the
+ * file, since their handlers are host addresses, which differ from run to run.
+ * Every entry is written when its handler is filled in, so every page of a
+ * private mapping would be copied anyway.
+ **/
+static bool load_cached_entries(decode_cache_t *cache,
+        const mem_segment_t *segment, const char *path, uint64_t key)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return false;
+    }
+
+    // The file must hold exactly the header and the segment's entries
+    decode_file_header_t header;
+    size_t num_entries = cache->num_entries;
+    bool valid = fread(&header, sizeof(header), 1, file) == 1 &&
+            header.magic == DECODE_FILE_MAGIC &&
+            header.entry_size == sizeof(cache->entries[0]) &&
+            header.key == key && header.base_addr == cache->base_addr &&
+            header.num_entries == cache->num_entries &&
+            fread(cache->entries, sizeof(cache->entries[0]), num_entries,
+                    file) == num_entries && fgetc(file) == EOF;
+    fclose(file);
+
+    for (uint32_t i = 0; valid && i < cache->num_entries; i++)
+    {
+        const uint8_t *word = &segment->mem[i * sizeof(uint32_t)];
+        uint32_t instr = word[0] | (word[1] << 8) | (word[2] << 16) |
+                ((uint32_t)word[3] << 24);
+        decoded_instr_t *entry = &cache->entries[i];
+        valid = entry_valid(entry, instr);
+        entry->handler = valid ? INSTR_HANDLERS[entry->op] : NULL;
+    }
+
+    return valid;
+}
+
+/**
+ * Saves the predecoded entries for the text segment to the given file in the
+ * cache. The file is written under a unique temporary name first, so that
+ * other simulators, or other threads saving the same file, never load a
+ * partially written file. Returns a negative error code on failure.
+ **/
+static int save_cached_entries(const decode_cache_t *cache, const char *path,
+        uint64_t key)
+{
+    char temp_path[DECODE_MAX_PATH_LEN];
+    snprintf(temp_path, sizeof(temp_path), "%s.XXXXXX", path);
+    int fd = mkstemp(temp_path);
+    if (fd < 0) {
+        return -errno;
+    }
+    FILE *file = fdopen(fd, "wb");
+    if (file == NULL) {
+        int rc = -errno;
+        close(fd);
+        remove(temp_path);
+        return rc;
+    }
+
+    /* Handlers are host addresses, so the entries are written as NULL through
+     * a zeroed buffer. Their fields are copied one by one, so that the padding
+     * between them is written as zeros, and the file only depends on the
+     * segment. */
+    decoded_instr_t buffer[DECODE_FILE_BUFFER_LEN];
+    decode_file_header_t header = {
+        .magic          = DECODE_FILE_MAGIC,
+        .entry_size     = sizeof(cache->entries[0]),
+        .key            = key,
+        .base_addr      = cache->base_addr,
+        .num_entries    = cache->num_entries,
+    };
+    bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (uint32_t i = 0; written && i < cache->num_entries;
+            i += DECODE_FILE_BUFFER_LEN)
+    {
+        uint32_t count = cache->num_entries - i;
+        if (count > DECODE_FILE_BUFFER_LEN) {
+            count = DECODE_FILE_BUFFER_LEN;
+        }
+        memset(buffer, 0, count * sizeof(buffer[0]));
+        for (uint32_t j = 0; j < count; j++)
+        {
+            const decoded_instr_t *entry = &cache->entries[i + j];
+            buffer[j].op = entry->op;
+            buffer[j].instr = entry->instr;
+            buffer[j].imm = entry->imm;
+            buffer[j].rd = entry->rd;
+            buffer[j].rs1 = entry->rs1;
+            buffer[j].rs2 = entry->rs2;
+            buffer[j].fusion = entry->fusion;
+            buffer[j].fused_len = entry->fused_len;
+        }
+        written = fwrite(buffer, sizeof(buffer[0]), count, file) == count;
+    }
+
+    int rc = 0;
+    if (fclose(file) != 0 || !written) {
+        rc = -EIO;
+    } else if (rename(temp_path, path) < 0) {
+        rc = -errno;
+    }
+    if (rc < 0) {
+        remove(temp_path);
+    }
+    return rc;
+}
+
+/*----------------------------------------------------------------------------
+ * Decode Cache
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Decodes each word in the text segment into the cache, which has an entry for
+ * each of them, and finds the fused sequences among them.
+ **/
+static void decode_segment(decode_cache_t *cache, const mem_segment_t *segment)
+{
+    // Decode each word in the segment, which is stored in little-endian order
+    for (uint32_t i = 0; i < cache->num_entries; i++)
+    {
+        const uint8_t *word = &segment->mem[i * sizeof(uint32_t)];
+        uint32_t instr = word[0] | (word[1] << 8) | (word[2] << 16) |
+                ((uint32_t)word[3] << 24);
+        decode_instruction(instr, &cache->entries[i]);
+    }
+    if (cache->num_entries > 0) {
+        fuse_instructions(cache, 0, cache->num_entries - 1);
+    }
+    return;
+}
+
+/**
+ * Loads the predecoded text segment from the persistent cache in the given
+ * directory, or if it is not there, decodes the segment and saves it there.
+ * Failing to save the segment is not an error, so it is only reported as a
+ * warning the first time, rather than on every run.
+ **/
+static void decode_segment_cached(decode_cache_t *cache,
+        const mem_segment_t *segment, const char *cache_dir)
+{
+    char path[DECODE_MAX_PATH_LEN];
+    uint64_t key = hash_segment(segment);
+    snprintf(path, sizeof(path), "%s/text-%016" PRIx64 ".decode", cache_dir,
+            key);
+    if (load_cached_entries(cache, segment, path, key)) {
+        return;
+    }
+
+    decode_segment(cache, segment);
+    int rc = (mkdir(cache_dir, 0755) < 0 && errno != EEXIST) ? -errno :
+            save_cached_entries(cache, path, key);
+    if (rc < 0 && !atomic_flag_test_and_set(&save_failure_reported)) {
+        fprintf(stderr, "Warning: %s: Unable to save the predecoded text "
+                "segment: %s. Running without the cache.\n", path,
+                strerror(-rc));
+    }
+    return;
+}
+
+/**
+ * Builds the predecoded form of the given text segment.
+ *
+ * This decodes every word in the segment once, so that the simulator does not
+ * have to re-extract the fields of an instruction each time it is executed.
+ * If the persistent cache is enabled, the segment is loaded from it instead,
+ * or saved to it once it is decoded. This is invoked by the memory subsystem
+ * once the program has been loaded. Exits on error.
+ **/
+void decode_cache_build(cpu_state_t *cpu_state, const mem_segment_t *segment)
+{
+    // Allocate a cache entry for each word in the segment
+    uint32_t num_entries = segment->size / sizeof(uint32_t);
+    decode_cache_t *cache = malloc(sizeof(*cache) +
+            num_entries * sizeof(cache->entries[0]));
+    if (cache == NULL) {
+        fprintf(stderr, "Error: Unable to allocate memory for the decode "
+                "cache.\n");
+        exit(ENOMEM);
+    }
+    cache->base_addr = segment->base_addr;
+    cache->num_entries = num_entries;
+    cache->blocks = NULL;
+    cache->aot = NULL;
+    cache->modified = false;
+
+    // Without a persistent cache directory, the segment is always decoded
+    const char *cache_dir = getenv(DECODE_CACHE_ENV);
+    if (cache_dir == NULL || *cache_dir == '\0' || num_entries == 0) {
+        decode_segment(cache, segment);
+    } else {
+        decode_segment_cached(cache, segment, cache_dir);
+    }
+
+    decode_cache_free(cpu_state);
+    cpu_state->decode_cache = cache;
+    return;
+}
+
+/**
+ * Frees the predecoded text segment previously built by decode_cache_build.
+ **/
+void decode_cache_free(cpu_state_t *cpu_state)
+{
+    if (cpu_state->decode_cache != NULL) {
+        block_table_free(cpu_state->decode_cache);
+        aot_program_free(cpu_state->decode_cache->aot);
+    }
+    free(cpu_state->decode_cache);
+    cpu_state->decode_cache = NULL;
+    return;
+}
+
+/**
+ * Invalidates the predecoded entry for the word containing the given address.
+ *
+ * This must be invoked whenever memory in the predecoded text segment is
+ * written. The entry is re-decoded from the updated memory contents, the fused
+ * sequences that it may belong to are recomputed, and any translated basic
+ * blocks are discarded. Addresses outside of the predecoded text segment are
+ * ignored.
+ **/
+void decode_cache_invalidate(cpu_state_t *cpu_state, uint32_t addr)
+{
+    uint32_t word_addr = addr & ~(uint32_t)(sizeof(uint32_t) - 1);
+    decode_cache_t *cache = cpu_state->decode_cache;
+    if (decode_cache_lookup(cache, word_addr) == NULL) {
+        return;
+    }
+
+    uint32_t index = (word_addr - cache->base_addr) / sizeof(uint32_t);
+    decode_instruction(mem_fetch32(cpu_state, word_addr),
+            &cache->entries[index]);
+    uint32_t first = (index >= FUSION_MAX_LEN - 1) ?
+            index - (FUSION_MAX_LEN - 1) : 0;
+    fuse_instructions(cache, first, index);
+    block_table_invalidate(cache);
+    cache->modified = true;
+    return;
+}
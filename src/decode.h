@@ -0,0 +1,153 @@
+/**
+ * decode.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the instruction decoder and the
+ * predecoded form of the user text segment.
+ *
+ * Each instruction word is decoded once into a decoded_instr_t, which holds the
+ * handler that carries out the instruction along with its register operands
+ * and its sign-extended immediate. The decode cache holds one such entry for
+ * every word in the text segment, indexed by (pc - base_addr) / 4. The decoder
+ * specializes instructions whose operands make them simpler, so that writes to
+ * x0 become no-ops, computations on x0 alone become immediate moves, and
+ * branches that compare a register with itself become a jump or a no-op.
+ * Entries that start a common multi-instruction sequence are also marked with
+ * the fused operation that carries out the whole sequence at once.
+ **/
+
+#ifndef DECODE_H_
+#define DECODE_H_
+
+// Standard Includes
+#include <stdbool.h>            // Boolean type and definitions
+#include <stddef.h>             // Definition of NULL
+#include <stdint.h>             // Fixed-size integral types
+
+// 18-447 Simulator Includes
+#include <sim.h>                // Definition of cpu_state_t
+
+// Local Includes
+#include "isa_table.h"          // The table of instructions in the ISA
+
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+/* The operations that an instruction word can be decoded to, which are one for
+ * each instruction in the ISA table, followed by the operations that the
+ * decoder specializes instructions to when their operands allow it. */
+typedef enum instr_op {
+#define X(NAME, name, format, opcode, funct3, funct7, action) INSTR_##NAME,
+    RV32I_OPS(X)
+#undef X
+
+    // System instructions
+    INSTR_ECALL,
+
+    // Specialized operations: no-ops, immediate moves, and unconditional jumps
+    INSTR_NOP, INSTR_LI, INSTR_JUMP,
+
+    // Instruction words that could not be decoded
+    INSTR_UNKNOWN_OPCODE, INSTR_UNKNOWN_FUNCT3, INSTR_UNKNOWN_FUNCT7,
+    INSTR_UNKNOWN_FUNCT12,
+
+    // The number of operations, not an actual operation
+    INSTR_NUM_OPS,
+} instr_op_t;
+
+/* The common instruction sequences that the decoder fuses into a single
+ * operation. The fused operation is recorded on the first instruction of the
+ * sequence, and the instructions that follow it keep their own entries, so that
+ * the program can still jump into the middle of a sequence. */
+typedef enum instr_fusion {
+    FUSION_NONE,                // The instruction starts no fused sequence
+    FUSION_LUI_ADDI,            // lui rd, hi; addi rd2, rd, lo
+    FUSION_AUIPC_JALR,          // auipc rd, hi; jalr rd2, lo(rd)
+    FUSION_SLT_BRANCH,          // slt[u] rd, rs1, rs2; beq/bne rd, x0, target
+    FUSION_SP_STORES,           // addi sp, sp, -N; followed by sw ..., M(sp)
+} instr_fusion_t;
+
+/* Determines if a fused sequence can start with the given operation. This is
+ * a constant for a constant operation, so that engines can skip the check. */
+static inline bool fusion_can_start(instr_op_t op)
+{
+    return op == INSTR_LUI || op == INSTR_AUIPC || op == INSTR_SLT ||
+            op == INSTR_SLTU || op == INSTR_ADDI;
+}
+
+// The maximum number of stores that are fused into a function prologue
+#define FUSION_MAX_STORES       8
+
+// The maximum number of instructions in any fused sequence
+#define FUSION_MAX_LEN          (1 + FUSION_MAX_STORES)
+
+// Forward declaration of the decoded instruction struct
+struct decoded_instr;
+
+// A function that carries out the actions of a decoded instruction
+typedef void (*instr_handler_t)(cpu_state_t *cpu_state,
+        const struct decoded_instr *instr);
+
+// The representation of a single predecoded instruction
+typedef struct decoded_instr {
+    instr_handler_t handler;    // Handler that executes the instruction
+    instr_op_t op;              // Operation the instruction was decoded to
+    uint32_t instr;             // Raw instruction word, for error messages
+    int32_t imm;                // Sign-extended immediate value
+    uint8_t rd;                 // Destination register
+    uint8_t rs1;                // First source register
+    uint8_t rs2;                // Second source register
+    uint8_t fusion;             // Fused sequence starting here (instr_fusion_t)
+    uint8_t fused_len;          // Number of instructions in the fused sequence
+} decoded_instr_t;
+
+// Forward declarations of the translated forms of a text segment
+struct block_table;
+struct aot_program;
+
+// The predecoded form of a text segment
+typedef struct decode_cache {
+    uint32_t base_addr;         // Base address of the predecoded segment
+    uint32_t num_entries;       // Number of instruction words in the segment
+    struct block_table *blocks; // Translated basic blocks, built on demand
+    struct aot_program *aot;    // Ahead-of-time translation, loaded on demand
+    bool modified;              // The text has been written since it was loaded
+    decoded_instr_t entries[];  // Predecoded entry for each instruction word
+} decode_cache_t;
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Decodes the given instruction word, filling in the decoded instruction.
+ *
+ * Instructions that are unknown or unimplemented are decoded to a handler that
+ * reports the error and halts the processor when it is executed.
+ **/
+void decode_instruction(uint32_t instr, decoded_instr_t *decoded);
+
+/**
+ * Looks up the predecoded entry for the instruction at the given address.
+ *
+ * Returns NULL if the address is misaligned or lies outside the predecoded text
+ * segment, in which case the instruction must be fetched and decoded directly.
+ **/
+static inline const decoded_instr_t *decode_cache_lookup(
+        const decode_cache_t *cache, uint32_t addr)
+{
+    if (cache == NULL || addr % sizeof(uint32_t) != 0) {
+        return NULL;
+    }
+
+    // The subtraction wraps around for addresses below the base address
+    uint32_t index = (addr - cache->base_addr) / sizeof(uint32_t);
+    return (index < cache->num_entries) ? &cache->entries[index] : NULL;
+}
+
+#endif /* DECODE_H_ */
@@ -0,0 +1,268 @@
+/**
+ * instructions.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the handlers for the instructions in the RV32I base ISA.
+ *
+ * Each handler carries out the actions for a single decoded instruction. The
+ * operands of the instruction are already extracted and sign-extended by the
+ * decoder, so the handlers only read the register file and memory, compute the
+ * result, and update the PC. The handlers for the RV32I instructions are
+ * generated from the ISA table.
+ **/
+
+// Standard Includes
+#include <stdio.h>              // Printf and related functions
+#include <stdbool.h>            // Boolean type and definitions
+#include <stdint.h>             // Fixed-size integral types
+
+// 18-447 Simulator Includes
+#include <riscv_isa.h>          // Definition of RISC-V opcodes, ISA registers
+#include <riscv_abi.h>          // ABI registers and definitions
+#include <sim.h>                // Definitions for the simulator
+#include <memory.h>             // Interface to the processor memory
+#include <register_file.h>      // Interface to the register file
+
+// Local Includes
+#include "decode.h"             // Definition of decoded_instr_t
+#include "isa_table.h"          // The table of instructions in the ISA
+#include "instructions.h"       // This file's interface
+
+/*----------------------------------------------------------------------------
+ * Shared Helper Functions
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Writes the result of an instruction to its destination register, and moves
+ * the PC to the next sequential instruction.
+ *
+ * The decoder turns instructions that write x0 into no-ops, so the destination
+ * register is never x0 here, and it is written without checking.
+ **/
+static void write_result(cpu_state_t *cpu_state, const decoded_instr_t *instr,
+        uint32_t value)
+{
+    cpu_state->registers[instr->rd] = value;
+    cpu_state->pc += sizeof(uint32_t);
+    return;
+}
+
+/**
+ * Computes the effective address for a load or store instruction.
+ **/
+static uint32_t effective_addr(const cpu_state_t *cpu_state,
+        const decoded_instr_t *instr)
+{
+    return cpu_state->registers[instr->rs1] + instr->imm;
+}
+
+/**
+ * Reads size bytes (1, 2, or 4) from the given address, zero-extended. On a
+ * misaligned or invalid address, the processor is halted.
+ **/
+static uint32_t load_value(cpu_state_t *cpu_state, uint32_t addr,
+        uint32_t size)
+{
+    switch (size)
+    {
+        case sizeof(uint8_t):
+            return mem_read8(cpu_state, addr);
+
+        case sizeof(uint16_t):
+            return mem_read16(cpu_state, addr);
+
+        default:
+            return mem_read32(cpu_state, addr);
+    }
+}
+
+/**
+ * Writes the low size bytes (1, 2, or 4) of the value to the given address. On
+ * a misaligned or invalid address, the processor is halted.
+ **/
+static void store_value(cpu_state_t *cpu_state, uint32_t addr, uint32_t size,
+        uint32_t value)
+{
+    switch (size)
+    {
+        case sizeof(uint8_t):
+            mem_write8(cpu_state, addr, value);
+            break;
+
+        case sizeof(uint16_t):
+            mem_write16(cpu_state, addr, value);
+            break;
+
+        default:
+            mem_write32(cpu_state, addr, value);
+            break;
+    }
+
+    return;
+}
+
+/**
+ * Moves the PC to the branch target if the branch is taken, otherwise to the
+ * next sequential instruction.
+ **/
+static void branch(cpu_state_t *cpu_state, const decoded_instr_t *instr,
+        bool taken)
+{
+    cpu_state->pc += taken ? (uint32_t)instr->imm : sizeof(uint32_t);
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * RV32I Instructions
+ *----------------------------------------------------------------------------*/
+
+// The operands of the instruction, as the ISA table refers to them
+#define RS1     (cpu_state->registers[instr->rs1])
+#define RS2     (cpu_state->registers[instr->rs2])
+#define IMM     ((uint32_t)instr->imm)
+#define PC      (cpu_state->pc)
+#define VALUE   loaded
+
+// Computations, which write their result to rd
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+    void exec_##name(cpu_state_t *cpu_state, const decoded_instr_t *instr) \
+    { \
+        write_result(cpu_state, instr, (action)); \
+    }
+RV32I_ALU_OPS(X)
+#undef X
+
+/* Loads and stores, which halt the processor without updating the PC on an
+ * invalid address. Loads may still write x0, so they check the register. */
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+    void exec_##name(cpu_state_t *cpu_state, const decoded_instr_t *instr) \
+    { \
+        uint32_t loaded = load_value(cpu_state, \
+                effective_addr(cpu_state, instr), ISA_ACCESS_SIZE(funct3)); \
+        if (!cpu_state->halted) { \
+            register_write(cpu_state, instr->rd, (action)); \
+            cpu_state->pc += sizeof(uint32_t); \
+        } \
+    }
+RV32I_LOAD_OPS(X)
+#undef X
+
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+    void exec_##name(cpu_state_t *cpu_state, const decoded_instr_t *instr) \
+    { \
+        store_value(cpu_state, effective_addr(cpu_state, instr), \
+                ISA_ACCESS_SIZE(funct3), (action)); \
+        if (!cpu_state->halted) { \
+            cpu_state->pc += sizeof(uint32_t); \
+        } \
+    }
+RV32I_STORE_OPS(X)
+#undef X
+
+// The target must be computed before rd is written, in case rd == rs1
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+    void exec_##name(cpu_state_t *cpu_state, const decoded_instr_t *instr) \
+    { \
+        uint32_t return_addr = cpu_state->pc + sizeof(uint32_t); \
+        cpu_state->pc = (action); \
+        register_write(cpu_state, instr->rd, return_addr); \
+    }
+RV32I_JUMP_OPS(X)
+#undef X
+
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+    void exec_##name(cpu_state_t *cpu_state, const decoded_instr_t *instr) \
+    { \
+        branch(cpu_state, instr, (action)); \
+    }
+RV32I_BRANCH_OPS(X)
+#undef X
+
+#undef RS1
+#undef RS2
+#undef IMM
+#undef PC
+#undef VALUE
+
+/*----------------------------------------------------------------------------
+ * System Instructions
+ *----------------------------------------------------------------------------*/
+
+void exec_ecall(cpu_state_t *cpu_state, const decoded_instr_t *instr)
+{
+    (void)instr;
+
+    // The only supported system call is halt, all other values are ignored
+    if (register_read(cpu_state, (riscv_isa_reg_t)REG_A0) ==
+            ECALL_ARG_HALT) {
+        fprintf(stdout, "ECALL invoked with halt argument, halting the "
+                "simulator.\n");
+        cpu_state->halted = true;
+        cpu_state->halt_reason = SIM_HALT_ECALL;
+        return;
+    }
+
+    cpu_state->pc += sizeof(uint32_t);
+}
+
+/*----------------------------------------------------------------------------
+ * Specialized Operations
+ *----------------------------------------------------------------------------*/
+
+void exec_nop(cpu_state_t *cpu_state, const decoded_instr_t *instr)
+{
+    (void)instr;
+    cpu_state->pc += sizeof(uint32_t);
+}
+
+void exec_li(cpu_state_t *cpu_state, const decoded_instr_t *instr)
+{
+    write_result(cpu_state, instr, instr->imm);
+}
+
+void exec_jump(cpu_state_t *cpu_state, const decoded_instr_t *instr)
+{
+    cpu_state->pc += instr->imm;
+}
+
+/*----------------------------------------------------------------------------
+ * Undecodable Instructions
+ *----------------------------------------------------------------------------*/
+
+void exec_unknown_opcode(cpu_state_t *cpu_state, const decoded_instr_t *instr)
+{
+    fprintf(stderr, "Encountered unknown opcode 0x%02x. Halting "
+            "simulation.\n", instr->instr & 0x7F);
+    cpu_state->halted = true;
+    cpu_state->halt_reason = SIM_HALT_ERROR;
+}
+
+void exec_unknown_funct3(cpu_state_t *cpu_state, const decoded_instr_t *instr)
+{
+    fprintf(stderr, "Encountered unknown/unimplemented 3-bit function code "
+            "0x%01x for opcode 0x%02x. Halting simulation.\n",
+            (instr->instr >> 12) & 0x7, instr->instr & 0x7F);
+    cpu_state->halted = true;
+    cpu_state->halt_reason = SIM_HALT_ERROR;
+}
+
+void exec_unknown_funct7(cpu_state_t *cpu_state, const decoded_instr_t *instr)
+{
+    fprintf(stderr, "Encountered unknown/unimplemented 7-bit function code "
+            "0x%02x. Halting simulation.\n", (instr->instr >> 25) & 0x7F);
+    cpu_state->halted = true;
+    cpu_state->halt_reason = SIM_HALT_ERROR;
+}
+
+void exec_unknown_funct12(cpu_state_t *cpu_state,
+        const decoded_instr_t *instr)
+{
+    fprintf(stderr, "Encountered unknown/unimplemented 12-bit system function "
+            "code 0x%03x. Halting simulation.\n", (instr->instr >> 20) & 0xFFF);
+    cpu_state->halted = true;
+    cpu_state->halt_reason = SIM_HALT_ERROR;
+}
@@ -0,0 +1,62 @@
+/**
+ * instructions.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the instruction handlers.
+ *
+ * There is one handler for each instruction in the RV32I base ISA, which are
+ * generated from the ISA table, along with handlers for the operations that
+ * the decoder specializes instructions to, and for instructions that could not
+ * be decoded. Each handler carries out the actions for a decoded instruction,
+ * updating the register file, memory, and PC register appropriately.
+ **/
+
+#ifndef INSTRUCTIONS_H_
+#define INSTRUCTIONS_H_
+
+// 18-447 Simulator Includes
+#include <sim.h>                // Definition of cpu_state_t
+
+// Local Includes
+#include "decode.h"             // Definition of decoded_instr_t
+#include "isa_table.h"          // The table of instructions in the ISA
+
+/*----------------------------------------------------------------------------
+ * RV32I Instructions
+ *----------------------------------------------------------------------------*/
+
+// The handlers for the instructions in the ISA table, such as exec_add
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+    void exec_##name(cpu_state_t *cpu_state, const decoded_instr_t *instr);
+RV32I_OPS(X)
+#undef X
+
+/*----------------------------------------------------------------------------
+ * System Instructions
+ *----------------------------------------------------------------------------*/
+
+void exec_ecall(cpu_state_t *cpu_state, const decoded_instr_t *instr);
+
+/*----------------------------------------------------------------------------
+ * Specialized Operations
+ *----------------------------------------------------------------------------*/
+
+void exec_nop(cpu_state_t *cpu_state, const decoded_instr_t *instr);
+void exec_li(cpu_state_t *cpu_state, const decoded_instr_t *instr);
+void exec_jump(cpu_state_t *cpu_state, const decoded_instr_t *instr);
+
+/*----------------------------------------------------------------------------
+ * Undecodable Instructions
+ *----------------------------------------------------------------------------*/
+
+void exec_unknown_opcode(cpu_state_t *cpu_state, const decoded_instr_t *instr);
+void exec_unknown_funct3(cpu_state_t *cpu_state, const decoded_instr_t *instr);
+void exec_unknown_funct7(cpu_state_t *cpu_state, const decoded_instr_t *instr);
+void exec_unknown_funct12(cpu_state_t *cpu_state,
+        const decoded_instr_t *instr);
+
+#endif /* INSTRUCTIONS_H_ */
@@ -0,0 +1,147 @@
+/**
+ * isa_table.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the table that describes the RV32I base ISA, which is the
+ * single source from which the decoder, the instruction handlers, and the
+ * execution engines are generated.
+ *
+ * Each list below is an X-macro, which invokes the given macro once for every
+ * instruction in it, as X(NAME, name, format, opcode, funct3, funct7, action).
+ * The encoding is given in terms of the opcode and function code enums in
+ * riscv_isa.h, with ISA_ANY for the fields that the instruction does not use.
+ * The format is the instruction format, which selects how the immediate is
+ * decoded, with shamt for the shifts by an immediate. The action is a C
+ * expression, whose meaning depends on the list, written in terms of the
+ * operand macros RS1, RS2, IMM, PC, and VALUE. Each user of the table defines
+ * these to read the operands in its own way, and all of them are uint32_t.
+ **/
+
+#ifndef ISA_TABLE_H_
+#define ISA_TABLE_H_
+
+// 18-447 Simulator Includes
+#include <riscv_isa.h>          // Definition of RISC-V opcodes and functions
+
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+// Marks a function code field that is not part of an instruction's encoding
+#define ISA_ANY                 0xFF
+
+/* The access size in bytes of a load or store, which the low two bits of its
+ * 3-bit function code encode as a power of two. */
+#define ISA_ACCESS_SIZE(funct3) (1U << ((funct3) & 0x3))
+
+/*----------------------------------------------------------------------------
+ * Instruction Lists
+ *----------------------------------------------------------------------------*/
+
+/* Instructions that compute a value from registers and immediates and write it
+ * to rd. The action is the value written to rd. */
+#define RV32I_ALU_OPS(X) \
+    X(ADD,   add,   rtype,  OP_OP,    FUNCT3_ADD_SUB,   FUNCT7_INT, \
+            RS1 + RS2) \
+    X(SUB,   sub,   rtype,  OP_OP,    FUNCT3_ADD_SUB,   FUNCT7_ALT_INT, \
+            RS1 - RS2) \
+    X(SLL,   sll,   rtype,  OP_OP,    FUNCT3_SLL,       FUNCT7_INT, \
+            RS1 << (RS2 & 0x1F)) \
+    X(SLT,   slt,   rtype,  OP_OP,    FUNCT3_SLT,       FUNCT7_INT, \
+            (int32_t)RS1 < (int32_t)RS2) \
+    X(SLTU,  sltu,  rtype,  OP_OP,    FUNCT3_SLTU,      FUNCT7_INT, \
+            RS1 < RS2) \
+    X(XOR,   xor,   rtype,  OP_OP,    FUNCT3_XOR,       FUNCT7_INT, \
+            RS1 ^ RS2) \
+    X(SRL,   srl,   rtype,  OP_OP,    FUNCT3_SRL_SRA,   FUNCT7_INT, \
+            RS1 >> (RS2 & 0x1F)) \
+    X(SRA,   sra,   rtype,  OP_OP,    FUNCT3_SRL_SRA,   FUNCT7_ALT_INT, \
+            (uint32_t)((int32_t)RS1 >> (RS2 & 0x1F))) \
+    X(OR,    or,    rtype,  OP_OP,    FUNCT3_OR,        FUNCT7_INT, \
+            RS1 | RS2) \
+    X(AND,   and,   rtype,  OP_OP,    FUNCT3_AND,       FUNCT7_INT, \
+            RS1 & RS2) \
+    X(ADDI,  addi,  itype,  OP_IMM,   FUNCT3_ADDI,      ISA_ANY, \
+            RS1 + IMM) \
+    X(SLTI,  slti,  itype,  OP_IMM,   FUNCT3_SLTI,      ISA_ANY, \
+            (int32_t)RS1 < (int32_t)IMM) \
+    X(SLTIU, sltiu, itype,  OP_IMM,   FUNCT3_SLTIU,     ISA_ANY, \
+            RS1 < IMM) \
+    X(XORI,  xori,  itype,  OP_IMM,   FUNCT3_XORI,      ISA_ANY, \
+            RS1 ^ IMM) \
+    X(ORI,   ori,   itype,  OP_IMM,   FUNCT3_ORI,       ISA_ANY, \
+            RS1 | IMM) \
+    X(ANDI,  andi,  itype,  OP_IMM,   FUNCT3_ANDI,      ISA_ANY, \
+            RS1 & IMM) \
+    X(SLLI,  slli,  shamt,  OP_IMM,   FUNCT3_SLLI,      FUNCT7_INT, \
+            RS1 << IMM) \
+    X(SRLI,  srli,  shamt,  OP_IMM,   FUNCT3_SRLI_SRAI, FUNCT7_INT, \
+            RS1 >> IMM) \
+    X(SRAI,  srai,  shamt,  OP_IMM,   FUNCT3_SRLI_SRAI, FUNCT7_ALT_INT, \
+            (uint32_t)((int32_t)RS1 >> IMM)) \
+    X(LUI,   lui,   utype,  OP_LUI,   ISA_ANY,          ISA_ANY, \
+            IMM) \
+    X(AUIPC, auipc, utype,  OP_AUIPC, ISA_ANY,          ISA_ANY, \
+            PC + IMM)
+
+/* Loads, which read ISA_ACCESS_SIZE(funct3) bytes at RS1 + IMM into VALUE,
+ * zero-extended. The action is the value written to rd. */
+#define RV32I_LOAD_OPS(X) \
+    X(LB,    lb,    itype,  OP_LOAD,  FUNCT3_LB,        ISA_ANY, \
+            (uint32_t)(int8_t)VALUE) \
+    X(LH,    lh,    itype,  OP_LOAD,  FUNCT3_LH,        ISA_ANY, \
+            (uint32_t)(int16_t)VALUE) \
+    X(LW,    lw,    itype,  OP_LOAD,  FUNCT3_LW,        ISA_ANY, \
+            VALUE) \
+    X(LBU,   lbu,   itype,  OP_LOAD,  FUNCT3_LBU,       ISA_ANY, \
+            VALUE) \
+    X(LHU,   lhu,   itype,  OP_LOAD,  FUNCT3_LHU,       ISA_ANY, \
+            VALUE)
+
+/* Stores, which write ISA_ACCESS_SIZE(funct3) bytes at RS1 + IMM. The action
+ * is the value written, of which only the low bytes are stored. */
+#define RV32I_STORE_OPS(X) \
+    X(SB,    sb,    stype,  OP_STORE, FUNCT3_SB,        ISA_ANY, \
+            RS2) \
+    X(SH,    sh,    stype,  OP_STORE, FUNCT3_SH,        ISA_ANY, \
+            RS2) \
+    X(SW,    sw,    stype,  OP_STORE, FUNCT3_SW,        ISA_ANY, \
+            RS2)
+
+/* Jumps, which write the address of the next instruction to rd. The action is
+ * the jump target. */
+#define RV32I_JUMP_OPS(X) \
+    X(JAL,   jal,   ujtype, OP_JAL,   ISA_ANY,          ISA_ANY, \
+            PC + IMM) \
+    X(JALR,  jalr,  itype,  OP_JALR,  0x0,              ISA_ANY, \
+            (RS1 + IMM) & ~(uint32_t)1)
+
+/* Conditional branches to PC + IMM. The action is the condition under which
+ * the branch is taken. */
+#define RV32I_BRANCH_OPS(X) \
+    X(BEQ,   beq,   sbtype, OP_BRANCH, FUNCT3_BEQ,      ISA_ANY, \
+            RS1 == RS2) \
+    X(BNE,   bne,   sbtype, OP_BRANCH, FUNCT3_BNE,      ISA_ANY, \
+            RS1 != RS2) \
+    X(BLT,   blt,   sbtype, OP_BRANCH, FUNCT3_BLT,      ISA_ANY, \
+            (int32_t)RS1 < (int32_t)RS2) \
+    X(BGE,   bge,   sbtype, OP_BRANCH, FUNCT3_BGE,      ISA_ANY, \
+            (int32_t)RS1 >= (int32_t)RS2) \
+    X(BLTU,  bltu,  sbtype, OP_BRANCH, FUNCT3_BLTU,     ISA_ANY, \
+            RS1 < RS2) \
+    X(BGEU,  bgeu,  sbtype, OP_BRANCH, FUNCT3_BGEU,     ISA_ANY, \
+            RS1 >= RS2)
+
+// Every instruction in the table
+#define RV32I_OPS(X) \
+    RV32I_ALU_OPS(X) \
+    RV32I_LOAD_OPS(X) \
+    RV32I_STORE_OPS(X) \
+    RV32I_JUMP_OPS(X) \
+    RV32I_BRANCH_OPS(X)
+
+#endif /* ISA_TABLE_H_ */
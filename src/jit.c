@@ -0,0 +1,1080 @@
+/**
+ * jit.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the just-in-time compiler, which translates hot basic
+ * blocks into native x86-64 code, and the engine that runs them.
+ *
+ * Blocks start out running in the basic-block engine. Once a block has run
+ * JIT_HOT_THRESHOLD times, it is compiled into an executable code cache. The
+ * guest registers that a compiled block uses most are held in host registers
+ * while it runs, and written back to the CPU state whenever it leaves the
+ * block or calls into the simulator. Compiled blocks that exit directly to
+ * another compiled block are patched to jump straight to it, so hot loops run
+ * entirely in native code until they leave through an indirect jump, run out
+ * of their instruction budget, or halt.
+ *
+ * The code cache is never writable and executable at once, since some hosts
+ * forbid such mappings. It is only made writable while a block is compiled or
+ * linked into it. If the host does not allow the code cache at all, the blocks
+ * keep running in the basic-block engine.
+ *
+ * The native code for a block has the following signature, and returns the
+ * part of the budget that it did not use:
+ *
+ *      int block(cpu_state_t *cpu_state, int budget);
+ *
+ * On hosts other than x86-64, the JIT engine simply runs the basic-block
+ * engine.
+ **/
+
+// Standard Includes
+#include <stdlib.h>             // Malloc and related functions
+#include <stdio.h>              // Printf and related functions
+#include <stdbool.h>            // Boolean type and definitions
+#include <stddef.h>             // Definition of NULL and offsetof
+#include <stdint.h>             // Fixed-size integral types
+#include <string.h>             // Memcpy and strerror
+#include <errno.h>              // Error codes and perror
+#include <sys/mman.h>           // Mapping the executable code cache
+
+// 18-447 Simulator Includes
+#include <riscv_isa.h>          // The number of RISC-V registers
+#include <sim.h>                // Definitions for the simulator
+#include <memory.h>             // Interface to the processor memory
+
+// Local Includes
+#include "decode.h"             // Predecoded instructions and the decoder
+#include "block.h"              // Translated basic blocks
+#include "jit.h"                // This file's interface
+
+#if defined(__x86_64__)
+
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+// The number of times a block runs before it is compiled to native code
+#define JIT_HOT_THRESHOLD       16
+
+// The size of the executable code cache for a text segment
+#define JIT_CODE_SIZE           (16 << 20)
+
+/* An upper bound on the size of the native code for a block, which is checked
+ * before compiling it into the code cache. */
+#define JIT_MAX_BLOCK_SIZE      (512 + BLOCK_MAX_INSTRS * 384)
+
+/* Indicates that the host did not allow this thread a code cache, in which case
+ * blocks are no longer compiled. */
+static _Thread_local bool jit_unavailable = false;
+
+// The native code cache for the compiled blocks of a text segment
+typedef struct jit_code {
+    uint8_t *base;              // Start of the executable mapping
+    size_t used;                // Number of bytes of the mapping in use
+    uint8_t *epilogue;          // Shared sequence that returns to the engine
+    uint8_t *last_link;         // Unlinked direct exit that was last taken
+} jit_code_t;
+
+// The x86-64 registers, numbered as in their instruction encodings
+typedef enum host_reg {
+    RAX, RCX, RDX, RBX, RSP, RBP, RSI, RDI,
+    R8, R9, R10, R11, R12, R13, R14, R15,
+} host_reg_t;
+
+/* The callee-saved host registers that hold guest registers. Register rbx is
+ * also callee-saved, and always holds the CPU state. */
+static const host_reg_t GUEST_HOST_REGS[] = { RBP, R12, R13, R14, R15 };
+
+// The number of guest registers held in host registers by a block
+#define JIT_NUM_HOST_REGS \
+    ((int)(sizeof(GUEST_HOST_REGS) / sizeof(GUEST_HOST_REGS[0])))
+
+// The x86-64 condition codes used by the compiled code
+typedef enum host_cond {
+    COND_B = 0x2, COND_AE = 0x3, COND_E = 0x4, COND_NE = 0x5,
+    COND_L = 0xC, COND_GE = 0xD,
+} host_cond_t;
+
+// The x86-64 group 1 arithmetic operations, encoded in the ModRM reg field
+typedef enum host_alu {
+    ALU_ADD = 0, ALU_OR = 1, ALU_AND = 4, ALU_SUB = 5, ALU_XOR = 6,
+    ALU_CMP = 7,
+} host_alu_t;
+
+// The x86-64 shift operations, encoded in the ModRM reg field
+typedef enum host_shift {
+    SHIFT_SHL = 4, SHIFT_SHR = 5, SHIFT_SAR = 7,
+} host_shift_t;
+
+// The guest register operands that an operation reads and writes
+typedef enum op_operands {
+    USES_RD     = 1 << 0,
+    USES_RS1    = 1 << 1,
+    USES_RS2    = 1 << 2,
+} op_operands_t;
+
+// The state for compiling a single block
+typedef struct jit_compiler {
+    jit_code_t *code;           // The code cache being compiled into
+    decode_cache_t *cache;      // The predecoded segment the block is from
+    const block_t *block;       // The block being compiled
+    uint8_t *pos;               // Next byte of native code to emit
+    int8_t host_reg[RISCV_NUM_REGS];    // Host register for each guest, or -1
+    uint32_t dirty;             // Guest registers in host registers written
+} jit_compiler_t;
+
+/*----------------------------------------------------------------------------
+ * Code Cache
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Unmaps the given native code cache, discarding the code for every block
+ * compiled into it. The code cache may be NULL, in which case nothing happens.
+ **/
+void jit_code_free(jit_code_t *code)
+{
+    if (code == NULL) {
+        return;
+    }
+
+    munmap(code->base, JIT_CODE_SIZE);
+    free(code);
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * Instruction Encoding
+ *----------------------------------------------------------------------------*/
+
+// Emits a byte, or a 32-bit or 64-bit little-endian value, of native code
+static void emit8(jit_compiler_t *jit, uint8_t byte)
+{
+    *jit->pos++ = byte;
+    return;
+}
+
+static void emit32(jit_compiler_t *jit, uint32_t value)
+{
+    memcpy(jit->pos, &value, sizeof(value));
+    jit->pos += sizeof(value);
+    return;
+}
+
+static void emit64(jit_compiler_t *jit, uint64_t value)
+{
+    memcpy(jit->pos, &value, sizeof(value));
+    jit->pos += sizeof(value);
+    return;
+}
+
+/**
+ * Points the 32-bit relative displacement at the given location to the target,
+ * which is how jumps are linked once their target is known.
+ **/
+static void patch_rel32(uint8_t *rel32, const uint8_t *target)
+{
+    int32_t offset = (int32_t)(target - (rel32 + sizeof(int32_t)));
+    memcpy(rel32, &offset, sizeof(offset));
+    return;
+}
+
+// Emits the REX prefix for a 32-bit operation, if any extended register is used
+static void emit_rex(jit_compiler_t *jit, int reg, int rm)
+{
+    if (reg >= R8 || rm >= R8) {
+        emit8(jit, 0x40 | ((reg >> 3) << 2) | (rm >> 3));
+    }
+    return;
+}
+
+// Emits a 32-bit operation between the registers in the ModRM reg and rm fields
+static void emit_op_rr(jit_compiler_t *jit, uint8_t opcode, int reg, int rm)
+{
+    emit_rex(jit, reg, rm);
+    emit8(jit, opcode);
+    emit8(jit, 0xC0 | ((reg & 7) << 3) | (rm & 7));
+    return;
+}
+
+// Emits a 32-bit operation between a register and a field of the CPU state
+static void emit_op_state(jit_compiler_t *jit, uint8_t opcode, int reg,
+        size_t offset)
+{
+    emit_rex(jit, reg, RBX);
+    emit8(jit, opcode);
+    emit8(jit, 0x80 | ((reg & 7) << 3) | RBX);
+    emit32(jit, (uint32_t)offset);
+    return;
+}
+
+// mov dst, imm32
+static void emit_mov_imm(jit_compiler_t *jit, host_reg_t dst, uint32_t imm)
+{
+    emit_rex(jit, 0, dst);
+    emit8(jit, 0xB8 | (dst & 7));
+    emit32(jit, imm);
+    return;
+}
+
+// mov dst, imm64
+static void emit_mov_imm64(jit_compiler_t *jit, host_reg_t dst, uint64_t imm)
+{
+    emit8(jit, 0x48 | (dst >> 3));
+    emit8(jit, 0xB8 | (dst & 7));
+    emit64(jit, imm);
+    return;
+}
+
+// <alu> dst, imm32
+static void emit_alu_imm(jit_compiler_t *jit, host_alu_t alu, host_reg_t dst,
+        uint32_t imm)
+{
+    emit_rex(jit, 0, dst);
+    emit8(jit, 0x81);
+    emit8(jit, 0xC0 | (alu << 3) | (dst & 7));
+    emit32(jit, imm);
+    return;
+}
+
+// <shift> dst, imm8
+static void emit_shift_imm(jit_compiler_t *jit, host_shift_t shift,
+        host_reg_t dst, uint8_t imm)
+{
+    emit_rex(jit, 0, dst);
+    emit8(jit, 0xC1);
+    emit8(jit, 0xC0 | (shift << 3) | (dst & 7));
+    emit8(jit, imm);
+    return;
+}
+
+// <shift> dst, cl
+static void emit_shift_cl(jit_compiler_t *jit, host_shift_t shift,
+        host_reg_t dst)
+{
+    emit_rex(jit, 0, dst);
+    emit8(jit, 0xD3);
+    emit8(jit, 0xC0 | (shift << 3) | (dst & 7));
+    return;
+}
+
+// set<cond> al; movzx eax, al
+static void emit_setcc_eax(jit_compiler_t *jit, host_cond_t cond)
+{
+    emit8(jit, 0x0F);
+    emit8(jit, 0x90 | cond);
+    emit8(jit, 0xC0);
+    emit8(jit, 0x0F);
+    emit8(jit, 0xB6);
+    emit8(jit, 0xC0);
+    return;
+}
+
+// j<cond> rel32, returning the displacement so that it can be patched
+static uint8_t *emit_jcc(jit_compiler_t *jit, host_cond_t cond)
+{
+    emit8(jit, 0x0F);
+    emit8(jit, 0x80 | cond);
+    uint8_t *rel32 = jit->pos;
+    emit32(jit, 0);
+    return rel32;
+}
+
+// jmp rel32, returning the displacement so that it can be patched
+static uint8_t *emit_jmp(jit_compiler_t *jit)
+{
+    emit8(jit, 0xE9);
+    uint8_t *rel32 = jit->pos;
+    emit32(jit, 0);
+    return rel32;
+}
+
+// mov rax, <function>; call rax
+static void emit_call(jit_compiler_t *jit, uintptr_t function)
+{
+    emit_mov_imm64(jit, RAX, function);
+    emit8(jit, 0xFF);
+    emit8(jit, 0xD0);
+    return;
+}
+
+// mov rdi, rbx, which passes the CPU state as the first argument
+static void emit_cpu_state_arg(jit_compiler_t *jit)
+{
+    emit8(jit, 0x48);
+    emit8(jit, 0x89);
+    emit8(jit, 0xDF);
+    return;
+}
+
+// mov dword [rbx + offsetof(pc)], imm32
+static void emit_set_pc(jit_compiler_t *jit, uint32_t pc)
+{
+    emit8(jit, 0xC7);
+    emit8(jit, 0x83);
+    emit32(jit, offsetof(cpu_state_t, pc));
+    emit32(jit, pc);
+    return;
+}
+
+// <alu> dword [rsp], imm32, which updates the remaining instruction budget
+static void emit_budget_op(jit_compiler_t *jit, host_alu_t alu, uint32_t imm)
+{
+    emit8(jit, 0x81);
+    emit8(jit, 0x04 | (alu << 3));
+    emit8(jit, 0x24);
+    emit32(jit, imm);
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * Guest Registers
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Determines which guest register operands the given operation uses in the
+ * compiled code. Operations carried out by their handlers access the guest
+ * registers through the CPU state, so they have no operands here.
+ **/
+static op_operands_t op_operands(instr_op_t op)
+{
+    switch (op)
+    {
+        case INSTR_ADD: case INSTR_SUB: case INSTR_SLL: case INSTR_SLT:
+        case INSTR_SLTU: case INSTR_XOR: case INSTR_SRL: case INSTR_SRA:
+        case INSTR_OR: case INSTR_AND:
+            return USES_RD | USES_RS1 | USES_RS2;
+
+        case INSTR_ADDI: case INSTR_SLTI: case INSTR_SLTIU: case INSTR_XORI:
+        case INSTR_ORI: case INSTR_ANDI: case INSTR_SLLI: case INSTR_SRLI:
+        case INSTR_SRAI: case INSTR_LW: case INSTR_JALR:
+            return USES_RD | USES_RS1;
+
+        case INSTR_SW: case INSTR_BEQ: case INSTR_BNE: case INSTR_BLT:
+        case INSTR_BGE: case INSTR_BLTU: case INSTR_BGEU:
+            return USES_RS1 | USES_RS2;
+
+        case INSTR_LUI: case INSTR_AUIPC: case INSTR_JAL: case INSTR_LI:
+            return USES_RD;
+
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Chooses which guest registers to hold in host registers for the block, which
+ * are the ones that its operations use most often.
+ **/
+static void allocate_host_regs(jit_compiler_t *jit)
+{
+    int uses[RISCV_NUM_REGS] = { 0 };
+    for (uint32_t i = 0; i < jit->block->num_instrs; i++)
+    {
+        const block_op_t *op = &jit->block->ops[i];
+        op_operands_t operands = op_operands(op->op);
+        uses[op->rd] += (operands & USES_RD) ? 1 : 0;
+        uses[op->rs1] += (operands & USES_RS1) ? 1 : 0;
+        uses[op->rs2] += (operands & USES_RS2) ? 1 : 0;
+    }
+
+    // Register x0 is always 0, so it is never held in a host register
+    for (int reg = 0; reg < RISCV_NUM_REGS; reg++)
+    {
+        jit->host_reg[reg] = -1;
+    }
+    uses[0] = 0;
+
+    // A guest register used only once gains nothing from a host register
+    for (int i = 0; i < JIT_NUM_HOST_REGS; i++)
+    {
+        int best = 0;
+        for (int reg = 1; reg < RISCV_NUM_REGS; reg++)
+        {
+            best = (uses[reg] > uses[best]) ? reg : best;
+        }
+        if (uses[best] < 2) {
+            break;
+        }
+        jit->host_reg[best] = GUEST_HOST_REGS[i];
+        uses[best] = 0;
+    }
+
+    // Track which of the held registers the block writes
+    jit->dirty = 0;
+    for (uint32_t i = 0; i < jit->block->num_instrs; i++)
+    {
+        const block_op_t *op = &jit->block->ops[i];
+        if ((op_operands(op->op) & USES_RD) && jit->host_reg[op->rd] >= 0) {
+            jit->dirty |= 1u << op->rd;
+        }
+    }
+    return;
+}
+
+// The offset of the given guest register in the CPU state
+static size_t guest_offset(int reg)
+{
+    return offsetof(cpu_state_t, registers) + reg * sizeof(uint32_t);
+}
+
+// Loads the value of the given guest register into a scratch host register
+static void load_guest(jit_compiler_t *jit, host_reg_t dst, int reg)
+{
+    if (reg == 0) {
+        emit_op_rr(jit, 0x31, dst, dst);
+    } else if (jit->host_reg[reg] >= 0) {
+        emit_op_rr(jit, 0x89, jit->host_reg[reg], dst);
+    } else {
+        emit_op_state(jit, 0x8B, dst, guest_offset(reg));
+    }
+    return;
+}
+
+// Stores a scratch host register into the given guest register
+static void store_guest(jit_compiler_t *jit, int reg, host_reg_t src)
+{
+    if (reg == 0) {
+        return;
+    } else if (jit->host_reg[reg] >= 0) {
+        emit_op_rr(jit, 0x89, src, jit->host_reg[reg]);
+    } else {
+        emit_op_state(jit, 0x89, src, guest_offset(reg));
+    }
+    return;
+}
+
+// Writes the held guest registers that the block modifies to the CPU state
+static void write_back_guests(jit_compiler_t *jit)
+{
+    for (int reg = 1; reg < RISCV_NUM_REGS; reg++)
+    {
+        if (jit->dirty & (1u << reg)) {
+            emit_op_state(jit, 0x89, jit->host_reg[reg], guest_offset(reg));
+        }
+    }
+    return;
+}
+
+// Reloads all of the held guest registers from the CPU state
+static void reload_guests(jit_compiler_t *jit)
+{
+    for (int reg = 1; reg < RISCV_NUM_REGS; reg++)
+    {
+        if (jit->host_reg[reg] >= 0) {
+            emit_op_state(jit, 0x8B, jit->host_reg[reg], guest_offset(reg));
+        }
+    }
+    return;
+}
+
+/**
+ * Makes the code cache writable, so that code can be compiled or linked into
+ * it, or makes it executable again, so that its code can run. Returns a
+ * negative error code on failure.
+ **/
+static int jit_code_protect(jit_code_t *code, bool writable)
+{
+    int prot = writable ? (PROT_READ | PROT_WRITE) : (PROT_READ | PROT_EXEC);
+    return (mprotect(code->base, JIT_CODE_SIZE, prot) < 0) ? -errno : 0;
+}
+
+/**
+ * Stops compiling blocks on this thread, after the code cache for the given
+ * block table could not be mapped or protected, printing a warning with the
+ * given error code. The block table is marked as stale, so that the blocks
+ * compiled into the code cache are discarded, and run in the basic-block
+ * engine instead.
+ **/
+static void jit_disable(block_table_t *table, int error)
+{
+    fprintf(stderr, "Warning: The host does not allow a JIT code cache: %s. "
+            "Running blocks in the basic-block engine instead.\n",
+            strerror(error));
+    jit_unavailable = true;
+    table->stale = true;
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * Block Exits
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Emits a direct exit to the given guest address. The exit initially returns
+ * to the engine, recording itself as the last exit taken, so that the engine
+ * can link it straight to the target block once that block is compiled.
+ **/
+static void emit_direct_exit(jit_compiler_t *jit, uint32_t target)
+{
+    write_back_guests(jit);
+
+    // The jump initially falls through to the code that returns to the engine
+    uint8_t *link = emit_jmp(jit);
+    emit_set_pc(jit, target);
+    emit_mov_imm64(jit, RAX, (uintptr_t)&jit->code->last_link);
+    emit_mov_imm64(jit, RCX, (uintptr_t)link);
+    emit8(jit, 0x48);               // mov [rax], rcx
+    emit8(jit, 0x89);
+    emit8(jit, 0x08);
+    patch_rel32(emit_jmp(jit), jit->code->epilogue);
+    return;
+}
+
+/**
+ * Emits an indirect exit to the guest address in eax, which has already been
+ * stored to the PC. If the block at the address has been compiled, the exit
+ * jumps straight to it, otherwise it returns to the engine.
+ **/
+static void emit_indirect_exit(jit_compiler_t *jit)
+{
+    uint8_t *to_engine[4];
+
+    // ecx = addr - base_addr, which must be an aligned offset into the segment
+    emit_op_rr(jit, 0x89, RAX, RCX);
+    emit_alu_imm(jit, ALU_SUB, RCX, jit->cache->base_addr);
+    emit_alu_imm(jit, ALU_CMP, RCX, jit->cache->num_entries *
+            sizeof(uint32_t));
+    to_engine[0] = emit_jcc(jit, COND_AE);
+    emit8(jit, 0xF7);               // test ecx, 3
+    emit8(jit, 0xC1);
+    emit32(jit, sizeof(uint32_t) - 1);
+    to_engine[1] = emit_jcc(jit, COND_NE);
+
+    // rdx = blocks[ecx / 4], scaling the byte offset to the size of a pointer
+    emit_mov_imm64(jit, RDX, (uintptr_t)jit->cache->blocks->blocks);
+    emit8(jit, 0x48);               // mov rdx, [rdx + rcx * 2]
+    emit8(jit, 0x8B);
+    emit8(jit, 0x14);
+    emit8(jit, 0x4A);
+    emit8(jit, 0x48);               // test rdx, rdx
+    emit8(jit, 0x85);
+    emit8(jit, 0xD2);
+    to_engine[2] = emit_jcc(jit, COND_E);
+
+    // rdx = block->native_body, which is NULL if the block is not compiled
+    emit8(jit, 0x48);               // mov rdx, [rdx + offsetof(native_body)]
+    emit8(jit, 0x8B);
+    emit8(jit, 0x92);
+    emit32(jit, offsetof(block_t, native_body));
+    emit8(jit, 0x48);               // test rdx, rdx
+    emit8(jit, 0x85);
+    emit8(jit, 0xD2);
+    to_engine[3] = emit_jcc(jit, COND_E);
+    emit8(jit, 0xFF);               // jmp rdx
+    emit8(jit, 0xE2);
+
+    for (int i = 0; i < (int)(sizeof(to_engine) / sizeof(to_engine[0])); i++)
+    {
+        patch_rel32(to_engine[i], jit->code->epilogue);
+    }
+    return;
+}
+
+/**
+ * Emits an exit back to the engine after the instruction at the given index,
+ * returning the budget for the instructions in the block that did not run.
+ * The PC is set to the given address, unless update_pc is false.
+ **/
+static void emit_stop_exit(jit_compiler_t *jit, uint32_t index, bool update_pc,
+        uint32_t pc)
+{
+    write_back_guests(jit);
+    if (update_pc) {
+        emit_set_pc(jit, pc);
+    }
+    uint32_t unused = jit->block->num_instrs - index - 1;
+    if (unused != 0) {
+        emit_budget_op(jit, ALU_ADD, unused);
+    }
+    patch_rel32(emit_jmp(jit), jit->code->epilogue);
+    return;
+}
+
+// Leaves the block if the processor was halted by the last call
+static void emit_halt_check(jit_compiler_t *jit, uint32_t index,
+        bool update_pc, uint32_t pc)
+{
+    // cmp byte [rbx + offsetof(halted)], 0
+    emit8(jit, 0x80);
+    emit8(jit, 0xBB);
+    emit32(jit, offsetof(cpu_state_t, halted));
+    emit8(jit, 0x00);
+
+    uint8_t *skip = emit_jcc(jit, COND_E);
+    emit_stop_exit(jit, index, update_pc, pc);
+    patch_rel32(skip, jit->pos);
+    return;
+}
+
+// Leaves the block if the last call wrote to the text segment
+static void emit_stale_check(jit_compiler_t *jit, uint32_t index,
+        bool update_pc, uint32_t pc)
+{
+    // mov rax, &stale; cmp byte [rax], 0
+    emit_mov_imm64(jit, RAX, (uintptr_t)&jit->cache->blocks->stale);
+    emit8(jit, 0x80);
+    emit8(jit, 0x38);
+    emit8(jit, 0x00);
+
+    uint8_t *skip = emit_jcc(jit, COND_E);
+    emit_stop_exit(jit, index, update_pc, pc);
+    patch_rel32(skip, jit->pos);
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * Block Compilation
+ *----------------------------------------------------------------------------*/
+
+// Emits an integer R-type operation, leaving the result in eax
+static void emit_rtype(jit_compiler_t *jit, const block_op_t *op)
+{
+    load_guest(jit, RAX, op->rs1);
+    load_guest(jit, RCX, op->rs2);
+    switch ((instr_op_t)op->op)
+    {
+        case INSTR_ADD:     emit_op_rr(jit, 0x01, RCX, RAX); break;
+        case INSTR_SUB:     emit_op_rr(jit, 0x29, RCX, RAX); break;
+        case INSTR_XOR:     emit_op_rr(jit, 0x31, RCX, RAX); break;
+        case INSTR_OR:      emit_op_rr(jit, 0x09, RCX, RAX); break;
+        case INSTR_AND:     emit_op_rr(jit, 0x21, RCX, RAX); break;
+
+        // The host masks the shift amount to 5 bits, as RISC-V does
+        case INSTR_SLL:     emit_shift_cl(jit, SHIFT_SHL, RAX); break;
+        case INSTR_SRL:     emit_shift_cl(jit, SHIFT_SHR, RAX); break;
+        case INSTR_SRA:     emit_shift_cl(jit, SHIFT_SAR, RAX); break;
+
+        case INSTR_SLT:
+            emit_op_rr(jit, 0x39, RCX, RAX);
+            emit_setcc_eax(jit, COND_L);
+            break;
+
+        case INSTR_SLTU:
+            emit_op_rr(jit, 0x39, RCX, RAX);
+            emit_setcc_eax(jit, COND_B);
+            break;
+
+        default:
+            break;
+    }
+    return;
+}
+
+// Emits an integer I-type operation, leaving the result in eax
+static void emit_itype(jit_compiler_t *jit, const block_op_t *op)
+{
+    uint32_t imm = (uint32_t)op->imm;
+    load_guest(jit, RAX, op->rs1);
+    switch ((instr_op_t)op->op)
+    {
+        case INSTR_ADDI:    emit_alu_imm(jit, ALU_ADD, RAX, imm); break;
+        case INSTR_XORI:    emit_alu_imm(jit, ALU_XOR, RAX, imm); break;
+        case INSTR_ORI:     emit_alu_imm(jit, ALU_OR, RAX, imm); break;
+        case INSTR_ANDI:    emit_alu_imm(jit, ALU_AND, RAX, imm); break;
+        case INSTR_SLLI:    emit_shift_imm(jit, SHIFT_SHL, RAX, imm); break;
+        case INSTR_SRLI:    emit_shift_imm(jit, SHIFT_SHR, RAX, imm); break;
+        case INSTR_SRAI:    emit_shift_imm(jit, SHIFT_SAR, RAX, imm); break;
+
+        case INSTR_SLTI:
+            emit_alu_imm(jit, ALU_CMP, RAX, imm);
+            emit_setcc_eax(jit, COND_L);
+            break;
+
+        case INSTR_SLTIU:
+            emit_alu_imm(jit, ALU_CMP, RAX, imm);
+            emit_setcc_eax(jit, COND_B);
+            break;
+
+        default:
+            break;
+    }
+    return;
+}
+
+// Emits a conditional branch, which ends the block with two direct exits
+static void emit_branch(jit_compiler_t *jit, const block_op_t *op, uint32_t pc)
+{
+    host_cond_t cond;
+    switch ((instr_op_t)op->op)
+    {
+        case INSTR_BEQ:     cond = COND_E; break;
+        case INSTR_BNE:     cond = COND_NE; break;
+        case INSTR_BLT:     cond = COND_L; break;
+        case INSTR_BGE:     cond = COND_GE; break;
+        case INSTR_BLTU:    cond = COND_B; break;
+        default:            cond = COND_AE; break;
+    }
+
+    load_guest(jit, RAX, op->rs1);
+    load_guest(jit, RCX, op->rs2);
+    emit_op_rr(jit, 0x39, RCX, RAX);
+    uint8_t *taken = emit_jcc(jit, cond);
+    emit_direct_exit(jit, pc + sizeof(uint32_t));
+    patch_rel32(taken, jit->pos);
+    emit_direct_exit(jit, pc + (uint32_t)op->imm);
+    return;
+}
+
+/**
+ * Emits an operation that is carried out by its handler. The held guest
+ * registers are written back before the call, and reloaded after it, since
+ * the handler works on the CPU state directly.
+ **/
+static void emit_handler_call(jit_compiler_t *jit, uint32_t index, uint32_t pc)
+{
+    const decoded_instr_t *decoded = decode_cache_lookup(jit->cache, pc);
+
+    write_back_guests(jit);
+    emit_set_pc(jit, pc);
+    emit_cpu_state_arg(jit);
+    emit_mov_imm64(jit, RSI, (uintptr_t)decoded);
+    emit_call(jit, (uintptr_t)decoded->handler);
+    reload_guests(jit);
+
+    // The handler updates the PC itself, including when it halts
+    emit_halt_check(jit, index, false, 0);
+    emit_stale_check(jit, index, false, 0);
+    if (block_is_terminator(decoded->op)) {
+        emit_stop_exit(jit, index, false, 0);
+    }
+    return;
+}
+
+// Emits the code for the operation at the given index in the block
+static void emit_op(jit_compiler_t *jit, uint32_t index)
+{
+    const block_op_t *op = &jit->block->ops[index];
+    uint32_t pc = jit->block->start_pc + index * sizeof(uint32_t);
+    uint32_t imm = (uint32_t)op->imm;
+
+    switch ((instr_op_t)op->op)
+    {
+        case INSTR_ADD: case INSTR_SUB: case INSTR_SLL: case INSTR_SLT:
+        case INSTR_SLTU: case INSTR_XOR: case INSTR_SRL: case INSTR_SRA:
+        case INSTR_OR: case INSTR_AND:
+            if (op->rd != 0) {
+                emit_rtype(jit, op);
+                store_guest(jit, op->rd, RAX);
+            }
+            break;
+
+        case INSTR_ADDI: case INSTR_SLTI: case INSTR_SLTIU: case INSTR_XORI:
+        case INSTR_ORI: case INSTR_ANDI: case INSTR_SLLI: case INSTR_SRLI:
+        case INSTR_SRAI:
+            if (op->rd != 0) {
+                emit_itype(jit, op);
+                store_guest(jit, op->rd, RAX);
+            }
+            break;
+
+        case INSTR_LUI:
+        case INSTR_AUIPC:
+        case INSTR_LI:
+            emit_mov_imm(jit, RAX, (op->op == INSTR_AUIPC) ? pc + imm : imm);
+            store_guest(jit, op->rd, RAX);
+            break;
+
+        // Operations that the decoder specializes instructions to
+        case INSTR_NOP:
+            break;
+
+        case INSTR_JUMP:
+            emit_direct_exit(jit, pc + imm);
+            break;
+
+        // A faulting load or store halts without advancing the PC
+        case INSTR_LW:
+            load_guest(jit, RSI, op->rs1);
+            emit_alu_imm(jit, ALU_ADD, RSI, imm);
+            emit_cpu_state_arg(jit);
+            emit_call(jit, (uintptr_t)mem_read32);
+            emit_halt_check(jit, index, true, pc);
+            store_guest(jit, op->rd, RAX);
+            break;
+
+        case INSTR_SW:
+            load_guest(jit, RSI, op->rs1);
+            emit_alu_imm(jit, ALU_ADD, RSI, imm);
+            load_guest(jit, RDX, op->rs2);
+            emit_cpu_state_arg(jit);
+            emit_call(jit, (uintptr_t)mem_write32);
+            emit_halt_check(jit, index, true, pc);
+            emit_stale_check(jit, index, true, pc + sizeof(uint32_t));
+            break;
+
+        case INSTR_BEQ: case INSTR_BNE: case INSTR_BLT: case INSTR_BGE:
+        case INSTR_BLTU: case INSTR_BGEU:
+            emit_branch(jit, op, pc);
+            break;
+
+        case INSTR_JAL:
+            emit_mov_imm(jit, RAX, pc + sizeof(uint32_t));
+            store_guest(jit, op->rd, RAX);
+            emit_direct_exit(jit, pc + imm);
+            break;
+
+        case INSTR_JALR:
+            load_guest(jit, RAX, op->rs1);
+            emit_alu_imm(jit, ALU_ADD, RAX, imm);
+            emit_alu_imm(jit, ALU_AND, RAX, ~(uint32_t)1);
+            emit_mov_imm(jit, RCX, pc + sizeof(uint32_t));
+            store_guest(jit, op->rd, RCX);
+            write_back_guests(jit);
+            emit_op_state(jit, 0x89, RAX, offsetof(cpu_state_t, pc));
+            emit_indirect_exit(jit);
+            break;
+
+        default:
+            emit_handler_call(jit, index, pc);
+            break;
+    }
+    return;
+}
+
+/**
+ * Emits the shared sequence that returns from native code to the engine, with
+ * the remaining budget, at the start of a new code cache.
+ **/
+static void emit_epilogue(jit_compiler_t *jit)
+{
+    jit->code->epilogue = jit->pos;
+    emit8(jit, 0x8B);               // mov eax, [rsp]
+    emit8(jit, 0x04);
+    emit8(jit, 0x24);
+    emit8(jit, 0x48);               // add rsp, 8
+    emit8(jit, 0x83);
+    emit8(jit, 0xC4);
+    emit8(jit, 0x08);
+    emit8(jit, 0x41);               // pop r15
+    emit8(jit, 0x5F);
+    emit8(jit, 0x41);               // pop r14
+    emit8(jit, 0x5E);
+    emit8(jit, 0x41);               // pop r13
+    emit8(jit, 0x5D);
+    emit8(jit, 0x41);               // pop r12
+    emit8(jit, 0x5C);
+    emit8(jit, 0x5D);               // pop rbp
+    emit8(jit, 0x5B);               // pop rbx
+    emit8(jit, 0xC3);               // ret
+    return;
+}
+
+/**
+ * Emits the entry sequence for a block called from the engine, which saves
+ * the callee-saved registers, and keeps the CPU state in rbx and the budget on
+ * the stack. The stack stays 16-byte aligned for calls into the simulator.
+ **/
+static void emit_prologue(jit_compiler_t *jit)
+{
+    emit8(jit, 0x53);               // push rbx
+    emit8(jit, 0x55);               // push rbp
+    emit8(jit, 0x41);               // push r12
+    emit8(jit, 0x54);
+    emit8(jit, 0x41);               // push r13
+    emit8(jit, 0x55);
+    emit8(jit, 0x41);               // push r14
+    emit8(jit, 0x56);
+    emit8(jit, 0x41);               // push r15
+    emit8(jit, 0x57);
+    emit8(jit, 0x48);               // sub rsp, 8
+    emit8(jit, 0x83);
+    emit8(jit, 0xEC);
+    emit8(jit, 0x08);
+    emit8(jit, 0x48);               // mov rbx, rdi
+    emit8(jit, 0x89);
+    emit8(jit, 0xFB);
+    emit8(jit, 0x89);               // mov [rsp], esi
+    emit8(jit, 0x34);
+    emit8(jit, 0x24);
+    return;
+}
+
+/**
+ * Compiles the given block into the code cache of its predecoded segment.
+ * If the code cache is full, the blocks are flushed instead, and the block is
+ * compiled again once it is hot. If the host does not allow the code cache,
+ * the block is left uncompiled. Exits on error.
+ **/
+static void compile_block(decode_cache_t *cache, block_t *block)
+{
+    block_table_t *table = cache->blocks;
+    if (jit_unavailable) {
+        return;
+    } else if (table->code == NULL) {
+        uint8_t *base = mmap(NULL, JIT_CODE_SIZE, PROT_READ | PROT_WRITE,
+                MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (base == MAP_FAILED) {
+            jit_disable(table, errno);
+            return;
+        }
+
+        table->code = malloc(sizeof(*table->code));
+        if (table->code == NULL) {
+            fprintf(stderr, "Error: Unable to allocate memory for the JIT "
+                    "code cache.\n");
+            exit(ENOMEM);
+        }
+        table->code->base = base;
+        table->code->used = 0;
+        table->code->last_link = NULL;
+
+        jit_compiler_t jit = { .code = table->code, .pos = table->code->base };
+        emit_epilogue(&jit);
+        table->code->used = jit.pos - table->code->base;
+    } else if (table->code->used + JIT_MAX_BLOCK_SIZE > JIT_CODE_SIZE) {
+        table->stale = true;
+        return;
+    } else {
+        int rc = jit_code_protect(table->code, true);
+        if (rc < 0) {
+            jit_disable(table, -rc);
+            return;
+        }
+    }
+
+    // The code cache is writable here, and must be executable again on return
+    jit_code_t *code = table->code;
+
+    jit_compiler_t jit = {
+        .code = code,
+        .cache = cache,
+        .block = block,
+        .pos = code->base + code->used,
+    };
+    allocate_host_regs(&jit);
+
+    block->native = jit.pos;
+    emit_prologue(&jit);
+
+    /* Blocks linked to this one jump here, past the prologue. Leave the block
+     * if the rest of the budget cannot cover it. */
+    block->native_body = jit.pos;
+    emit8(&jit, 0x81);              // cmp dword [rsp], num_instrs
+    emit8(&jit, 0x3C);
+    emit8(&jit, 0x24);
+    emit32(&jit, block->num_instrs);
+    uint8_t *enough = emit_jcc(&jit, COND_GE);
+    emit_set_pc(&jit, block->start_pc);
+    patch_rel32(emit_jmp(&jit), code->epilogue);
+    patch_rel32(enough, jit.pos);
+    emit_budget_op(&jit, ALU_SUB, block->num_instrs);
+    reload_guests(&jit);
+
+    for (uint32_t i = 0; i < block->num_instrs; i++)
+    {
+        emit_op(&jit, i);
+    }
+
+    // A block without a control transfer falls through to the next one
+    if (!block_is_terminator(block->ops[block->num_instrs - 1].op)) {
+        emit_direct_exit(&jit, block->start_pc +
+                block->num_instrs * sizeof(uint32_t));
+    }
+
+    code->used = jit.pos - code->base;
+    int rc = jit_code_protect(code, false);
+    if (rc < 0) {
+        block->native = NULL;
+        block->native_body = NULL;
+        jit_disable(table, -rc);
+    }
+    return;
+}
+
+/*----------------------------------------------------------------------------
+ * JIT Engine
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Simulates up to max_instrs cycles on the CPU with the JIT engine.
+ *
+ * This has the same effect as calling process_instruction max_instrs times.
+ * Blocks run in the basic-block engine until they are hot, after which they
+ * are compiled and run as native code. Simulation stops early if the
+ * processor is halted.
+ **/
+int process_instructions_jit(cpu_state_t *cpu_state, int max_instrs)
+{
+    decode_cache_t *cache = cpu_state->decode_cache;
+    int executed = 0;
+
+    while (executed < max_instrs && !cpu_state->halted)
+    {
+        // Discard the translations once the text segment has been written
+        if (cache != NULL && cache->blocks != NULL && cache->blocks->stale) {
+            block_table_free(cache);
+        }
+
+        /* Instructions outside the predecoded segment, and blocks that would
+         * overrun the budget, are run one at a time by the reference engine. */
+        block_t *block = block_lookup(cache, cpu_state->pc);
+        if (block == NULL || (int)block->num_instrs > max_instrs - executed) {
+            process_instruction(cpu_state);
+            executed += 1;
+            continue;
+        }
+
+        if (block->native == NULL) {
+            block->exec_count += 1;
+            if (block->exec_count >= JIT_HOT_THRESHOLD) {
+                compile_block(cache, block);
+            }
+        }
+        if (block->native == NULL) {
+            block_run(cpu_state, cache, block, &executed);
+            continue;
+        }
+
+        // Function pointers cannot be converted from object pointers directly
+        jit_code_t *code = cache->blocks->code;
+        int (*native)(cpu_state_t *, int) = (int (*)(cpu_state_t *, int))
+                (uintptr_t)block->native;
+        code->last_link = NULL;
+        executed = max_instrs - native(cpu_state, max_instrs - executed);
+
+        // Link the direct exit that was taken to its target, once compiled
+        if (code->last_link != NULL && !cache->blocks->stale &&
+                !cpu_state->halted) {
+            block_t *next = block_lookup(cache, cpu_state->pc);
+            if (next != NULL && next->native != NULL) {
+                int rc = jit_code_protect(code, true);
+                if (rc == 0) {
+                    patch_rel32(code->last_link, next->native_body);
+                    rc = jit_code_protect(code, false);
+                }
+                if (rc < 0) {
+                    jit_disable(cache->blocks, -rc);
+                }
+            }
+        }
+    }
+
+    return executed;
+}
+
+#else /* !defined(__x86_64__) */
+
+/**
+ * Unmaps the given native code cache. Nothing is ever compiled on this host.
+ **/
+void jit_code_free(struct jit_code *code)
+{
+    (void)code;
+    return;
+}
+
+/**
+ * Simulates up to max_instrs cycles on the CPU with the JIT engine. There is
+ * no native code generator for this host, so the basic-block engine is used.
+ **/
+int process_instructions_jit(cpu_state_t *cpu_state, int max_instrs)
+{
+    return process_instructions_block(cpu_state, max_instrs);
+}
+
+#endif /* defined(__x86_64__) */
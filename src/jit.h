@@ -0,0 +1,33 @@
+/**
+ * jit.h
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the interface to the just-in-time compiler, which
+ * translates hot basic blocks into native x86-64 code.
+ **/
+
+#ifndef JIT_H_
+#define JIT_H_
+
+/*----------------------------------------------------------------------------
+ * Definitions
+ *----------------------------------------------------------------------------*/
+
+// The native code cache for the compiled blocks of a text segment
+struct jit_code;
+
+/*----------------------------------------------------------------------------
+ * Interface
+ *----------------------------------------------------------------------------*/
+
+/**
+ * Unmaps the given native code cache, discarding the code for every block
+ * compiled into it. The code cache may be NULL, in which case nothing happens.
+ **/
+void jit_code_free(struct jit_code *code);
+
+#endif /* JIT_H_ */
@@ -33,15 +33,15 @@
  *----------------------------------------------------------------------------*/
 
 // Standard Includes
-#include <stdio.h>              // Printf and related functions
-#include <stdbool.h>            // Boolean type and definitions
+#include <stddef.h>             // Definition of NULL
+#include <stdint.h>             // Fixed-size integral types
 
 // 18-447 Simulator Includes
-#include <riscv_isa.h>          // Definition of RISC-V opcodes, ISA registers
-#include <riscv_abi.h>          // ABI registers and definitions
 #include <sim.h>                // Definitions for the simulator
 #include <memory.h>             // Interface to the processor memory
-#include <register_file.h>      // Interface to the register file
+
+// Local Includes
+#include "decode.h"             // Predecoded instructions and the decoder
 
 /**
  * Simulates a single cycle on the CPU, updating the CPU's state as needed.
@@ -62,128 +62,80 @@
  **/
 void process_instruction(cpu_state_t *cpu_state)
 {
-    // Fetch the 4-bytes for the current instruction
-    uint32_t instr = mem_read32(cpu_state, cpu_state->pc);
-
-    // Decode the opcode, 7-bit function code, and registers
-    opcode_t opcode = instr & 0x7F;
-    funct7_t funct7 = (instr >> 25) & 0x7F;
-    riscv_isa_reg_t rs1 = (instr >> 15) & 0x1F;
-    riscv_isa_reg_t rs2 = (instr >> 20) & 0x1F;
-    riscv_isa_reg_t rd = (instr >> 7) & 0x1F;
+    /* Look up the predecoded instruction at the PC. If the PC lies outside of
+     * the predecoded text segment, fetch and decode the instruction
+     * directly. */
+    decoded_instr_t fetched;
+    const decoded_instr_t *instr = decode_cache_lookup(cpu_state->decode_cache,
+            cpu_state->pc);
+    if (instr == NULL) {
+        uint32_t instr_word = mem_fetch32(cpu_state, cpu_state->pc);
+        if (cpu_state->halted) {
+            return;
+        }
 
-    /* Decode the instruction as an I-type instruction, sign extending the
-     * immediate value. */
-    itype_int_funct3_t itype_funct3 = (instr >> 12) & 0x7;
-    int32_t itype_imm = ((int32_t)instr) >> 20;
+        decode_instruction(instr_word, &fetched);
+        instr = &fetched;
+    }
 
-    // Decode the instruction as an R-type instruction
-    rtype_funct3_t rtype_funct3 = (instr >> 12) & 0x7;
+    // Carry out the actions for the instruction, which also updates the PC
+    instr->handler(cpu_state, instr);
+    return;
+}
 
-    // Decode the 12-bit function code for system instructions
-    itype_funct12_t sys_funct12 = (instr >> 20) & 0xFFF;
+/**
+ * Simulates a batch of up to max_instrs cycles on the CPU.
+ *
+ * This runs the instructions with the CPU's selected engine in a single tight
+ * loop, and adds the number retired to the cycle count. The interrupt flag is
+ * only checked before and after the batch.
+ **/
+sim_result_t process_instructions(cpu_state_t *cpu_state, int max_instrs)
+{
+    sim_result_t result = { .retired = 0, .stop = SIM_STOP_BUDGET };
+    volatile bool *interrupt = cpu_state->interrupt;
+
+    if (cpu_state->halted) {
+        result.stop = SIM_STOP_HALTED;
+        return result;
+    } else if (interrupt != NULL && *interrupt) {
+        result.stop = SIM_STOP_INTERRUPTED;
+        return result;
+    }
 
-    switch (opcode)
+    switch (cpu_state->engine)
     {
-        // General R-Type arithmetic operation
-        case OP_OP: {
-            switch (rtype_funct3)
-            {
-                // 3-bit function code for add or subtract
-                case FUNCT3_ADD_SUB: {
-                    switch (funct7)
-                    {
-                        // 7-bit function code for typical integer instructions
-                        case FUNCT7_INT: {
-                            uint32_t sum = register_read(cpu_state, rs1) +
-                                    register_read(cpu_state, rs2);
-                            register_write(cpu_state, rd, sum);
-                            cpu_state->pc = cpu_state->pc + sizeof(instr);
-                            break;
-                        }
-
-                        default: {
-                            fprintf(stderr, "Encountered unknown/unimplemented "
-                                    "7-bit function code 0x%01x. Halting "
-                                    "simulation.\n", funct7);
-                            cpu_state->halted = true;
-                            break;
-                        }
-                    }
-                    break;
-                }
+        case SIM_ENGINE_THREADED:
+            result.retired = process_instructions_threaded(cpu_state,
+                    max_instrs);
+            break;
 
-                default: {
-                    fprintf(stderr, "Encountered unknown/unimplemented "
-                            "3-bit rtype function code 0x%01x. Halting "
-                            "simulation.\n",
-                            rtype_funct3);
-                    cpu_state->halted = true;
-                    break;
-                }
-            }
+        case SIM_ENGINE_BLOCK:
+            result.retired = process_instructions_block(cpu_state, max_instrs);
             break;
-        }
 
-        // General I-type arithmetic operation
-        case OP_IMM: {
-            switch (itype_funct3)
-            {
-                // 3-bit function code for ADDI
-                case FUNCT3_ADDI: {
-                    uint32_t sum = register_read(cpu_state, rs1) + itype_imm;
-                    register_write(cpu_state, rd, sum);
-                    cpu_state->pc = cpu_state->pc + sizeof(instr);
-                    break;
-                }
+        case SIM_ENGINE_JIT:
+            result.retired = process_instructions_jit(cpu_state, max_instrs);
+            break;
 
-                default: {
-                    fprintf(stderr, "Encountered unknown/unimplemented 3-bit "
-                            "itype function code 0x%01x. Halting simulation.\n",
-                            rtype_funct3);
-                    cpu_state->halted = true;
-                    break;
-                }
-            }
+        case SIM_ENGINE_AOT:
+            result.retired = process_instructions_aot(cpu_state, max_instrs);
             break;
-        }
 
-        // General system operation
-        case OP_SYSTEM: {
-            switch (sys_funct12)
+        default:
+            while (result.retired < max_instrs && !cpu_state->halted)
             {
-                // 12-bit function code for ECALL
-                case FUNCT12_ECALL: {
-                    /* FIXME: To actually support syscalls, the argument
-                     * register a0 must be read from the register value, and its
-                     * value must equal 0xa to terminate simulation. */
-                    uint32_t a0_value = ECALL_ARG_HALT;
-                    if (a0_value == ECALL_ARG_HALT) {
-                        fprintf(stdout, "ECALL invoked with halt argument, "
-                                "halting the simulator.\n");
-                        cpu_state->halted = true;
-                    }
-                    break;
-                }
-
-                default: {
-                    fprintf(stderr, "Encountered unknown/unimplemented 12-bit "
-                            "system function code 0x%03x. Halting "
-                            "simulation.\n", sys_funct12);
-                    cpu_state->halted = true;
-                    break;
-                }
+                process_instruction(cpu_state);
+                result.retired += 1;
             }
             break;
-        }
-
-        default: {
-            fprintf(stderr, "Encountered unknown opcode 0x%02x. Halting "
-                    "simulation.\n", opcode);
-            cpu_state->halted = true;
-            break;
-        }
     }
+    cpu_state->cycle += result.retired;
 
-    return;
+    if (cpu_state->halted) {
+        result.stop = SIM_STOP_HALTED;
+    } else if (interrupt != NULL && *interrupt) {
+        result.stop = SIM_STOP_INTERRUPTED;
+    }
+    return result;
 }
@@ -0,0 +1,297 @@
+/**
+ * threaded.c
+ *
+ * RISC-V 32-bit Instruction Level Simulator
+ *
+ * ECE 18-447
+ * Carnegie Mellon University
+ *
+ * This file contains the threaded-code execution engine for the simulator.
+ *
+ * Instead of returning to a dispatch loop after each instruction, the code for
+ * each operation looks up the next predecoded instruction and jumps straight to
+ * the code for its operation through a table of label addresses (computed
+ * goto). This gives each operation its own indirect branch, which the host's
+ * branch predictor can learn separately. The engine runs over the same
+ * predecoded text segment as process_instruction, which remains the reference
+ * engine, and falls back to it for any instruction outside that segment.
+ *
+ * The code for the computations and branches is generated from the ISA table.
+ * Common instruction sequences that the decoder has fused, such as constant
+ * materialization and function prologues, are carried out as a single
+ * operation, which saves the dispatches between their instructions.
+ **/
+
+// Standard Includes
+#include <stdbool.h>            // Boolean type and definitions
+#include <stddef.h>             // Definition of NULL
+#include <stdint.h>             // Fixed-size integral types
+
+// 18-447 Simulator Includes
+#include <riscv_isa.h>          // Definition of RISC-V registers
+#include <sim.h>                // Definitions for the simulator
+#include <memory.h>             // Interface to the processor memory
+
+// Local Includes
+#include "decode.h"             // Predecoded instructions and the decoder
+#include "isa_table.h"          // The table of instructions in the ISA
+
+/* Taking the address of a label and jumping to it are GNU extensions, which
+ * are what this engine is built on. */
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+/**
+ * Runs up to max_instrs instructions with the threaded-code engine, stopping
+ * early if the processor is halted. Returns the number of instructions
+ * executed, which the caller is responsible for adding to the cycle count.
+ **/
+int process_instructions_threaded(cpu_state_t *cpu_state, int max_instrs)
+{
+    // The code for each operation, indexed by the decoded operation
+    static const void *const OP_LABELS[INSTR_NUM_OPS] = {
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+        [INSTR_##NAME]          = &&do_##name,
+        RV32I_ALU_OPS(X)
+        RV32I_BRANCH_OPS(X)
+#undef X
+        [INSTR_LB]              = &&do_handler,
+        [INSTR_LH]              = &&do_handler,
+        [INSTR_LW]              = &&do_lw,
+        [INSTR_LBU]             = &&do_handler,
+        [INSTR_LHU]             = &&do_handler,
+        [INSTR_SB]              = &&do_handler,
+        [INSTR_SH]              = &&do_handler,
+        [INSTR_SW]              = &&do_sw,
+        [INSTR_JAL]             = &&do_jal,
+        [INSTR_JALR]            = &&do_jalr,
+        [INSTR_ECALL]           = &&do_handler,
+        [INSTR_NOP]             = &&do_nop,
+        [INSTR_LI]              = &&do_li,
+        [INSTR_JUMP]            = &&do_jump,
+        [INSTR_UNKNOWN_OPCODE]  = &&do_handler,
+        [INSTR_UNKNOWN_FUNCT3]  = &&do_handler,
+        [INSTR_UNKNOWN_FUNCT7]  = &&do_handler,
+        [INSTR_UNKNOWN_FUNCT12] = &&do_handler,
+    };
+
+    // The code for each fused sequence, indexed by the kind of fusion
+    static const void *const FUSION_LABELS[] = {
+        [FUSION_LUI_ADDI]       = &&fuse_lui_addi,
+        [FUSION_AUIPC_JALR]     = &&fuse_auipc_jalr,
+        [FUSION_SLT_BRANCH]     = &&fuse_slt_branch,
+        [FUSION_SP_STORES]      = &&fuse_sp_stores,
+    };
+
+    // Keep the hot parts of the CPU state in locals while running
+    const decode_cache_t *cache = cpu_state->decode_cache;
+    uint32_t *regs = cpu_state->registers;
+    uint32_t pc = cpu_state->pc;
+    const decoded_instr_t *instr;
+    int executed = 0;
+
+/* Fetches the predecoded instruction at the PC, and jumps to the code for its
+ * operation. Instructions outside the predecoded segment are run by the
+ * reference engine instead. */
+#define DISPATCH() \
+    do { \
+        if (executed >= max_instrs) { \
+            goto done; \
+        } \
+        executed += 1; \
+        instr = decode_cache_lookup(cache, pc); \
+        if (instr == NULL) { \
+            goto do_fallback; \
+        } \
+        goto *OP_LABELS[instr->op]; \
+    } while (0)
+
+/* Writes the destination register and moves on to the next sequential
+ * instruction. The decoder turns computations that write x0 into no-ops, so
+ * the destination is never x0 here. */
+#define WRITE_RD(value) \
+    do { \
+        regs[instr->rd] = (value); \
+        pc += sizeof(uint32_t); \
+        DISPATCH(); \
+    } while (0)
+
+/* Carries out the fused sequence starting at the current instruction, if it
+ * starts one, and if the whole sequence fits within the instruction budget.
+ * The first instruction of the sequence has already been counted. The check is
+ * left out of operations that can never start a sequence. */
+#define FUSE(op) \
+    do { \
+        if (fusion_can_start(op) && instr->fusion != FUSION_NONE && \
+                executed + instr->fused_len - 1 <= max_instrs) { \
+            goto *FUSION_LABELS[instr->fusion]; \
+        } \
+    } while (0)
+
+// The operands of the current instruction, as the ISA table refers to them
+#define RS1     (regs[instr->rs1])
+#define RS2     (regs[instr->rs2])
+#define IMM     ((uint32_t)instr->imm)
+#define PC      pc
+
+    DISPATCH();
+
+    // Computations, generated from the ISA table
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+do_##name: \
+    FUSE(INSTR_##NAME); \
+    WRITE_RD(action);
+    RV32I_ALU_OPS(X)
+#undef X
+
+    /* Conditional branches, generated from the ISA table. The taken and
+     * not-taken paths each dispatch the next instruction separately, so that
+     * the host can predict the two paths separately. */
+#define X(NAME, name, format, opcode, funct3, funct7, action) \
+do_##name: \
+    if (action) { \
+        pc += IMM; \
+        DISPATCH(); \
+    } \
+    pc += sizeof(uint32_t); \
+    DISPATCH();
+    RV32I_BRANCH_OPS(X)
+#undef X
+
+    // Operations that the decoder specializes instructions to
+do_nop:
+    pc += sizeof(uint32_t);
+    DISPATCH();
+
+do_li:      WRITE_RD(IMM);
+
+do_jump:
+    pc += IMM;
+    DISPATCH();
+
+    // Word loads and stores, which can halt the processor on a bad address
+do_lw: {
+    uint32_t value = mem_read32(cpu_state, RS1 + IMM);
+    if (cpu_state->halted) {
+        goto done;
+    }
+    regs[instr->rd] = value;
+    regs[0] = 0;
+    pc += sizeof(uint32_t);
+    DISPATCH();
+}
+
+do_sw:
+    mem_write32(cpu_state, RS1 + IMM, RS2);
+    if (cpu_state->halted) {
+        goto done;
+    }
+    pc += sizeof(uint32_t);
+    DISPATCH();
+
+    // Jumps, which may write x0
+do_jal:
+    regs[instr->rd] = pc + sizeof(uint32_t);
+    regs[0] = 0;
+    pc += IMM;
+    DISPATCH();
+
+do_jalr: {
+    uint32_t target = (RS1 + IMM) & ~(uint32_t)1;
+    regs[instr->rd] = pc + sizeof(uint32_t);
+    regs[0] = 0;
+    pc = target;
+    DISPATCH();
+}
+
+    /* Fused sequences, which carry out the instructions in program order and
+     * count each one of them as retired. The entries of the instructions after
+     * the first are read from the decode cache, since a fused sequence never
+     * extends past the end of the predecoded segment. */
+fuse_lui_addi: {
+    const decoded_instr_t *addi = instr + 1;
+    regs[instr->rd] = IMM;
+    regs[addi->rd] = IMM + (uint32_t)addi->imm;
+    regs[0] = 0;
+    pc += 2 * sizeof(uint32_t);
+    executed += 1;
+    DISPATCH();
+}
+
+fuse_auipc_jalr: {
+    const decoded_instr_t *jalr = instr + 1;
+    uint32_t base = pc + IMM;
+    regs[instr->rd] = base;
+    regs[jalr->rd] = pc + 2 * sizeof(uint32_t);
+    regs[0] = 0;
+    pc = (base + (uint32_t)jalr->imm) & ~(uint32_t)1;
+    executed += 1;
+    DISPATCH();
+}
+
+fuse_slt_branch: {
+    const decoded_instr_t *branch = instr + 1;
+    uint32_t less = (instr->op == INSTR_SLT) ?
+            (int32_t)RS1 < (int32_t)RS2 : RS1 < RS2;
+    bool taken = (branch->op == INSTR_BNE) ? less != 0 : less == 0;
+    regs[instr->rd] = less;
+    pc += sizeof(uint32_t);
+    pc += taken ? (uint32_t)branch->imm : sizeof(uint32_t);
+    executed += 1;
+    DISPATCH();
+}
+
+fuse_sp_stores:
+    regs[REG_X2] += IMM;
+    pc += sizeof(uint32_t);
+    for (int i = 1; i < instr->fused_len; i++)
+    {
+        /* A store may rewrite the rest of the sequence, in which case the
+         * rewritten instructions are dispatched normally. */
+        const decoded_instr_t *store = instr + i;
+        if (store->op != INSTR_SW) {
+            break;
+        }
+
+        executed += 1;
+        mem_write32(cpu_state, regs[store->rs1] + (uint32_t)store->imm,
+                regs[store->rs2]);
+        if (cpu_state->halted) {
+            goto done;
+        }
+        pc += sizeof(uint32_t);
+    }
+    DISPATCH();
+
+    /* Rare operations, such as sub-word memory accesses, system calls, and
+     * undecodable instructions, are carried out by their handlers. */
+do_handler:
+    cpu_state->pc = pc;
+    instr->handler(cpu_state, instr);
+    pc = cpu_state->pc;
+    if (cpu_state->halted) {
+        goto done;
+    }
+    DISPATCH();
+
+    // Instructions outside the predecoded segment use the reference engine
+do_fallback:
+    cpu_state->pc = pc;
+    process_instruction(cpu_state);
+    pc = cpu_state->pc;
+    if (cpu_state->halted) {
+        goto done;
+    }
+    DISPATCH();
+
+done:
+    cpu_state->pc = pc;
+    return executed;
+
+#undef DISPATCH
+#undef WRITE_RD
+#undef FUSE
+#undef RS1
+#undef RS2
+#undef IMM
+#undef PC
+}